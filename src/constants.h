@@ -21,6 +21,7 @@
 #define DEFAULT_SERVER      "localhost"
 #define DEFAULT_PORT        13666
 #define DEFAULT_CONFIG_FILE "/etc/lcd-stuff.conf"
+#define DEFAULT_CACHE_DIR   "/var/cache/lcd-stuff"
 
 #define PRG_NAME            "lcd-stuff"
 #define MAX_LINE_LEN        80
@@ -0,0 +1,459 @@
+/*
+ * This file is part of lcd-stuff.
+ *
+ * lcd-stuff is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License.
+ *
+ * lcd-stuff is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with lcd-stuff; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include <glib.h>
+#include <expat.h>
+
+#include <shared/report.h>
+
+#include "feedparser.h"
+
+/* ---------------------- constants ----------------------------------------- */
+#define VALUE_MAX           1024
+#define HOUR_SEC            (60*60)
+#define DAY_SEC             (24*HOUR_SEC)
+
+/* ---------------------- types --------------------------------------------- */
+enum feed_field {
+    FIELD_NONE,
+    FIELD_TITLE,
+    FIELD_DATE,
+    FIELD_ID,
+    FIELD_LINK,
+    FIELD_TTL,
+    FIELD_UPDATE_PERIOD,
+    FIELD_UPDATE_FREQUENCY,
+    FIELD_SKIP_HOUR,
+    FIELD_SKIP_DAY
+};
+
+static const char *days[] = {
+    "Sunday", "Monday", "Tuesday", "Wednesday", "Thursday", "Friday", "Saturday"
+};
+
+struct feed_parser {
+    XML_Parser          parser;
+    unsigned int        max_items;
+    GPtrArray           *items;         /* struct feed_item */
+    int                 depth;
+    int                 item_depth;     /* depth of the current item, or 0 */
+    int                 field_depth;    /* depth of the current field, or 0 */
+    enum feed_field     field;
+    GString             *value;         /* text of the current field */
+    char                *title;         /* of the current item */
+    bool                title_prefixed; /* e.g. itunes:title, not the headline */
+    char                *date;          /* of the current item */
+    char                *id;            /* of the current item */
+    char                *link;          /* of the current item */
+    bool                in_skip_hours;
+    bool                in_skip_days;
+    int                 ttl;            /* minutes */
+    int                 update_period;  /* seconds */
+    int                 update_frequency;
+    struct feed_hints   hints;
+    bool                done;           /* stopped after max_items */
+    bool                error;
+};
+
+/* -------------------------------------------------------------------------- */
+static const char *local_name(const char *name)
+{
+    const char *colon = strrchr(name, ':');
+
+    return colon ? colon + 1 : name;
+}
+
+/* -------------------------------------------------------------------------- */
+static enum feed_field item_field(const char *name)
+{
+    if (strcmp(name, "title") == 0)
+        return FIELD_TITLE;
+
+    /* RSS 2.0, Dublin Core (RSS 1.0) and Atom */
+    if (strcmp(name, "pubDate") == 0 || strcmp(name, "date") == 0 ||
+            strcmp(name, "updated") == 0 || strcmp(name, "published") == 0)
+        return FIELD_DATE;
+
+    /* RSS guid, Atom id */
+    if (strcmp(name, "guid") == 0 || strcmp(name, "id") == 0)
+        return FIELD_ID;
+    if (strcmp(name, "link") == 0)
+        return FIELD_LINK;
+
+    return FIELD_NONE;
+}
+
+/* -------------------------------------------------------------------------- */
+static enum feed_field channel_field(struct feed_parser *parser, const char *name)
+{
+    if (strcmp(name, "ttl") == 0)
+        return FIELD_TTL;
+
+    /* the syndication module of RSS 1.0 */
+    if (strcmp(name, "updatePeriod") == 0)
+        return FIELD_UPDATE_PERIOD;
+    if (strcmp(name, "updateFrequency") == 0)
+        return FIELD_UPDATE_FREQUENCY;
+
+    if (parser->in_skip_hours && strcmp(name, "hour") == 0)
+        return FIELD_SKIP_HOUR;
+    if (parser->in_skip_days && strcmp(name, "day") == 0)
+        return FIELD_SKIP_DAY;
+
+    return FIELD_NONE;
+}
+
+/* -------------------------------------------------------------------------- */
+static void set_channel_field(struct feed_parser *parser, const char *value)
+{
+    int i;
+
+    switch (parser->field) {
+        case FIELD_TTL:
+            parser->ttl = atoi(value);
+            break;
+
+        case FIELD_UPDATE_PERIOD:
+            if (strcmp(value, "hourly") == 0)
+                parser->update_period = HOUR_SEC;
+            else if (strcmp(value, "daily") == 0)
+                parser->update_period = DAY_SEC;
+            else if (strcmp(value, "weekly") == 0)
+                parser->update_period = 7*DAY_SEC;
+            else if (strcmp(value, "monthly") == 0)
+                parser->update_period = 30*DAY_SEC;
+            else if (strcmp(value, "yearly") == 0)
+                parser->update_period = 365*DAY_SEC;
+            break;
+
+        case FIELD_UPDATE_FREQUENCY:
+            parser->update_frequency = atoi(value);
+            break;
+
+        case FIELD_SKIP_HOUR:
+            /* some use 24 for midnight */
+            i = atoi(value) % 24;
+            if (i >= 0)
+                parser->hints.skip_hours |= 1U << i;
+            break;
+
+        case FIELD_SKIP_DAY:
+            for (i = 0; i < 7; i++)
+                if (g_ascii_strcasecmp(value, days[i]) == 0)
+                    parser->hints.skip_days |= 1U << i;
+            break;
+
+        default:
+            break;
+    }
+}
+
+/* -------------------------------------------------------------------------- */
+/*
+ * Atom has the link in attributes: <link rel="alternate" href="..."/>, the
+ * rel attribute is optional.
+ */
+static char *atom_link(const XML_Char **atts)
+{
+    const char *href = NULL, *rel = NULL;
+    int i;
+
+    for (i = 0; atts[i] && atts[i+1]; i += 2) {
+        if (strcmp(atts[i], "href") == 0)
+            href = atts[i+1];
+        else if (strcmp(atts[i], "rel") == 0)
+            rel = atts[i+1];
+    }
+
+    if (!href || (rel && strcmp(rel, "alternate") != 0))
+        return NULL;
+
+    return g_strdup(href);
+}
+
+/* -------------------------------------------------------------------------- */
+static void start_element(void *data, const XML_Char *name, const XML_Char **atts)
+{
+    struct feed_parser *parser = (struct feed_parser *)data;
+    const char *local = local_name(name);
+
+    parser->depth++;
+
+    if (parser->item_depth == 0) {
+        if (strcmp(local, "item") == 0 || strcmp(local, "entry") == 0)
+            parser->item_depth = parser->depth;
+        else if (strcmp(local, "skipHours") == 0)
+            parser->in_skip_hours = true;
+        else if (strcmp(local, "skipDays") == 0)
+            parser->in_skip_days = true;
+        else if (parser->field == FIELD_NONE) {
+            parser->field = channel_field(parser, local);
+            if (parser->field != FIELD_NONE) {
+                parser->field_depth = parser->depth;
+                g_string_truncate(parser->value, 0);
+            }
+        }
+        return;
+    }
+
+    /* only direct children of the item, and no nested fields */
+    if (parser->field != FIELD_NONE || parser->depth != parser->item_depth + 1)
+        return;
+
+    parser->field = item_field(local);
+    if (parser->field == FIELD_LINK && atts[0]) {
+        if (!parser->link)
+            parser->link = atom_link(atts);
+        parser->field = FIELD_NONE;
+    }
+    if ((parser->field == FIELD_TITLE && parser->title &&
+                (local != name || !parser->title_prefixed)) ||
+            (parser->field == FIELD_DATE && parser->date) ||
+            (parser->field == FIELD_ID && parser->id) ||
+            (parser->field == FIELD_LINK && parser->link))
+        parser->field = FIELD_NONE;     /* the first one wins, a plain title
+                                           over a prefixed one */
+    if (parser->field != FIELD_NONE) {
+        parser->field_depth = parser->depth;
+        g_string_truncate(parser->value, 0);
+    }
+}
+
+/* -------------------------------------------------------------------------- */
+static void end_item(struct feed_parser *parser)
+{
+    struct feed_item *item;
+
+    item = g_new0(struct feed_item, 1);
+    item->title = parser->title ? parser->title : g_strdup("");
+    item->date = parser->date;
+    if (parser->id && *parser->id) {
+        item->id = parser->id;
+        g_free(parser->link);
+    } else {
+        item->id = parser->link;
+        g_free(parser->id);
+    }
+    parser->title = parser->date = parser->id = parser->link = NULL;
+    g_ptr_array_add(parser->items, item);
+
+    /* that's all we need, don't parse (and download) the rest */
+    if (parser->max_items > 0 && parser->items->len >= parser->max_items) {
+        parser->done = true;
+        XML_StopParser(parser->parser, XML_FALSE);
+    }
+}
+
+/* -------------------------------------------------------------------------- */
+static void end_element(void *data, const XML_Char *name)
+{
+    struct feed_parser *parser = (struct feed_parser *)data;
+
+    if (parser->field != FIELD_NONE && parser->depth == parser->field_depth) {
+        char *value = g_strdup(parser->value->str);
+        const char *end;
+
+        /* VALUE_MAX may have cut a character */
+        if (!g_utf8_validate(value, -1, &end))
+            value[end - value] = '\0';
+        g_strstrip(value);
+
+        switch (parser->field) {
+            case FIELD_TTL:
+            case FIELD_UPDATE_PERIOD:
+            case FIELD_UPDATE_FREQUENCY:
+            case FIELD_SKIP_HOUR:
+            case FIELD_SKIP_DAY:
+                set_channel_field(parser, value);
+                g_free(value);
+                break;
+            case FIELD_TITLE:
+                g_free(parser->title);
+                parser->title = value;
+                parser->title_prefixed = local_name(name) != name;
+                break;
+            case FIELD_DATE:
+                parser->date = value;
+                break;
+            case FIELD_ID:
+                parser->id = value;
+                break;
+            case FIELD_LINK:
+                parser->link = value;
+                break;
+            default:
+                g_free(value);
+                break;
+        }
+
+        parser->field = FIELD_NONE;
+        parser->field_depth = 0;
+    } else if (parser->depth == parser->item_depth) {
+        parser->item_depth = 0;
+        end_item(parser);
+    } else if (parser->item_depth == 0) {
+        const char *local = local_name(name);
+
+        if (strcmp(local, "skipHours") == 0)
+            parser->in_skip_hours = false;
+        else if (strcmp(local, "skipDays") == 0)
+            parser->in_skip_days = false;
+    }
+
+    parser->depth--;
+}
+
+/* -------------------------------------------------------------------------- */
+static void character_data(void *data, const XML_Char *s, int len)
+{
+    struct feed_parser *parser = (struct feed_parser *)data;
+
+    /* the text of descriptions and contents is dropped right here */
+    if (parser->field == FIELD_NONE)
+        return;
+
+    if (parser->value->len + len > VALUE_MAX)
+        len = VALUE_MAX - parser->value->len;
+    if (len > 0)
+        g_string_append_len(parser->value, s, len);
+}
+
+/* -------------------------------------------------------------------------- */
+/*
+ * expat only knows UTF-8, UTF-16, ISO-8859-1 and US-ASCII. Other single-byte
+ * encodings like windows-1252 are mapped with iconv.
+ */
+static int unknown_encoding(void *data, const XML_Char *name, XML_Encoding *info)
+{
+    int i;
+
+    for (i = 0; i < 256; i++) {
+        char byte = (char)i;
+        char *utf8;
+
+        utf8 = g_convert(&byte, 1, "UTF-8", name, NULL, NULL, NULL);
+        info->map[i] = utf8 ? (int)g_utf8_get_char(utf8) : -1;
+        g_free(utf8);
+
+        /* unknown to iconv as well */
+        if (i == 'a' && info->map[i] != 'a')
+            return XML_STATUS_ERROR;
+    }
+
+    info->data = NULL;
+    info->convert = NULL;
+    info->release = NULL;
+
+    return XML_STATUS_OK;
+}
+
+/* -------------------------------------------------------------------------- */
+struct feed_parser *feed_parser_new(unsigned int max_items)
+{
+    struct feed_parser *parser;
+
+    parser = g_new0(struct feed_parser, 1);
+    parser->max_items = max_items;
+    parser->items = g_ptr_array_new();
+    parser->value = g_string_sized_new(VALUE_MAX);
+
+    parser->parser = XML_ParserCreate(NULL);
+    XML_SetUserData(parser->parser, parser);
+    XML_SetElementHandler(parser->parser, start_element, end_element);
+    XML_SetCharacterDataHandler(parser->parser, character_data);
+    XML_SetUnknownEncodingHandler(parser->parser, unknown_encoding, NULL);
+
+    return parser;
+}
+
+/* -------------------------------------------------------------------------- */
+bool feed_parser_parse(struct feed_parser *parser, const char *data, size_t len)
+{
+    if (parser->done || parser->error)
+        return false;
+
+    if (XML_Parse(parser->parser, data, len, false) == XML_STATUS_ERROR && !parser->done) {
+        report(RPT_ERR, "Error parsing feed in line %lu: %s",
+               (unsigned long)XML_GetCurrentLineNumber(parser->parser),
+               XML_ErrorString(XML_GetErrorCode(parser->parser)));
+        parser->error = true;
+    }
+
+    return !parser->done && !parser->error;
+}
+
+/* -------------------------------------------------------------------------- */
+GPtrArray *feed_parser_finish(struct feed_parser *parser)
+{
+    if (parser->done)
+        return parser->items;
+    if (parser->error)
+        return NULL;
+
+    if (XML_Parse(parser->parser, NULL, 0, true) == XML_STATUS_ERROR && !parser->done) {
+        report(RPT_ERR, "Error parsing feed: %s",
+               XML_ErrorString(XML_GetErrorCode(parser->parser)));
+        parser->error = true;
+        return NULL;
+    }
+
+    return parser->items;
+}
+
+/* -------------------------------------------------------------------------- */
+void feed_parser_get_hints(struct feed_parser *parser, struct feed_hints *hints)
+{
+    *hints = parser->hints;
+    hints->ttl = MAX(parser->ttl, 0) * 60;
+
+    /* updatePeriod alone means once per period */
+    if (parser->update_period > 0)
+        hints->ttl = MAX(hints->ttl,
+                         parser->update_period / MAX(parser->update_frequency, 1));
+}
+
+/* -------------------------------------------------------------------------- */
+void feed_parser_free(struct feed_parser *parser)
+{
+    unsigned int i;
+
+    if (!parser)
+        return;
+
+    for (i = 0; i < parser->items->len; i++) {
+        struct feed_item *item = g_ptr_array_index(parser->items, i);
+        g_free(item->title);
+        g_free(item->date);
+        g_free(item->id);
+        g_free(item);
+    }
+    g_ptr_array_free(parser->items, true);
+    g_string_free(parser->value, true);
+    g_free(parser->title);
+    g_free(parser->date);
+    g_free(parser->id);
+    g_free(parser->link);
+    XML_ParserFree(parser->parser);
+    g_free(parser);
+}
+
+/* vim: set ts=4 sw=4 et: */
@@ -0,0 +1,101 @@
+/*
+ * This file is part of lcd-stuff.
+ *
+ * lcd-stuff is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License.
+ *
+ * lcd-stuff is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with lcd-stuff; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+#ifndef FEEDPARSER_H
+#define FEEDPARSER_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <glib.h>
+
+/**
+ * @file feedparser.h
+ * @brief Streaming parser for RSS (0.9x, 1.0, 2.0) and Atom feeds.
+ *
+ * The feed is parsed while it is downloaded, no document tree is built.
+ * Only the title, the date and the identity of the items are kept;
+ * descriptions and contents are skipped without being buffered. Once the
+ * configured number of items is complete, the parser asks to stop the
+ * download.
+ */
+
+struct feed_parser;
+
+/**
+ * @brief One item of a feed. All strings are UTF-8.
+ */
+struct feed_item {
+    char            *title;         /**< never NULL */
+    char            *date;          /**< as in the feed or NULL */
+    char            *id;            /**< guid (RSS) or id (Atom), else the
+                                         link, NULL if the item has neither */
+};
+
+/**
+ * @brief What the publisher says about refreshing the feed (RSS only).
+ *
+ * These elements are part of the channel. If they come after the items and
+ * the parser stopped at max_items, they are not seen.
+ */
+struct feed_hints {
+    int             ttl;            /**< seconds the feed stays current, from
+                                         ttl or sy:updatePeriod and
+                                         sy:updateFrequency, 0 if unknown */
+    guint32         skip_hours;     /**< bit n: don't fetch from n o'clock
+                                         (GMT) for an hour (skipHours) */
+    guint8          skip_days;      /**< bit n: don't fetch on day n of the
+                                         week, 0 is Sunday (skipDays) */
+};
+
+/**
+ * @brief Creates a parser.
+ *
+ * @param[in] max_items the number of items after which parsing stops,
+ *            0 for all items
+ * @return the parser
+ */
+struct feed_parser *feed_parser_new(unsigned int max_items);
+
+/**
+ * @brief Parses the next chunk of the feed.
+ *
+ * @return @c true if more data is wanted, @c false if enough items have
+ *         been parsed or if the feed is not well-formed
+ */
+bool feed_parser_parse(struct feed_parser *parser, const char *data, size_t len);
+
+/**
+ * @brief Finishes parsing.
+ *
+ * @return the items (struct feed_item) in feed order, owned by the parser,
+ *         or NULL if the feed was not well-formed
+ */
+GPtrArray *feed_parser_finish(struct feed_parser *parser);
+
+/**
+ * @brief Gets the refresh hints of the feed parsed so far.
+ */
+void feed_parser_get_hints(struct feed_parser *parser, struct feed_hints *hints);
+
+/**
+ * @brief Frees the parser with its items.
+ */
+void feed_parser_free(struct feed_parser *parser);
+
+#endif /* FEEDPARSER_H */
+
+/* vim: set ts=4 sw=4 et: */
@@ -0,0 +1,468 @@
+/*
+ * This file is part of lcd-stuff.
+ *
+ * lcd-stuff is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License.
+ *
+ * lcd-stuff is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with lcd-stuff; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <time.h>
+
+#include <glib.h>
+#include <curl/curl.h>
+
+#include <shared/report.h>
+
+#include "http.h"
+#include "main.h"
+#include "constants.h"
+
+/* ---------------------- constants ----------------------------------------- */
+#define CONNECT_TIMEOUT_SEC     30
+#define TRANSFER_TIMEOUT_SEC    120
+#define MAX_REDIRECTS           5
+#define MAX_CONNECTIONS         8       /* of all modules together */
+#define DNS_CACHE_SEC           300
+#define ACCEPT_ENCODING         "gzip, deflate"
+
+/* ---------------------- types --------------------------------------------- */
+struct http_request {
+    struct http_transfer    *transfer;
+    CURL                    *curl;
+    struct curl_slist       *headers;
+    char                    *etag;          /* of the response */
+    char                    *last_modified; /* of the response */
+    long                    max_age;        /* Cache-Control, or 0 */
+    time_t                  expires;        /* Expires, or 0 */
+    time_t                  date;           /* Date, or 0 */
+    bool                    stopped;        /* by the data function */
+    bool                    slot;           /* holds a connection slot */
+    char                    error[CURL_ERROR_SIZE];
+};
+
+/* ---------------------- variables ----------------------------------------- */
+/*
+ * DNS results, TLS sessions and open connections are shared by all
+ * requests of all modules, so a host that has been asked before gets its
+ * connection reused.
+ */
+static CURLSH           *s_share;
+static GMutex           *s_share_locks[CURL_LOCK_DATA_LAST];
+static GMutex           *s_slots_mutex;
+static unsigned int     s_slots_used;
+
+/* -------------------------------------------------------------------------- */
+static void share_lock(CURL *curl, curl_lock_data data, curl_lock_access access,
+                       void *userptr)
+{
+    g_mutex_lock(s_share_locks[data]);
+}
+
+/* -------------------------------------------------------------------------- */
+static void share_unlock(CURL *curl, curl_lock_data data, void *userptr)
+{
+    g_mutex_unlock(s_share_locks[data]);
+}
+
+/* -------------------------------------------------------------------------- */
+void http_global_init(void)
+{
+    int i;
+
+    curl_global_init(CURL_GLOBAL_ALL);
+
+    for (i = 0; i < CURL_LOCK_DATA_LAST; i++)
+        s_share_locks[i] = g_mutex_new();
+    s_slots_mutex = g_mutex_new();
+
+    s_share = curl_share_init();
+    if (!s_share) {
+        report(RPT_ERR, "curl_share_init failed");
+        return;
+    }
+
+    curl_share_setopt(s_share, CURLSHOPT_LOCKFUNC, share_lock);
+    curl_share_setopt(s_share, CURLSHOPT_UNLOCKFUNC, share_unlock);
+    curl_share_setopt(s_share, CURLSHOPT_SHARE, CURL_LOCK_DATA_DNS);
+    curl_share_setopt(s_share, CURLSHOPT_SHARE, CURL_LOCK_DATA_SSL_SESSION);
+    curl_share_setopt(s_share, CURLSHOPT_SHARE, CURL_LOCK_DATA_CONNECT);
+}
+
+/* -------------------------------------------------------------------------- */
+void http_global_cleanup(void)
+{
+    int i;
+
+    if (s_share)
+        curl_share_cleanup(s_share);
+    s_share = NULL;
+
+    for (i = 0; i < CURL_LOCK_DATA_LAST; i++)
+        g_mutex_free(s_share_locks[i]);
+    g_mutex_free(s_slots_mutex);
+
+    curl_global_cleanup();
+}
+
+/* -------------------------------------------------------------------------- */
+static bool slot_acquire(void)
+{
+    bool ok;
+
+    g_mutex_lock(s_slots_mutex);
+    ok = s_slots_used < MAX_CONNECTIONS;
+    if (ok)
+        s_slots_used++;
+    g_mutex_unlock(s_slots_mutex);
+
+    return ok;
+}
+
+/* -------------------------------------------------------------------------- */
+static void slot_release(void)
+{
+    g_mutex_lock(s_slots_mutex);
+    s_slots_used--;
+    g_mutex_unlock(s_slots_mutex);
+}
+
+/* -------------------------------------------------------------------------- */
+void http_validator_clear(struct http_validator *validator)
+{
+    g_free(validator->etag);
+    g_free(validator->last_modified);
+    validator->etag = NULL;
+    validator->last_modified = NULL;
+}
+
+/* -------------------------------------------------------------------------- */
+time_t http_parse_date(const char *date)
+{
+    return MAX(curl_getdate(date, NULL), (time_t)0);
+}
+
+/* -------------------------------------------------------------------------- */
+static size_t write_body(char *ptr, size_t size, size_t nmemb, void *userdata)
+{
+    struct http_request *request = (struct http_request *)userdata;
+    struct http_transfer *transfer = request->transfer;
+    long code = 0;
+
+    /* error pages are no documents */
+    curl_easy_getinfo(request->curl, CURLINFO_RESPONSE_CODE, &code);
+    if (code < 200 || code >= 300)
+        return size * nmemb;
+
+    if (transfer->data && !transfer->data(transfer, ptr, size * nmemb)) {
+        request->stopped = true;
+        return 0;
+    }
+    if (transfer->body)
+        g_string_append_len(transfer->body, ptr, size * nmemb);
+
+    return size * nmemb;
+}
+
+/* -------------------------------------------------------------------------- */
+static char *header_value(const char *line, size_t len, const char *name)
+{
+    size_t name_len = strlen(name);
+
+    if (len <= name_len || line[name_len] != ':' ||
+            g_ascii_strncasecmp(line, name, name_len) != 0)
+        return NULL;
+
+    return g_strstrip(g_strndup(line + name_len + 1, len - name_len - 1));
+}
+
+/* -------------------------------------------------------------------------- */
+static long parse_max_age(const char *cache_control)
+{
+    const char *max_age = strstr(cache_control, "max-age=");
+
+    /* not "s-maxage", that's for shared caches only */
+    if (!max_age)
+        return 0;
+
+    return MAX(atol(max_age + strlen("max-age=")), 0L);
+}
+
+/* -------------------------------------------------------------------------- */
+static size_t write_header(char *ptr, size_t size, size_t nmemb, void *userdata)
+{
+    struct http_request *request = (struct http_request *)userdata;
+    size_t len = size * nmemb;
+    char *value;
+
+    /* a new response after a redirect */
+    if (len > 5 && strncmp(ptr, "HTTP/", 5) == 0) {
+        g_free(request->etag);
+        g_free(request->last_modified);
+        request->etag = request->last_modified = NULL;
+        request->max_age = 0;
+        request->expires = request->date = 0;
+    } else if ((value = header_value(ptr, len, "ETag"))) {
+        g_free(request->etag);
+        request->etag = value;
+    } else if ((value = header_value(ptr, len, "Last-Modified"))) {
+        g_free(request->last_modified);
+        request->last_modified = value;
+    } else if ((value = header_value(ptr, len, "Cache-Control"))) {
+        request->max_age = parse_max_age(value);
+        g_free(value);
+    } else if ((value = header_value(ptr, len, "Expires"))) {
+        request->expires = http_parse_date(value);
+        g_free(value);
+    } else if ((value = header_value(ptr, len, "Date"))) {
+        request->date = http_parse_date(value);
+        g_free(value);
+    }
+
+    return len;
+}
+
+/* -------------------------------------------------------------------------- */
+static bool request_start(struct http_request *request, long timeout)
+{
+    struct http_validator *validator = request->transfer->validator;
+    CURL *curl;
+    char *tmp;
+
+    curl = request->curl = curl_easy_init();
+    if (!curl) {
+        report(RPT_ERR, "curl_easy_init failed");
+        return false;
+    }
+
+    if (validator && validator->etag) {
+        tmp = g_strdup_printf("If-None-Match: %s", validator->etag);
+        request->headers = curl_slist_append(request->headers, tmp);
+        g_free(tmp);
+    }
+    if (validator && validator->last_modified) {
+        tmp = g_strdup_printf("If-Modified-Since: %s", validator->last_modified);
+        request->headers = curl_slist_append(request->headers, tmp);
+        g_free(tmp);
+    }
+
+    if (request->transfer->body)
+        g_string_truncate(request->transfer->body, 0);
+
+    curl_easy_setopt(curl, CURLOPT_URL, request->transfer->url);
+    curl_easy_setopt(curl, CURLOPT_HTTPHEADER, request->headers);
+    curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, write_body);
+    curl_easy_setopt(curl, CURLOPT_WRITEDATA, request);
+    curl_easy_setopt(curl, CURLOPT_HEADERFUNCTION, write_header);
+    curl_easy_setopt(curl, CURLOPT_HEADERDATA, request);
+    curl_easy_setopt(curl, CURLOPT_ERRORBUFFER, request->error);
+    curl_easy_setopt(curl, CURLOPT_PRIVATE, request);
+    curl_easy_setopt(curl, CURLOPT_FOLLOWLOCATION, 1L);
+    curl_easy_setopt(curl, CURLOPT_MAXREDIRS, (long)MAX_REDIRECTS);
+    curl_easy_setopt(curl, CURLOPT_CONNECTTIMEOUT, MIN(timeout, (long)CONNECT_TIMEOUT_SEC));
+    curl_easy_setopt(curl, CURLOPT_TIMEOUT, timeout);
+    curl_easy_setopt(curl, CURLOPT_USERAGENT, PRG_NAME);
+    /* decompressed by curl while it arrives */
+    curl_easy_setopt(curl, CURLOPT_ACCEPT_ENCODING, ACCEPT_ENCODING);
+    /* curl can't know the TTL of the DNS answer */
+    curl_easy_setopt(curl, CURLOPT_DNS_CACHE_TIMEOUT, (long)DNS_CACHE_SEC);
+    if (s_share)
+        curl_easy_setopt(curl, CURLOPT_SHARE, s_share);
+    /* we have threads, so no SIGALRM for the DNS timeout */
+    curl_easy_setopt(curl, CURLOPT_NOSIGNAL, 1L);
+
+    return true;
+}
+
+/* -------------------------------------------------------------------------- */
+static void request_finish(struct http_request *request, CURLcode err)
+{
+    struct http_transfer *transfer = request->transfer;
+    struct http_validator *validator = transfer->validator;
+    long code = 0;
+
+    transfer->result = HTTP_ERROR;
+
+    /* we have all we need */
+    if (err == CURLE_WRITE_ERROR && request->stopped)
+        err = CURLE_OK;
+
+    if (err != CURLE_OK) {
+        report(RPT_ERR, "Downloading %s failed: %s", transfer->url,
+               request->error[0] ? request->error : curl_easy_strerror(err));
+        return;
+    }
+
+    /* max-age wins, Expires is relative to the server's clock */
+    if (request->max_age > 0)
+        transfer->max_age = request->max_age;
+    else if (request->expires > 0)
+        transfer->max_age = MAX(request->expires -
+                                (request->date > 0 ? request->date : time(NULL)),
+                                (time_t)0);
+
+    curl_easy_getinfo(request->curl, CURLINFO_RESPONSE_CODE, &code);
+    if (code == 304) {
+        transfer->result = HTTP_NOT_MODIFIED;
+    } else if (code >= 200 && code < 300) {
+        transfer->result = HTTP_MODIFIED;
+        if (validator) {
+            http_validator_clear(validator);
+            validator->etag = request->etag;
+            validator->last_modified = request->last_modified;
+            request->etag = request->last_modified = NULL;
+        }
+    } else
+        report(RPT_ERR, "Downloading %s failed: HTTP status %ld", transfer->url, code);
+}
+
+/* -------------------------------------------------------------------------- */
+static void request_free(struct http_request *request)
+{
+    g_free(request->etag);
+    g_free(request->last_modified);
+    curl_slist_free_all(request->headers);
+    if (request->curl)
+        curl_easy_cleanup(request->curl);
+
+    request->etag = request->last_modified = NULL;
+    request->max_age = 0;
+    request->expires = request->date = 0;
+    request->headers = NULL;
+    request->curl = NULL;
+
+    if (request->slot)
+        slot_release();
+    request->slot = false;
+}
+
+/* -------------------------------------------------------------------------- */
+static void request_count(struct http_request *request, long *connects, double *bytes)
+{
+    long n = 0;
+    double size = 0;
+
+    if (curl_easy_getinfo(request->curl, CURLINFO_NUM_CONNECTS, &n) == CURLE_OK)
+        *connects += n;
+    if (curl_easy_getinfo(request->curl, CURLINFO_SIZE_DOWNLOAD, &size) == CURLE_OK)
+        *bytes += size;
+}
+
+/* -------------------------------------------------------------------------- */
+void http_get_all(struct http_transfer  *transfers,
+                  unsigned int          n,
+                  unsigned int          max_connections,
+                  long                  timeout,
+                  http_done_fun         done)
+{
+    struct http_request *requests;
+    unsigned int next = 0, active = 0, i;
+    CURLM *multi;
+    CURLMsg *msg;
+    int running, queued;
+    long connects = 0;
+    double bytes = 0;
+
+    requests = g_new0(struct http_request, n);
+    for (i = 0; i < n; i++) {
+        requests[i].transfer = &transfers[i];
+        transfers[i].result = HTTP_ERROR;
+        transfers[i].max_age = 0;
+    }
+
+    multi = curl_multi_init();
+    if (!multi) {
+        report(RPT_ERR, "curl_multi_init failed");
+        goto out;
+    }
+
+    max_connections = MAX(max_connections, 1);
+
+    while (!g_exit && (next < n || active > 0)) {
+        bool finished = false;
+
+        /* keep the pipe full, as far as the other modules leave slots */
+        while (next < n && active < max_connections && slot_acquire()) {
+            struct http_request *request = &requests[next++];
+
+            request->slot = true;
+            if (request_start(request, timeout) &&
+                    curl_multi_add_handle(multi, request->curl) == CURLM_OK)
+                active++;
+            else {
+                if (done)
+                    done(request->transfer);
+                request_free(request);
+            }
+        }
+
+        curl_multi_perform(multi, &running);
+
+        /* handle the finished ones while the others are still running */
+        while ((msg = curl_multi_info_read(multi, &queued))) {
+            struct http_request *request;
+
+            if (msg->msg != CURLMSG_DONE)
+                continue;
+
+            curl_easy_getinfo(msg->easy_handle, CURLINFO_PRIVATE, (char **)&request);
+            curl_multi_remove_handle(multi, msg->easy_handle);
+            active--;
+
+            request_finish(request, msg->data.result);
+            request_count(request, &connects, &bytes);
+            if (done)
+                done(request->transfer);
+            request_free(request);
+            finished = true;
+        }
+
+        /* the slots of the finished ones are free again, use them now */
+        if (finished)
+            continue;
+        if (active > 0)
+            curl_multi_wait(multi, NULL, 0, 1000, NULL);
+        else if (next < n)
+            g_usleep(100000);   /* all slots are used by other modules */
+    }
+
+    report(RPT_DEBUG, "%u downloads: %ld new connections, %.0f bytes received",
+           n, connects, bytes);
+
+    /* only if we exit */
+    for (i = 0; i < n; i++)
+        if (requests[i].curl)
+            curl_multi_remove_handle(multi, requests[i].curl);
+    curl_multi_cleanup(multi);
+
+out:
+    for (i = 0; i < n; i++)
+        request_free(&requests[i]);
+    g_free(requests);
+}
+
+/* -------------------------------------------------------------------------- */
+enum http_result http_get(const char            *url,
+                          struct http_validator *validator,
+                          GString               *body)
+{
+    struct http_transfer transfer = { url, validator, body, NULL, HTTP_ERROR, 0, NULL };
+
+    http_get_all(&transfer, 1, 1, TRANSFER_TIMEOUT_SEC, NULL);
+
+    return transfer.result;
+}
+
+/* vim: set ts=4 sw=4 et: */
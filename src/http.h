@@ -0,0 +1,148 @@
+/*
+ * This file is part of lcd-stuff.
+ *
+ * lcd-stuff is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License.
+ *
+ * lcd-stuff is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with lcd-stuff; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+#ifndef HTTP_H
+#define HTTP_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <time.h>
+#include <glib.h>
+
+/**
+ * @file http.h
+ * @brief HTTP downloads with libcurl.
+ *
+ * Documents are fetched with conditional requests: the validators (ETag
+ * and Last-Modified) of the last response are sent back, so the server
+ * can answer with "304 Not Modified" and without a body if nothing
+ * changed.
+ *
+ * All modules share one client: connections are kept open and reused, DNS
+ * results and TLS sessions are cached, responses are compressed (gzip or
+ * deflate) and the number of connections of all modules together is
+ * limited.
+ */
+
+/**
+ * @brief The validators of the last successful response.
+ */
+struct http_validator {
+    char            *etag;          /**< NULL if unknown */
+    char            *last_modified; /**< NULL if unknown */
+};
+
+/**
+ * @brief The result of a request.
+ */
+enum http_result {
+    HTTP_ERROR,                     /**< failed, the error has been reported */
+    HTTP_MODIFIED,                  /**< the body holds the new document */
+    HTTP_NOT_MODIFIED               /**< 304, the last document is current */
+};
+
+struct http_transfer;
+
+/**
+ * @brief Gets the document of a transfer piece by piece while it arrives.
+ *
+ * @return @c false if the rest of the document is not needed, the transfer
+ *         is stopped then (and still successful)
+ */
+typedef bool (*http_data_fun)(struct http_transfer *transfer,
+                              const char *data, size_t len);
+
+/**
+ * @brief One request of http_get_all().
+ */
+struct http_transfer {
+    const char              *url;       /**< the URL */
+    struct http_validator   *validator; /**< see http_get(), may be NULL */
+    GString                 *body;      /**< the document on HTTP_MODIFIED,
+                                             may be NULL if @c data is set */
+    http_data_fun           data;       /**< streams the document, may be NULL */
+    enum http_result        result;     /**< set before the callback */
+    long                    max_age;    /**< how long the response is fresh in
+                                             seconds, from Cache-Control or
+                                             Expires, 0 if not given */
+    void                    *cookie;    /**< for the caller */
+};
+
+/**
+ * @brief Called for each finished transfer, in the order they finish.
+ */
+typedef void (*http_done_fun)(struct http_transfer *transfer);
+
+/**
+ * @brief Initialises libcurl and the shared client. Must be called after
+ *        g_thread_init() and before any thread is created.
+ */
+void http_global_init(void);
+
+/**
+ * @brief Frees the resources of http_global_init().
+ */
+void http_global_cleanup(void);
+
+/**
+ * @brief Downloads @p url unless it has not been modified.
+ *
+ * @param[in] url the URL
+ * @param[in,out] validator the validators of the last response (sent with
+ *                the request), updated on HTTP_MODIFIED; may be NULL for
+ *                an unconditional request
+ * @param[out] body the document on HTTP_MODIFIED
+ * @return the result
+ */
+enum http_result http_get(const char            *url,
+                          struct http_validator *validator,
+                          GString               *body);
+
+/**
+ * @brief Downloads several documents concurrently.
+ *
+ * All transfers run in parallel (at most @p max_connections at the same
+ * time), so that the whole takes about as long as the slowest one. Returns
+ * when all are done or the program exits.
+ *
+ * @param[in,out] transfers the requests, see http_get() for the fields
+ * @param[in] n the number of @p transfers
+ * @param[in] max_connections the number of parallel transfers
+ * @param[in] timeout the timeout of each transfer in seconds
+ * @param[in] done called for each finished transfer (successful or not)
+ */
+void http_get_all(struct http_transfer  *transfers,
+                  unsigned int          n,
+                  unsigned int          max_connections,
+                  long                  timeout,
+                  http_done_fun         done);
+
+/**
+ * @brief Parses a date as used by HTTP and RFC 822 (e.g. in RSS).
+ *
+ * @return the time or 0 if @p date cannot be parsed
+ */
+time_t http_parse_date(const char *date);
+
+/**
+ * @brief Frees the strings of @p validator and sets them to NULL.
+ */
+void http_validator_clear(struct http_validator *validator);
+
+#endif /* HTTP_H */
+
+/* vim: set ts=4 sw=4 et: */
@@ -20,6 +20,7 @@
 #include <unistd.h>
 #include <string.h>
 #include <time.h>
+#include <errno.h>
 
 #include <shared/report.h>
 #include <shared/sockets.h>
@@ -36,9 +37,19 @@
 #include "keyfile.h"
 #include "util.h"
 #include "screen.h"
+#include "mailwatch.h"
+#include "maildir.h"
+#include "mbox.h"
+#include "mailindex.h"
+#include "mailtls.h"
+#include "mailstore.h"
 
 /* ---------------------- constants ----------------------------------------- */
 #define MODULE_NAME           "mail"
+#define DISPATCH_TIMEOUT_MS   100
+#define SUMMARY_GROUP         "summary"
+#define BACKOFF_MAX_SEC       (6*60*60)
+#define PREVIEW_IDLE_SEC      60
 
 /* ---------------------- types --------------------------------------------- */
 struct mailbox {
@@ -48,24 +59,45 @@ struct mailbox {
     char            *name;
     char            *type;          /* pop3, imap */
     char            *mailbox_name;  /* imap only */
+    int             connection;     /* CONNECTION_TYPE_* */
+    struct mail_tls *tls;           /* NULL for plain connections */
     unsigned int    messages_seen;
     unsigned int    messages_unseen;
     unsigned int    messages_total;
+    int             interval;       /* seconds between two checks */
+    time_t          next_due;       /* time of the next check */
+    unsigned int    failures;       /* consecutive failed checks */
+    unsigned int    max_messages;   /* newest unseen mails listed, 0 for all */
     bool            hidden;
-};
-
-struct email {
-    struct mailbox  *box;
-    int             message_number_in_box;
-    char            *subject;
-    char            *from;
+    bool            watched;        /* local box watched for changes */
+    bool            changed;        /* watch reported a change */
+    bool            rescan;         /* watch lost events, list the box */
+    bool            listed;         /* the store matches the counts */
+    time_t          listed_at;      /* time of the last listing */
+    char            *cache_dir;     /* remote only, NULL if disabled */
+    struct mbox_state *mbox;        /* mbox only */
+    struct mail_index *uidl;        /* pop3 only */
+    struct mail_store store;        /* unseen mail, protected by mail->mutex */
+    GHashTable      *previews;      /* key -> preview of the unseen mail */
+    mailimap        *preview_imap;  /* imap only, kept open for previews */
+    time_t          preview_used;   /* time of the last preview */
+    char            **folders;      /* imap only, counts of several folders */
+    gsize           folders_count;
+    unsigned int    *folder_unseen;
 };
 
 struct lcd_stuff_mail {
     struct lcd_stuff    *lcd;
     int                 interval;
     GPtrArray           *mailboxes;
-    GList               *email;
+    GMutex              *mutex;     /* the stores are read in the service thread */
+    volatile gint       refresh;    /* the screen became visible */
+    bool                preview;    /* show the start of the body */
+    int                 lines;      /* lines on the screen without title */
+    volatile gint       preview_wanted;
+    struct mailbox      *preview_box;   /* the message that needs a preview */
+    int                 preview_index;
+    struct mail_watch   *watch;
     int                 current_screen;
     char                *title_prefix;
     struct screen       screen;
@@ -93,22 +125,44 @@ static void update_screen(struct lcd_stuff_mail *mail,
 /* -------------------------------------------------------------------------- */
 static void show_screen(struct lcd_stuff_mail *mail)
 {
-    int tot = g_list_length(mail->email);
+    int tot = 0;
     char *line1 = NULL;
     char *line1_old = NULL;
     char *line2 = NULL;
     char *line3 = NULL;
+    const char *preview = NULL;
     char *title = NULL;
     int i;
 
+    g_mutex_lock(mail->mutex);
+
     /* build the first line */
     for (i = 0; i < (int)mail->mailboxes->len; i++) {
         struct mailbox *box = g_ptr_array_index(mail->mailboxes, i);
 
         line1_old = line1 ? line1 : g_strdup("");
-        line1 = g_strdup_printf("%s%s:%d ", line1_old, box->name,
-                box->messages_unseen);
+        if (box->folders) {
+            GString *folders = g_string_new(line1_old);
+            gsize f;
+
+            /* the last component of the folder name is enough */
+            for (f = 0; f < box->folders_count; f++) {
+                const char *name = box->folders[f];
+                const char *sep = strpbrk(name, "/.");
+
+                while (sep) {
+                    name = sep + 1;
+                    sep = strpbrk(name, "/.");
+                }
+                g_string_append_printf(folders, "%s:%d ", name, box->folder_unseen[f]);
+            }
+            line1 = g_string_free(folders, false);
+        } else
+            line1 = g_strdup_printf("%s%s:%d ", line1_old, box->name,
+                    box->messages_unseen);
         g_free(line1_old);
+
+        tot += box->store.email->len;
     }
 
     if (mail->current_screen < 0) {
@@ -118,24 +172,35 @@ static void show_screen(struct lcd_stuff_mail *mail)
     }
 
     if (tot != 0) {
-        GList *cur = g_list_first(mail->email);
+        int skip = mail->current_screen;
 
         /* build the second line */
-        i = 0;
-        while (cur) {
-            struct email *email = (struct email *)cur->data;
-            if (!mail) {
-                break;
+        for (i = 0; i < (int)mail->mailboxes->len; i++) {
+            struct mailbox *box = g_ptr_array_index(mail->mailboxes, i);
+            int len = box->store.email->len;
+            struct email *email;
+
+            if (skip >= len) {
+                skip -= len;
+                continue;
             }
 
-            if (i++ == mail->current_screen) {
-                line2 = email->from;
-                line3 = email->subject;
-                title = g_strdup_printf("%s %d", email->box->name,
-                                        email->message_number_in_box);
-                break;
+            email = &g_array_index(box->store.email, struct email, skip);
+            line2 = (char *)email->from;
+            line3 = (char *)email->subject;
+            title = g_strdup_printf("%s %d", box->name,
+                                    email->message_number_in_box);
+
+            /* the mail thread fetches it, we get called again then */
+            if (mail->preview && email->key) {
+                preview = email->preview;
+                if (!preview) {
+                    mail->preview_box = box;
+                    mail->preview_index = skip;
+                    g_atomic_int_set(&mail->preview_wanted, 1);
+                }
             }
-            cur = cur->next;
+            break;
         }
     }
 
@@ -143,176 +208,830 @@ static void show_screen(struct lcd_stuff_mail *mail)
         title = g_strdup("");
     }
 
+    /* with only three lines, the preview replaces the numbers */
+    if (mail->preview && mail->lines <= 3 && preview) {
+        g_free(line1);
+        line1 = g_strdup(preview);
+    }
+
     update_screen(mail, title, line1, line2 ? line2 : "", line3 ? line3 : "");
+    if (mail->preview && mail->lines > 3)
+        screen_show_text(&mail->screen, 3, preview ? preview : "");
+
+    g_mutex_unlock(mail->mutex);
+
     g_free(title);
     g_free(line1);
 }
 
 /* -------------------------------------------------------------------------- */
-void free_emails(struct lcd_stuff_mail *mail)
+static bool same_email(const struct email *a, const struct email *b)
 {
-    GList *cur = g_list_first(mail->email);
-    while (cur) {
-        g_free(((struct email *)cur->data)->from);
-        g_free(((struct email *)cur->data)->subject);
-        free(cur->data);
-        cur = cur->next;
-    }
-    g_list_free(mail->email);
-    mail->email = NULL;
+    if (a->key && b->key)
+        return strcmp(a->key, b->key) == 0;
+
+    return g_strcmp0(a->from, b->from) == 0 && g_strcmp0(a->subject, b->subject) == 0;
 }
 
 /* -------------------------------------------------------------------------- */
-static void mail_check(struct lcd_stuff_mail *mail)
+/*
+ * Keeps the message on the screen when the unseen mail of @p box gets
+ * replaced by @p store. Only if that message is gone, the screen starts
+ * again with the first one. Called with mail->mutex held.
+ */
+static void keep_current_screen(struct lcd_stuff_mail   *mail,
+                                struct mailbox          *box,
+                                const struct mail_store *store)
 {
-    unsigned int mb;
+    int offset = 0, old_len = box->store.email->len, new_len = store->email->len;
+    const struct email *shown;
+    int i;
 
-    mail->current_screen = 0;
+    for (i = 0; i < (int)mail->mailboxes->len; i++) {
+        struct mailbox *cur = g_ptr_array_index(mail->mailboxes, i);
 
-    /* free old mail */
-    free_emails(mail);
+        if (cur == box)
+            break;
+        offset += cur->store.email->len;
+    }
 
-    for (mb = 0; mb < mail->mailboxes->len; mb++) {
-        struct mailbox *box = g_ptr_array_index(mail->mailboxes, mb);
-        struct mailfolder *folder = NULL;
-        struct mailmessage_list *messages  = NULL;
-        struct mailmessage *message = NULL;
-        struct mailstorage *storage = NULL;
-        unsigned int r, i;
-        int message_number = 1;
+    /* the box comes after the shown message */
+    if (mail->current_screen < offset)
+        return;
 
-        if (!box)
-            break;
+    /* the box comes before it */
+    if (mail->current_screen >= offset + old_len) {
+        mail->current_screen += new_len - old_len;
+        return;
+    }
 
-        if (!is_local(box->type)) {
-            update_screen(mail, box->name, "", "  Receiving ...", "");
-            box->messages_seen = box->messages_total = box->messages_unseen = 0;
+    shown = &g_array_index(box->store.email, struct email, mail->current_screen - offset);
+    for (i = 0; i < new_len; i++) {
+        if (same_email(shown, &g_array_index(store->email, struct email, i))) {
+            mail->current_screen = offset + i;
+            return;
         }
+    }
 
-        storage = mailstorage_new(NULL);
-        if (!storage) {
-            report(RPT_ERR, "error initializing storage\n");
-            goto end_loop;
-        }
+    mail->current_screen = 0;
+}
 
-        r = init_storage(storage, get_driver(box->type), box->server, 0,
-                CONNECTION_TYPE_PLAIN, box->username, box->password,
-                POP3_AUTH_TYPE_PLAIN, box->mailbox_name, NULL, NULL);
-        if (r != MAIL_NO_ERROR) {
-            report(RPT_ERR, "error initializing storage");
-            goto end_loop;
+/* -------------------------------------------------------------------------- */
+static void mail_store_commit(struct lcd_stuff_mail *mail,
+                              struct mailbox        *box,
+                              struct mail_store     *store)
+{
+    struct mail_store old;
+    GHashTable *previews;
+    unsigned int i;
+
+    /* keep the previews of the messages that are still there */
+    previews = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, g_free);
+    for (i = 0; box->previews && i < store->email->len; i++) {
+        struct email *email = &g_array_index(store->email, struct email, i);
+        gpointer key, value;
+
+        if (!email->key ||
+                !g_hash_table_lookup_extended(box->previews, email->key, &key, &value))
+            continue;
+
+        g_hash_table_steal(box->previews, key);
+        g_hash_table_insert(previews, key, value);
+        email->preview = g_string_chunk_insert(store->strings, value);
+    }
+
+    g_mutex_lock(mail->mutex);
+    keep_current_screen(mail, box, store);
+    old = box->store;
+    box->store = *store;
+    g_mutex_unlock(mail->mutex);
+
+    mail_store_free(&old);
+    if (box->previews)
+        g_hash_table_destroy(box->previews);
+    box->previews = previews;
+    store->email = NULL;
+    store->strings = NULL;
+}
+
+/* -------------------------------------------------------------------------- */
+static void add_scanned_message(struct mail_store   *store,
+                                const char          *key,
+                                const char          *from,
+                                const char          *subject)
+{
+    char *display_from, *display_subject;
+
+    display_from = display_from_raw(from);
+    display_subject = display_subject_raw(subject);
+
+    mail_store_add(store, key, display_from, display_subject);
+
+    g_free(display_from);
+    g_free(display_subject);
+}
+
+/* -------------------------------------------------------------------------- */
+static void add_maildir_message(const char  *filename,
+                                const char  *from,
+                                const char  *subject,
+                                void        *cookie)
+{
+    add_scanned_message((struct mail_store *)cookie, filename, from, subject);
+}
+
+/* -------------------------------------------------------------------------- */
+static bool counts_changed(struct mailbox *box, unsigned int total, unsigned int unseen)
+{
+    return !box->listed || total != box->messages_total || unseen != box->messages_unseen;
+}
+
+/* -------------------------------------------------------------------------- */
+static bool mail_check_maildir(struct mailbox       *box,
+                               struct mail_store    *store,
+                               bool                 force_list,
+                               bool                 *listed)
+{
+    unsigned int total, unseen;
+    bool ok;
+
+    /* counting only needs the file names, reading headers is expensive */
+    if (!box->hidden && !force_list) {
+        if (!maildir_scan(box->mailbox_name, &total, &unseen, 0, NULL, NULL))
+            return false;
+        if (!counts_changed(box, total, unseen))
+            return true;
+    }
+
+    ok = maildir_scan(box->mailbox_name, &box->messages_total,
+                      &box->messages_unseen, box->max_messages,
+                      box->hidden ? NULL : add_maildir_message, store);
+    if (ok) {
+        box->messages_seen = box->messages_total - box->messages_unseen;
+        *listed = true;
+    }
+
+    return ok;
+}
+
+/* -------------------------------------------------------------------------- */
+static void add_mbox_message(uint64_t      offset,
+                             const char    *from,
+                             const char    *subject,
+                             void          *cookie)
+{
+    char *key;
+
+    /* the subject makes sure that a rewritten file doesn't mix up previews */
+    key = g_strdup_printf("%llu %s", (unsigned long long)offset, subject ? subject : "");
+    add_scanned_message((struct mail_store *)cookie, key, from, subject);
+    g_free(key);
+}
+
+/* -------------------------------------------------------------------------- */
+static bool mail_check_mbox(struct mailbox *box, struct mail_store *store)
+{
+    if (!box->mbox)
+        box->mbox = mbox_state_new(box->max_messages);
+
+    if (!mbox_scan(box->mbox, box->mailbox_name, &box->messages_total,
+                   &box->messages_unseen))
+        return false;
+
+    box->messages_seen = box->messages_total - box->messages_unseen;
+    if (box->hidden)
+        return true;
+
+    mbox_foreach_unseen(box->mbox, add_mbox_message, store);
+
+    return true;
+}
+
+/* -------------------------------------------------------------------------- */
+static char *summary_path(struct mailbox *box)
+{
+    return g_build_filename(box->cache_dir, "summary", NULL);
+}
+
+/* -------------------------------------------------------------------------- */
+static void mail_summary_save(struct mailbox *box)
+{
+    GKeyFile *summary;
+    char     **from, **subject;
+    char     *data, *path;
+    gsize    len, n, i;
+    GError   *err = NULL;
+
+    if (!box->cache_dir)
+        return;
+
+    /* GKeyFile wants UTF-8 */
+    n = box->store.email->len;
+    from = g_new0(char *, n + 1);
+    subject = g_new0(char *, n + 1);
+    for (i = 0; i < n; i++) {
+        struct email *email = &g_array_index(box->store.email, struct email, i);
+
+        from[i] = g_convert(email->from ? email->from : "", -1,
+                            "UTF-8", "ISO-8859-1", NULL, NULL, NULL);
+        subject[i] = g_convert(email->subject ? email->subject : "", -1,
+                               "UTF-8", "ISO-8859-1", NULL, NULL, NULL);
+        if (!from[i])
+            from[i] = g_strdup("");
+        if (!subject[i])
+            subject[i] = g_strdup("");
+    }
+
+    summary = g_key_file_new();
+    g_key_file_set_integer(summary, SUMMARY_GROUP, "total", box->messages_total);
+    g_key_file_set_integer(summary, SUMMARY_GROUP, "seen", box->messages_seen);
+    g_key_file_set_integer(summary, SUMMARY_GROUP, "unseen", box->messages_unseen);
+    g_key_file_set_string_list(summary, SUMMARY_GROUP, "from",
+                               (const gchar * const *)from, n);
+    g_key_file_set_string_list(summary, SUMMARY_GROUP, "subject",
+                               (const gchar * const *)subject, n);
+
+    data = g_key_file_to_data(summary, &len, NULL);
+    path = summary_path(box);
+    if (!g_file_set_contents(path, data, len, &err)) {
+        report(RPT_WARNING, MODULE_NAME ": Cannot write %s: %s", path, err->message);
+        g_error_free(err);
+    }
+
+    g_free(path);
+    g_free(data);
+    g_key_file_free(summary);
+    g_strfreev(from);
+    g_strfreev(subject);
+}
+
+/* -------------------------------------------------------------------------- */
+static void mail_summary_load(struct mailbox *box)
+{
+    GKeyFile *summary;
+    char     **from = NULL, **subject = NULL;
+    gsize    n_from = 0, n_subject = 0, i;
+    char     *path;
+
+    if (!box->cache_dir)
+        return;
+
+    summary = g_key_file_new();
+    path = summary_path(box);
+    if (!g_key_file_load_from_file(summary, path, G_KEY_FILE_NONE, NULL))
+        goto out;
+
+    box->messages_total = g_key_file_get_integer(summary, SUMMARY_GROUP, "total", NULL);
+    box->messages_seen = g_key_file_get_integer(summary, SUMMARY_GROUP, "seen", NULL);
+    box->messages_unseen = g_key_file_get_integer(summary, SUMMARY_GROUP, "unseen", NULL);
+    box->listed = true;
+
+    from = g_key_file_get_string_list(summary, SUMMARY_GROUP, "from", &n_from, NULL);
+    subject = g_key_file_get_string_list(summary, SUMMARY_GROUP, "subject", &n_subject, NULL);
+
+    for (i = 0; i < MIN(n_from, n_subject); i++) {
+        char *from_l1, *subject_l1;
+
+        from_l1 = g_convert(from[i], -1, "ISO-8859-1", "UTF-8", NULL, NULL, NULL);
+        subject_l1 = g_convert(subject[i], -1, "ISO-8859-1", "UTF-8", NULL, NULL, NULL);
+        mail_store_add(&box->store, NULL, from_l1, subject_l1);
+        g_free(from_l1);
+        g_free(subject_l1);
+    }
+
+out:
+    g_strfreev(from);
+    g_strfreev(subject);
+    g_free(path);
+    g_key_file_free(summary);
+}
+
+/* -------------------------------------------------------------------------- */
+static bool fetch_from_subject(struct mailmessage   *message,
+                               char                 **from,
+                               char                 **subject)
+{
+    struct mailimf_fields *hdr = NULL;
+    clistiter *cur;
+    int r;
+
+    r = mailmessage_fetch_envelope(message, &hdr);
+    if (r != MAIL_NO_ERROR) {
+        report(RPT_ERR, "mailmessage_fetch_envelope failed\n");
+        return false;
+    }
+
+    for (cur = clist_begin(hdr->fld_list) ; cur != NULL; cur = clist_next(cur)) {
+        struct mailimf_field *field = (struct mailimf_field *)clist_content(cur);
+
+        switch (field->fld_type) {
+              case MAILIMF_FIELD_FROM:
+                  *from = display_from(field->fld_data.fld_from);
+                  break;
+
+              case MAILIMF_FIELD_SUBJECT:
+                  *subject = display_subject(field->fld_data.fld_subject);
+                  break;
         }
+    }
 
-        /* get the folder structure */
-        folder = mailfolder_new(storage, box->mailbox_name, NULL);
-        if (folder == NULL) {
-            report(RPT_ERR, "mailfolder_new failed");
-            goto end_loop;
+    mailimf_fields_free(hdr);
+
+    return true;
+}
+
+/* -------------------------------------------------------------------------- */
+static bool is_seen(struct mailmessage *message)
+{
+    struct mail_flags *flags = NULL;
+
+    return mailmessage_get_flags(message, &flags) == MAIL_NO_ERROR &&
+           (flags->fl_flags & MAIL_FLAG_SEEN);
+}
+
+/* -------------------------------------------------------------------------- */
+/*
+ * Removes all messages from @p messages but the newest @p max unseen ones
+ * (and the seen ones between them), so that only those get fetched.
+ */
+static void limit_messages(struct mailmessage_list *messages, unsigned int max)
+{
+    unsigned int first, found = 0, i;
+    carray *tab;
+
+    first = carray_count(messages->msg_tab);
+    while (first > 0 && found < max) {
+        first--;
+        if (!is_seen(carray_get(messages->msg_tab, first)))
+            found++;
+    }
+    if (first == 0)
+        return;
+
+    tab = carray_new(carray_count(messages->msg_tab) - first + 1);
+    if (!tab)
+        return;
+
+    for (i = 0; i < carray_count(messages->msg_tab); i++) {
+        struct mailmessage *message = carray_get(messages->msg_tab, i);
+
+        if (i < first || carray_add(tab, message, NULL) != 0)
+            mailmessage_free(message);
+    }
+    carray_free(messages->msg_tab);
+    messages->msg_tab = tab;
+}
+
+/* -------------------------------------------------------------------------- */
+static void touch_messages(struct mail_index *index, struct mailmessage_list *messages)
+{
+    unsigned int i;
+
+    for (i = 0; i < carray_count(messages->msg_tab); i++) {
+        struct mailmessage *message = carray_get(messages->msg_tab, i);
+
+        if (message->msg_uid)
+            mail_index_touch(index, message->msg_uid);
+    }
+}
+
+/* -------------------------------------------------------------------------- */
+static bool mail_check_folders(struct lcd_stuff_mail *mail, struct mailbox *box)
+{
+    unsigned int *messages, *unseen;
+    mailimap *imap;
+    gsize i;
+    bool ok;
+
+    imap = imap_connect(box->server, box->connection, box->tls,
+                        box->username, box->password);
+    if (!imap)
+        return false;
+
+    messages = g_new0(unsigned int, box->folders_count);
+    unseen = g_new0(unsigned int, box->folders_count);
+    ok = imap_folders_status(imap, box->folders, box->folders_count,
+                             messages, unseen);
+    imap_disconnect(imap);
+
+    if (ok) {
+        g_mutex_lock(mail->mutex);
+        box->messages_total = box->messages_unseen = 0;
+        for (i = 0; i < box->folders_count; i++) {
+            box->folder_unseen[i] = unseen[i];
+            box->messages_total += messages[i];
+            box->messages_unseen += unseen[i];
         }
+        box->messages_seen = box->messages_total - box->messages_unseen;
+        g_mutex_unlock(mail->mutex);
+    }
 
-        r = mailfolder_connect(folder);
-        if (r != MAIL_NO_ERROR) {
-            report(RPT_ERR, "mailfolder_connect failed");
+    g_free(messages);
+    g_free(unseen);
+
+    return ok;
+}
+
+/* -------------------------------------------------------------------------- */
+/*
+ * Sets the time of the next check. A failing box is retried later and later
+ * (up to BACKOFF_MAX_SEC), the random part keeps boxes on the same server
+ * from being retried all at the same time.
+ */
+static void mail_schedule(struct mailbox *box, bool ok)
+{
+    time_t delay = box->interval;
+
+    if (ok)
+        box->failures = 0;
+    else {
+        if (box->failures < 16)
+            box->failures++;
+        delay = MIN((time_t)box->interval << (box->failures - 1), BACKOFF_MAX_SEC);
+        delay = MAX(delay, box->interval);
+        delay = delay - delay / 4 + g_random_int_range(0, delay / 2 + 1);
+        report(RPT_INFO, MODULE_NAME ": Checking %s failed %u time(s), retry in %ld s",
+               box->name, box->failures, (long)delay);
+    }
+
+    box->next_due = time(NULL) + delay;
+}
+
+/* -------------------------------------------------------------------------- */
+/*
+ * Checks one box. Usually, only the counts are retrieved (IMAP STATUS,
+ * POP3 STAT). The expensive listing of the messages with their envelopes
+ * is only done if the counts changed or if @p force_list is true.
+ */
+static void mail_check_box(struct lcd_stuff_mail    *mail,
+                           struct mailbox           *box,
+                           bool                     force_list)
+{
+    struct mailfolder *folder = NULL;
+    struct mailmessage_list *messages  = NULL;
+    struct mailmessage *message = NULL;
+    struct mailstorage *storage = NULL;
+    char *cache_dir = NULL, *flags_dir = NULL;
+    struct mail_store store;
+    unsigned int r, i;
+    unsigned int total, seen, unseen;
+    bool ok = false, listed = false;
+
+    /*
+     * The new mail is collected in a new store which replaces the old one
+     * when the check is done. With a cache, the old one even stays when the
+     * check fails.
+     */
+    mail_store_init(&store);
+
+    /* only counts, all folders in one go */
+    if (box->folders) {
+        ok = mail_check_folders(mail, box);
+        if (ok)
+            box->listed_at = time(NULL);
+        goto end_loop;
+    }
+
+    /* use the fast native scanners, libetpan is only the fallback */
+    if (strcmp(box->type, "maildir") == 0 &&
+            mail_check_maildir(box, &store, force_list, &listed)) {
+        ok = true;
+        goto end_loop;
+    }
+    if (strcmp(box->type, "mbox") == 0 && mail_check_mbox(box, &store)) {
+        /* the scanner keeps the headers anyway */
+        ok = listed = true;
+        goto end_loop;
+    }
+    mail_store_reset(&store);
+
+    if (!is_local(box->type) && !box->cache_dir && !box->listed) {
+        update_screen(mail, box->name, "", "  Receiving ...", "");
+        box->messages_seen = box->messages_total = box->messages_unseen = 0;
+    }
+
+    storage = mailstorage_new(NULL);
+    if (!storage) {
+        report(RPT_ERR, "error initializing storage\n");
+        goto end_loop;
+    }
+
+    /* envelopes and flags are reused across checks and restarts */
+    if (box->cache_dir) {
+        cache_dir = g_build_filename(box->cache_dir, "cache", NULL);
+        flags_dir = g_build_filename(box->cache_dir, "flags", NULL);
+    }
+
+    r = init_storage(storage, get_driver(box->type), box->server, 0,
+            CONNECTION_TYPE_PLAIN, box->username, box->password,
+            POP3_AUTH_TYPE_PLAIN, box->mailbox_name, cache_dir, flags_dir);
+    if (r != MAIL_NO_ERROR) {
+        report(RPT_ERR, "error initializing storage");
+        goto end_loop;
+    }
+
+    /* libetpan can't resume TLS sessions, so we connect ourselves */
+    if (box->connection != CONNECTION_TYPE_PLAIN) {
+        if (!box->tls)
             goto end_loop;
-        }
 
-        r = mailfolder_status(folder, &box->messages_total, &box->messages_seen,
-                &box->messages_unseen);
+        r = connect_storage(storage, get_driver(box->type), box->server,
+                box->connection, box->tls, box->username, box->password,
+                cache_dir, flags_dir);
         if (r != MAIL_NO_ERROR) {
-            report(RPT_ERR, "mailfolder_status failed");
+            report(RPT_ERR, MODULE_NAME ": Connecting to %s failed", box->server);
             goto end_loop;
         }
+    }
 
-        /* end here when no message fetching is required */
-        if (box->hidden) {
-            goto end_loop;
-        }
+    /* get the folder structure */
+    folder = mailfolder_new(storage, box->mailbox_name, NULL);
+    if (folder == NULL) {
+        report(RPT_ERR, "mailfolder_new failed");
+        goto end_loop;
+    }
 
+    r = mailfolder_connect(folder);
+    if (r != MAIL_NO_ERROR) {
+        report(RPT_ERR, "mailfolder_connect failed");
+        goto end_loop;
+    }
+
+    r = mailfolder_status(folder, &total, &seen, &unseen);
+    if (r != MAIL_NO_ERROR) {
+        report(RPT_ERR, "mailfolder_status failed");
+        goto end_loop;
+    }
+
+    /* nothing new, the envelopes we have are still valid */
+    if (!box->hidden && !force_list && !counts_changed(box, total, unseen)) {
+        box->messages_seen = seen;
+        ok = true;
+        goto end_loop;
+    }
+
+    box->messages_total = total;
+    box->messages_seen = seen;
+    box->messages_unseen = unseen;
+
+    /* end here when no message fetching is required */
+    if (box->hidden) {
+        ok = listed = true;
+        goto end_loop;
+    }
+
+    /*
+     * With a limit, IMAP searches for the newest unseen messages, the others
+     * need the complete list. The counts stay the ones from above.
+     */
+    if (box->max_messages > 0 && strcmp(box->type, "imap") == 0)
+        r = imap_get_unseen_messages_list(folder, box->max_messages, &messages);
+    else {
         r = mailfolder_get_messages_list(folder, &messages);
-        if (r != MAIL_NO_ERROR) {
-            report(RPT_ERR, "mailfolder_get_message failed");
-            goto end_loop;
+        if (r == MAIL_NO_ERROR && box->max_messages > 0) {
+            /* the messages outside the limit are still on the server */
+            if (box->uidl)
+                touch_messages(box->uidl, messages);
+            limit_messages(messages, box->max_messages);
         }
+    }
+    if (r != MAIL_NO_ERROR) {
+        report(RPT_ERR, "mailfolder_get_message failed");
+        goto end_loop;
+    }
 
+    /*
+     * POP3 has no flags, so the envelopes list would mean a TOP command for
+     * each message in each check. With the UIDL index, only new messages
+     * are fetched below.
+     */
+    if (!box->uidl) {
         r = mailfolder_get_envelopes_list(folder, messages);
         if (r != MAIL_NO_ERROR) {
             report(RPT_ERR, "mailfolder_get_mailmessages_list failed");
             goto end_loop;
         }
+    }
 
-        for (i = 0; i < carray_count(messages->msg_tab); i++) {
-            clistiter             *cur   = NULL;
-            struct mailimf_fields *hdr   = NULL;
-            struct email          *email = NULL;
-            struct mail_flags     *flags = NULL;
+    for (i = 0; i < carray_count(messages->msg_tab); i++) {
+        const char            *from, *subject, *key = NULL;
+        char                  *new_from = NULL, *new_subject = NULL;
 
-            message = (struct mailmessage *)carray_get(messages->msg_tab, i);
+        message = (struct mailmessage *)carray_get(messages->msg_tab, i);
 
-            r = mailmessage_fetch_envelope(message, &hdr);
-            if (r != MAIL_NO_ERROR) {
-                report(RPT_ERR, "mailmessage_fetch_envelope failed\n");
-                goto end_inner;
-            }
+        /* previews are only supported for IMAP */
+        if (strcmp(box->type, "imap") == 0)
+            key = message->msg_uid;
 
-            /* get the flags */
-            r = mailmessage_get_flags(message, &flags);
-            if (r == MAIL_NO_ERROR) {
-                /* check if message is 'seen' */
-                if (flags->fl_flags & MAIL_FLAG_SEEN) {
-                    /* skip this, move to next message */
-                    goto end_inner;
-                }
-            }
+        /* skip messages that have been 'seen' */
+        if (is_seen(message))
+            continue;
 
-            /* allocate the email */
-            email = malloc(sizeof(struct email));
-            if (!email) {
-                report(RPT_ERR, MODULE_NAME ": Out of memory");
-                goto end_loop;
-            }
-            memset(email, 0, sizeof(struct email));
+        if (box->uidl && message->msg_uid &&
+                mail_index_lookup(box->uidl, message->msg_uid, &from, &subject)) {
+            mail_store_add(&store, key, from, subject);
+            continue;
+        }
 
-            for (cur = clist_begin(hdr->fld_list) ; cur != NULL; cur = clist_next(cur)) {
-                struct mailimf_field *field = (struct mailimf_field *)clist_content(cur);
+        if (fetch_from_subject(message, &new_from, &new_subject)) {
+            mail_store_add(&store, key, new_from, new_subject);
+            if (box->uidl && message->msg_uid)
+                mail_index_add(box->uidl, message->msg_uid, new_from, new_subject);
+        }
+        g_free(new_from);
+        g_free(new_subject);
+    }
 
-                switch (field->fld_type) {
-                      case MAILIMF_FIELD_FROM:
-                          email->from = display_from(field->fld_data.fld_from);
-                          string_canon(email->from);
-                          break;
+    /* forget messages that have been deleted on the server */
+    if (box->uidl) {
+        mail_index_prune(box->uidl);
+        mail_index_save(box->uidl);
+    }
+    ok = listed = true;
 
-                      case MAILIMF_FIELD_SUBJECT:
-                          email->subject = display_subject(field->fld_data.fld_subject);
-                          string_canon(email->subject);
-                          break;
-                }
-            }
+end_loop:
+    if (listed || (!ok && !box->cache_dir))
+        mail_store_commit(mail, box, &store);
+    else
+        mail_store_free(&store);
+    if (listed) {
+        box->listed = true;
+        box->listed_at = time(NULL);
+        mail_summary_save(box);
+    }
 
-            email->message_number_in_box = message_number++;
-            email->box = box;
-            mail->email = g_list_append(mail->email, email);
+    /* workaround to prevent maildir messages from being marked as 'old' */
+    if (storage && strcmp(box->type, "maildir") == 0) {
+        free(storage->sto_session);
+        storage->sto_session = NULL;
+    }
 
-end_inner:
-            if (hdr)
-                mailimf_fields_free(hdr);
-        }
+    if (messages)
+        mailmessage_list_free(messages);
+    if (folder) {
+        mailfolder_disconnect(folder);
+        mailfolder_free(folder);
+    }
+    if (storage)
+        mailstorage_free(storage);
+    g_free(cache_dir);
+    g_free(flags_dir);
 
-end_loop:
-        /* workaround to prevent maildir messages from being marked as 'old' */
-        if (strcmp(box->type, "maildir") == 0) {
-            free(storage->sto_session);
-            storage->sto_session = NULL;
-        }
+    mail_schedule(box, ok);
+}
+
+/* -------------------------------------------------------------------------- */
+/*
+ * Checks the boxes that are due, or all boxes if @p all is true.
+ */
+static void mail_check(struct lcd_stuff_mail *mail, bool all)
+{
+    unsigned int mb;
+    time_t now = time(NULL);
+
+    for (mb = 0; mb < mail->mailboxes->len; mb++) {
+        struct mailbox *box = g_ptr_array_index(mail->mailboxes, mb);
+
+        if (!box)
+            break;
+
+        /* watched boxes are checked when they change */
+        if (!all && (box->watched || box->next_due > now))
+            continue;
+
+        mail_check_box(mail, box, false);
+    }
+}
+
+/* -------------------------------------------------------------------------- */
+static time_t mail_next_due(struct lcd_stuff_mail *mail)
+{
+    unsigned int mb;
+    time_t next = time(NULL) + mail->interval;
+
+    for (mb = 0; mb < mail->mailboxes->len; mb++) {
+        struct mailbox *box = g_ptr_array_index(mail->mailboxes, mb);
+
+        if (!box->watched && box->next_due < next)
+            next = box->next_due;
+    }
+
+    return next;
+}
+
+/* -------------------------------------------------------------------------- */
+static void mail_check_visible(struct lcd_stuff_mail *mail)
+{
+    unsigned int mb;
+    time_t now = time(NULL);
+
+    /*
+     * At most once per interval, LCDd rotates through the screens. Failing
+     * boxes wait for their backoff.
+     */
+    for (mb = 0; mb < mail->mailboxes->len; mb++) {
+        struct mailbox *box = g_ptr_array_index(mail->mailboxes, mb);
+
+        if (box->hidden || now - box->listed_at < box->interval)
+            continue;
+        if (box->failures > 0 && box->next_due > now)
+            continue;
+
+        mail_check_box(mail, box, true);
+    }
+}
 
-        if (messages)
-            mailmessage_list_free(messages);
-        if (folder) {
-            mailfolder_disconnect(folder);
-            mailfolder_free(folder);
+/* -------------------------------------------------------------------------- */
+static void mail_fetch_preview(struct lcd_stuff_mail *mail)
+{
+    struct mailbox *box;
+    struct email *email = NULL;
+    char *preview = NULL;
+
+    /* the stores are only replaced in this thread, so email stays valid */
+    g_mutex_lock(mail->mutex);
+    box = mail->preview_box;
+    if (box && mail->preview_index < (int)box->store.email->len)
+        email = &g_array_index(box->store.email, struct email, mail->preview_index);
+    g_mutex_unlock(mail->mutex);
+
+    if (!email || !email->key || email->preview)
+        return;
+
+    if (strcmp(box->type, "imap") == 0) {
+        preview = imap_fetch_preview(&box->preview_imap, box->server,
+                                     box->connection, box->tls,
+                                     box->username, box->password,
+                                     box->mailbox_name, email->key);
+        box->preview_used = time(NULL);
+    }
+    else if (strcmp(box->type, "maildir") == 0)
+        preview = maildir_preview(box->mailbox_name, email->key);
+    else if (strcmp(box->type, "mbox") == 0)
+        preview = mbox_preview(box->mailbox_name, g_ascii_strtoull(email->key, NULL, 10));
+
+    /* failures are tried again after the next listing */
+    g_mutex_lock(mail->mutex);
+    email->preview = g_string_chunk_insert(box->store.strings, preview ? preview : "");
+    g_mutex_unlock(mail->mutex);
+
+    if (preview && box->previews)
+        g_hash_table_insert(box->previews, g_strdup(email->key), preview);
+    else
+        g_free(preview);
+}
+
+/* -------------------------------------------------------------------------- */
+/*
+ * Paging through new mail fetches one preview after the other on the same
+ * connection. It's closed when the user is done.
+ */
+static void mail_close_previews(struct lcd_stuff_mail *mail, bool all)
+{
+    unsigned int mb;
+    time_t now = time(NULL);
+
+    for (mb = 0; mb < mail->mailboxes->len; mb++) {
+        struct mailbox *box = g_ptr_array_index(mail->mailboxes, mb);
+
+        if (box->preview_imap && (all || now - box->preview_used >= PREVIEW_IDLE_SEC)) {
+            imap_disconnect(box->preview_imap);
+            box->preview_imap = NULL;
         }
-        if (storage)
-            mailstorage_free(storage);
-        ;
+    }
+}
+
+/* -------------------------------------------------------------------------- */
+static void mail_watch_handler(void *cookie, enum mail_watch_change change)
+{
+    struct mailbox *box = (struct mailbox *)cookie;
+
+    box->changed = true;
+
+    /* the counts could be the same after the lost events */
+    if (change != MAIL_WATCH_CHANGED)
+        box->rescan = true;
+
+    if (change == MAIL_WATCH_REMOVED) {
+        report(RPT_WARNING, MODULE_NAME ": Lost watch on %s, polling again",
+               box->mailbox_name);
+        box->watched = false;
+    }
+}
+
+/* -------------------------------------------------------------------------- */
+static void mail_check_changed(struct lcd_stuff_mail *mail)
+{
+    unsigned int mb;
+
+    for (mb = 0; mb < mail->mailboxes->len; mb++) {
+        struct mailbox *box = g_ptr_array_index(mail->mailboxes, mb);
+
+        if (!box->changed)
+            continue;
+
+        mail_check_box(mail, box, box->rescan);
+        box->changed = box->rescan = false;
     }
 }
 
@@ -321,28 +1040,89 @@ static void mail_key_handler(const char *str, void *cookie)
 {
     struct lcd_stuff_mail *mail = (struct lcd_stuff_mail *)cookie;
 
+    /* the mail thread moves it when the list changes */
+    g_mutex_lock(mail->mutex);
     if (strcmp(str, "Up") == 0) {
         mail->current_screen++;
     } else {
         mail->current_screen--;
     }
+    g_mutex_unlock(mail->mutex);
     show_screen(mail);
 }
 
+/* -------------------------------------------------------------------------- */
+static void mail_listen_handler(void *cookie)
+{
+    struct lcd_stuff_mail *mail = (struct lcd_stuff_mail *)cookie;
+
+    /* the mail thread fetches the messages */
+    g_atomic_int_set(&mail->refresh, 1);
+}
+
 /* -------------------------------------------------------------------------- */
 static void mail_ignore_handler(void *cookie)
 {
     struct lcd_stuff_mail *mail = (struct lcd_stuff_mail *)cookie;
 
+    g_mutex_lock(mail->mutex);
     mail->current_screen++;
+    g_mutex_unlock(mail->mutex);
     show_screen(mail);
 }
 
+/* -------------------------------------------------------------------------- */
+static void mail_net_handler(char **args, int fd, void *cookie)
+{
+    struct lcd_stuff_mail *mail = (struct lcd_stuff_mail *)cookie;
+    unsigned int hits, misses, i;
+    GString *buffer;
+    ssize_t to_write;
+
+    if (!args[0])
+        return;
+
+    if (starts_with(args[0], "stats")) {
+        buffer = g_string_new("");
+
+        display_cache_stats(&hits, &misses);
+        g_string_append_printf(buffer, "decode_hits %u\ndecode_misses %u\n",
+                               hits, misses);
+
+        for (i = 0; i < mail->mailboxes->len; i++) {
+            struct mailbox *box = g_ptr_array_index(mail->mailboxes, i);
+            struct mail_tls_stats stats;
+
+            if (!box->tls)
+                continue;
+
+            mail_tls_get_stats(box->tls, &stats);
+            g_string_append_printf(buffer,
+                    "tls_handshakes %s %u\n"
+                    "tls_resumed %s %u\n"
+                    "tls_handshake_last_ms %s %.1f\n"
+                    "tls_handshake_avg_ms %s %.1f\n",
+                    box->name, stats.handshakes,
+                    box->name, stats.resumed,
+                    box->name, stats.last_ms,
+                    box->name, stats.handshakes ? stats.total_ms / stats.handshakes : 0.0);
+        }
+        g_string_append(buffer, "__END__");
+
+        to_write = buffer->len;
+        if (write(fd, buffer->str, to_write) != to_write)
+            report(RPT_ERR, "write() failed: %s", strerror(errno));
+        g_string_free(buffer, true);
+    }
+}
+
 /* -------------------------------------------------------------------------- */
 static const struct client mail_client = {
     .name            = MODULE_NAME,
     .key_callback    = mail_key_handler,
-    .ignore_callback = mail_ignore_handler
+    .listen_callback = mail_listen_handler,
+    .ignore_callback = mail_ignore_handler,
+    .net_callback    = mail_net_handler
 };
 
 /* -------------------------------------------------------------------------- */
@@ -351,6 +1131,9 @@ static bool mail_init(struct lcd_stuff_mail *mail)
     int        i;
     int        number_of_mailboxes;
     char       *tmp;
+    char       *cache_base;
+    char       *ca_file;
+    char       *connection;
 
     /* register client */
     service_thread_register_client(mail->lcd->service_thread, &mail_client, mail);
@@ -374,6 +1157,8 @@ static bool mail_init(struct lcd_stuff_mail *mail)
 
     /* get config items */
     mail->interval = key_file_get_integer_default(MODULE_NAME, "interval", 300);
+    mail->preview = key_file_get_boolean_default(MODULE_NAME, "preview", false);
+    mail->lines = mail->lcd->display_size.height - (mail->lcd->no_title ? 0 : 1);
 
     number_of_mailboxes = key_file_get_integer_default(MODULE_NAME,
             "number_of_servers", 0);
@@ -384,6 +1169,10 @@ static bool mail_init(struct lcd_stuff_mail *mail)
 
     /* create the linked list of mailboxes */
     mail->mailboxes = g_ptr_array_sized_new(number_of_mailboxes);
+    mail->mutex = g_mutex_new();
+    mail->watch = mail_watch_new();
+    cache_base = cache_dir_get(MODULE_NAME, MODULE_NAME);
+    ca_file = key_file_get_string_default(MODULE_NAME, "ca_file", "");
 
     /* process the mailboxes */
     for (i = 1; i <= number_of_mailboxes; i++) {
@@ -393,6 +1182,7 @@ static bool mail_init(struct lcd_stuff_mail *mail)
             return false;
         }
         memset(cur, 0, sizeof(struct mailbox));
+        mail_store_init(&cur->store);
 
         tmp = g_strdup_printf("server%d", i);
         cur->server = key_file_get_string_default(MODULE_NAME, tmp, "");
@@ -414,16 +1204,100 @@ static bool mail_init(struct lcd_stuff_mail *mail)
         cur->mailbox_name = key_file_get_string_default(MODULE_NAME, tmp, "INBOX");
         g_free(tmp);
 
+        tmp = g_strdup_printf("connection%d", i);
+        connection = key_file_get_string_default(MODULE_NAME, tmp, "plain");
+        cur->connection = get_connection_type(connection);
+        if (cur->connection < 0 || (cur->connection != CONNECTION_TYPE_PLAIN &&
+                strcmp(cur->type, "imap") != 0 && strcmp(cur->type, "pop3") != 0)) {
+            report(RPT_WARNING, MODULE_NAME ": Invalid %s=%s, using plain", tmp, connection);
+            cur->connection = CONNECTION_TYPE_PLAIN;
+        }
+        if (cur->connection != CONNECTION_TYPE_PLAIN) {
+            cur->tls = mail_tls_new(cur->server, strlen(ca_file) > 0 ? ca_file : NULL);
+            if (!cur->tls)
+                report(RPT_ERR, MODULE_NAME ": No TLS for %s, cannot check it", cur->server);
+        }
+        g_free(connection);
+        g_free(tmp);
+
+        tmp = g_strdup_printf("interval%d", i);
+        cur->interval = key_file_get_integer_default(MODULE_NAME, tmp, mail->interval);
+        if (cur->interval <= 0) {
+            report(RPT_WARNING, MODULE_NAME ": Invalid %s=%d, using %d", tmp,
+                   cur->interval, mail->interval);
+            cur->interval = mail->interval;
+        }
+        g_free(tmp);
+
+        tmp = g_strdup_printf("max_messages%d", i);
+        cur->max_messages = MAX(key_file_get_integer_default(MODULE_NAME, tmp, 0), 0);
+        g_free(tmp);
+
         tmp = g_strdup_printf("hidden%d", i);
         cur->hidden = key_file_get_boolean_default(MODULE_NAME, tmp, false);
         g_free(tmp);
 
+        tmp = g_strdup_printf("folders%d", i);
+        cur->folders = key_file_get_string_list(MODULE_NAME, tmp, &cur->folders_count);
+        if (cur->folders && strcmp(cur->type, "imap") != 0) {
+            report(RPT_WARNING, MODULE_NAME ": %s is only supported for IMAP", tmp);
+            g_strfreev(cur->folders);
+            cur->folders = NULL;
+        }
+        if (cur->folders && cur->folders_count == 0) {
+            g_strfreev(cur->folders);
+            cur->folders = NULL;
+        }
+        if (cur->folders)
+            cur->folder_unseen = g_new0(unsigned int, cur->folders_count);
+        g_free(tmp);
+
         tmp = g_strdup_printf("name%d", i);
         cur->name = key_file_get_string_default(MODULE_NAME, tmp, cur->server);
         g_free(tmp);
 
+        /* local boxes don't need to be polled if we get notified */
+        cur->watched = mail_watch_add(mail->watch, cur->type,
+                                      cur->mailbox_name, cur);
+
+        tmp = g_strdup_printf("cache%d", i);
+        if (cache_base && !is_local(cur->type) &&
+                key_file_get_boolean_default(MODULE_NAME, tmp, true)) {
+            char *account;
+
+            account = g_strdup_printf("%s-%s@%s-%s", cur->type, cur->username,
+                                      cur->server, cur->mailbox_name);
+            g_strcanon(account, "abcdefghijklmnopqrstuvwxyz"
+                                "ABCDEFGHIJKLMNOPQRSTUVWXYZ"
+                                "0123456789@.-", '_');
+            cur->cache_dir = g_build_filename(cache_base, account, NULL);
+            if (g_mkdir_with_parents(cur->cache_dir, 0700) != 0) {
+                report(RPT_WARNING, MODULE_NAME ": Cannot create %s, caching disabled",
+                       cur->cache_dir);
+                g_free(cur->cache_dir);
+                cur->cache_dir = NULL;
+            }
+            g_free(account);
+        }
+        g_free(tmp);
+
+        /* remembers the headers of POP3 messages across checks */
+        if (strcmp(cur->type, "pop3") == 0) {
+            char *path = NULL;
+
+            if (cur->cache_dir)
+                path = g_build_filename(cur->cache_dir, "uidl", NULL);
+            cur->uidl = mail_index_load(path);
+            g_free(path);
+        }
+
+        /* show what we had before the restart until the first check is done */
+        mail_summary_load(cur);
+
         g_ptr_array_add(mail->mailboxes, cur);
     }
+    g_free(cache_base);
+    g_free(ca_file);
 
     return true;
 }
@@ -449,35 +1323,69 @@ void *mail_run(void *cookie)
         return NULL;
     conf_dec_count();
 
-    /* check mails instantly */
-    next_check = time(NULL);
+    /* show cached data while checking all mails */
+    show_screen(&mail);
+    mail_check(&mail, true);
+    show_screen(&mail);
+    next_check = mail_next_due(&mail);
 
     /* dispatcher */
     while (!g_exit) {
-        g_usleep(100000);
+        /* sleeps unless a watched box changes */
+        if (mail_watch_wait(mail.watch, DISPATCH_TIMEOUT_MS, mail_watch_handler) > 0) {
+            mail_check_changed(&mail);
+            show_screen(&mail);
+            next_check = mail_next_due(&mail);
+        }
+
+        /* fetch the messages when they're about to be read */
+        if (g_atomic_int_compare_and_exchange(&mail.refresh, 1, 0)) {
+            mail_check_visible(&mail);
+            show_screen(&mail);
+            next_check = mail_next_due(&mail);
+        }
+
+        /* the displayed message needs a preview */
+        if (g_atomic_int_compare_and_exchange(&mail.preview_wanted, 1, 0)) {
+            mail_fetch_preview(&mail);
+            show_screen(&mail);
+        }
+        mail_close_previews(&mail, false);
 
-        /* check emails? */
-        if (time(NULL) > next_check) {
-            mail_check(&mail);
+        /* check the boxes that are due */
+        if (time(NULL) >= next_check) {
+            mail_check(&mail, false);
             show_screen(&mail);
-            next_check = time(NULL) + mail.interval;
+            next_check = mail_next_due(&mail);
         }
     }
 
     service_thread_unregister_client(mail.lcd->service_thread, MODULE_NAME);
-    free_emails(&mail);
+    mail_watch_free(mail.watch);
+    mail_close_previews(&mail, true);
 
     for (i = 0; i < mail.mailboxes->len; i++) {
         struct mailbox *cur = (struct mailbox *)g_ptr_array_index(mail.mailboxes, i);
+        mail_store_free(&cur->store);
+        if (cur->previews)
+            g_hash_table_destroy(cur->previews);
+        g_strfreev(cur->folders);
+        g_free(cur->folder_unseen);
+        mail_tls_free(cur->tls);
+        mbox_state_free(cur->mbox);
+        mail_index_free(cur->uidl);
         g_free(cur->server);
         g_free(cur->username);
         g_free(cur->mailbox_name);
         g_free(cur->password);
         g_free(cur->name);
         g_free(cur->type);
+        g_free(cur->cache_dir);
         free(cur);
     }
     g_ptr_array_free(mail.mailboxes, true);
+    g_mutex_free(mail.mutex);
+    display_cache_free();
     g_free(mail.title_prefix);
     screen_destroy(&mail.screen);
 
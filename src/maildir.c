@@ -0,0 +1,252 @@
+/*
+ * This file is part of lcd-stuff.
+ *
+ * lcd-stuff is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License.
+ *
+ * lcd-stuff is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with lcd-stuff; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <dirent.h>
+
+#include <glib.h>
+
+#include <shared/report.h>
+
+#include "maildir.h"
+#include "maillib.h"
+
+/* ---------------------- constants ----------------------------------------- */
+#define HEADER_CHUNK        4096
+#define HEADER_MAX          (64*1024)
+#define VALUE_MAX           1024
+
+/* ---------------------- types --------------------------------------------- */
+struct unseen_message {
+    char        *name;
+    bool        in_new;
+};
+
+/* -------------------------------------------------------------------------- */
+static bool is_seen(const char *name)
+{
+    const char *info = strstr(name, ":2,");
+
+    return info && strchr(info + 3, 'S') != NULL;
+}
+
+/* -------------------------------------------------------------------------- */
+static gint compare_unseen(gconstpointer a, gconstpointer b)
+{
+    const struct unseen_message *msg_a = *(const struct unseen_message **)a;
+    const struct unseen_message *msg_b = *(const struct unseen_message **)b;
+
+    /* maildir file names start with the delivery time */
+    return strcmp(msg_a->name, msg_b->name);
+}
+
+/* -------------------------------------------------------------------------- */
+static void list_dir(DIR             *dir,
+                     bool            in_new,
+                     unsigned int    *total,
+                     unsigned int    *unseen,
+                     GPtrArray       *messages)
+{
+    struct dirent *entry;
+
+    while ((entry = readdir(dir)) != NULL) {
+        struct unseen_message *msg;
+
+        if (entry->d_name[0] == '.')
+            continue;
+
+        (*total)++;
+        if (!in_new && is_seen(entry->d_name))
+            continue;
+
+        (*unseen)++;
+        if (!messages)
+            continue;
+
+        msg = g_new(struct unseen_message, 1);
+        msg->name = g_strdup(entry->d_name);
+        msg->in_new = in_new;
+        g_ptr_array_add(messages, msg);
+    }
+}
+
+/* -------------------------------------------------------------------------- */
+static size_t read_header_fd(int fd, char *buffer)
+{
+    size_t len = 0;
+
+    /* stop reading at the first empty line */
+    while (len < HEADER_MAX) {
+        size_t start, end;
+        ssize_t n;
+
+        n = pread(fd, buffer + len, MIN(HEADER_CHUNK, HEADER_MAX - len), len);
+        if (n <= 0)
+            break;
+
+        /* the empty line might start in the previous chunk */
+        start = len > 3 ? len - 3 : 0;
+        len += n;
+
+        end = mail_header_end(buffer + start, len - start);
+        if (end > 0) {
+            len = start + end;
+            break;
+        }
+    }
+
+    return len;
+}
+
+/* -------------------------------------------------------------------------- */
+static size_t read_header(int dir_fd, const char *name, char *buffer)
+{
+    size_t len;
+    int fd;
+
+    fd = openat(dir_fd, name, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return 0;
+
+    len = read_header_fd(fd, buffer);
+    close(fd);
+
+    return len;
+}
+
+/* -------------------------------------------------------------------------- */
+bool maildir_scan(const char            *path,
+                  unsigned int          *total,
+                  unsigned int          *unseen,
+                  unsigned int          max_messages,
+                  maildir_message_fun   fun,
+                  void                  *cookie)
+{
+    DIR *new_dir = NULL, *cur_dir = NULL;
+    GPtrArray *messages = NULL;
+    char *buffer = NULL;
+    char *dirname;
+    bool ret = false;
+    unsigned int i, start;
+
+    *total = *unseen = 0;
+
+    dirname = g_build_filename(path, "new", NULL);
+    new_dir = opendir(dirname);
+    g_free(dirname);
+
+    dirname = g_build_filename(path, "cur", NULL);
+    cur_dir = opendir(dirname);
+    g_free(dirname);
+
+    if (!new_dir || !cur_dir) {
+        report(RPT_DEBUG, "%s is no maildir: %s", path, strerror(errno));
+        goto out;
+    }
+
+    if (fun)
+        messages = g_ptr_array_new();
+
+    list_dir(new_dir, true, total, unseen, messages);
+    list_dir(cur_dir, false, total, unseen, messages);
+    ret = true;
+
+    if (!messages)
+        goto out;
+
+    g_ptr_array_sort(messages, compare_unseen);
+
+    /* only the newest ones, the names are cheap but the headers are not */
+    start = 0;
+    if (max_messages > 0 && messages->len > max_messages)
+        start = messages->len - max_messages;
+
+    buffer = g_malloc(HEADER_MAX);
+    for (i = start; i < messages->len; i++) {
+        struct unseen_message *msg = g_ptr_array_index(messages, i);
+        char from[VALUE_MAX], subject[VALUE_MAX];
+        bool has_from, has_subject;
+        char *filename;
+        size_t len;
+
+        len = read_header(dirfd(msg->in_new ? new_dir : cur_dir), msg->name, buffer);
+        if (len == 0)
+            continue;   /* vanished in the meantime */
+
+        has_from = mail_header_get(buffer, len, "From", from, VALUE_MAX);
+        has_subject = mail_header_get(buffer, len, "Subject", subject, VALUE_MAX);
+
+        filename = g_build_filename(msg->in_new ? "new" : "cur", msg->name, NULL);
+        fun(filename, has_from ? from : NULL, has_subject ? subject : NULL, cookie);
+        g_free(filename);
+    }
+
+out:
+    if (messages) {
+        for (i = 0; i < messages->len; i++) {
+            struct unseen_message *msg = g_ptr_array_index(messages, i);
+            g_free(msg->name);
+            g_free(msg);
+        }
+        g_ptr_array_free(messages, true);
+    }
+    g_free(buffer);
+    if (new_dir)
+        closedir(new_dir);
+    if (cur_dir)
+        closedir(cur_dir);
+
+    return ret;
+}
+
+/* -------------------------------------------------------------------------- */
+char *maildir_preview(const char *path, const char *filename)
+{
+    char body[MAIL_PREVIEW_LEN];
+    char *buffer, *name, *preview = NULL;
+    size_t len;
+    ssize_t n;
+    int fd;
+
+    name = g_build_filename(path, filename, NULL);
+    fd = open(name, O_RDONLY | O_CLOEXEC);
+    g_free(name);
+    if (fd < 0)
+        return NULL;
+
+    /* the header is needed for the encoding, then only the start of the body */
+    buffer = g_malloc(HEADER_MAX);
+    len = read_header_fd(fd, buffer);
+    if (len > 0) {
+        n = pread(fd, body, MAIL_PREVIEW_LEN, len);
+        if (n >= 0)
+            preview = mail_preview(buffer, len, body, n);
+    }
+
+    g_free(buffer);
+    close(fd);
+
+    return preview;
+}
+
+/* vim: set ts=4 sw=4 et: */
@@ -0,0 +1,82 @@
+/*
+ * This file is part of lcd-stuff.
+ *
+ * lcd-stuff is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License.
+ *
+ * lcd-stuff is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with lcd-stuff; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+#ifndef MAILDIR_H
+#define MAILDIR_H
+
+#include <stdbool.h>
+
+/**
+ * @file maildir.h
+ * @brief Fast native scanner for maildir mailboxes.
+ *
+ * Unlike the libetpan maildir driver, this scanner never touches the
+ * mailbox: the seen state is taken from the directory (new/) and the
+ * info part of the file name (":2,S"), and only the header block of
+ * unseen messages is read.
+ */
+
+/**
+ * @brief Callback for each unseen message.
+ *
+ * The messages are passed in delivery order. The header values are raw,
+ * i.e. unfolded but not decoded. They are only valid during the call.
+ *
+ * @param[in] filename the file name relative to the maildir, e.g.
+ *            "new/1290000000.M1P2.host"
+ * @param[in] from the raw value of the From header or NULL
+ * @param[in] subject the raw value of the Subject header or NULL
+ * @param[in] cookie the cookie passed to maildir_scan()
+ */
+typedef void (*maildir_message_fun)(const char  *filename,
+                                    const char  *from,
+                                    const char  *subject,
+                                    void        *cookie);
+
+/**
+ * @brief Scans a maildir.
+ *
+ * @param[in] path the path of the maildir (containing new/ and cur/)
+ * @param[out] total the number of messages
+ * @param[out] unseen the number of unseen messages
+ * @param[in] max_messages only the headers of the newest @p max_messages
+ *            unseen messages are read and passed to @p fun, 0 for all
+ * @param[in] fun the callback for unseen messages, may be NULL if only the
+ *            numbers are needed
+ * @param[in] cookie passed to @p fun
+ * @return @c true on success, @c false if @p path is no maildir
+ */
+bool maildir_scan(const char            *path,
+                  unsigned int          *total,
+                  unsigned int          *unseen,
+                  unsigned int          max_messages,
+                  maildir_message_fun   fun,
+                  void                  *cookie);
+
+/**
+ * @brief Reads the header and the first MAIL_PREVIEW_LEN bytes of the body
+ *        of a message and builds a preview from them (see mail_preview()).
+ *
+ * @param[in] path the path of the maildir
+ * @param[in] filename the file name as passed to the maildir_message_fun
+ * @return the preview or NULL if the message could not be read
+ */
+char *maildir_preview(const char *path, const char *filename);
+
+#endif /* MAILDIR_H */
+
+/* vim: set ts=4 sw=4 et: */
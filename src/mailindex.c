@@ -0,0 +1,249 @@
+/*
+ * This file is part of lcd-stuff.
+ *
+ * lcd-stuff is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License.
+ *
+ * lcd-stuff is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with lcd-stuff; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <glib.h>
+
+#include <shared/report.h>
+
+#include "mailindex.h"
+
+/* ---------------------- constants ----------------------------------------- */
+#define INDEX_GROUP         "index"
+
+/* ---------------------- types --------------------------------------------- */
+struct index_entry {
+    char            *from;
+    char            *subject;
+    unsigned int    generation;
+};
+
+struct mail_index {
+    char            *path;
+    GHashTable      *entries;       /* uid -> struct index_entry */
+    unsigned int    generation;
+    bool            dirty;
+};
+
+/* -------------------------------------------------------------------------- */
+static void free_entry(gpointer data)
+{
+    struct index_entry *entry = (struct index_entry *)data;
+
+    g_free(entry->from);
+    g_free(entry->subject);
+    g_free(entry);
+}
+
+/* -------------------------------------------------------------------------- */
+struct mail_index *mail_index_load(const char *path)
+{
+    struct mail_index *index;
+    GKeyFile *key_file;
+    char **uids = NULL, **from = NULL, **subject = NULL;
+    gsize n_uids = 0, n_from = 0, n_subject = 0, i;
+
+    /* loaded entries have generation 0, so they are stale unless looked up */
+    index = g_new0(struct mail_index, 1);
+    index->entries = g_hash_table_new_full(g_str_hash, g_str_equal,
+                                           g_free, free_entry);
+    index->generation = 1;
+    if (!path)
+        return index;
+
+    index->path = g_strdup(path);
+
+    key_file = g_key_file_new();
+    if (!g_key_file_load_from_file(key_file, path, G_KEY_FILE_NONE, NULL))
+        goto out;
+
+    uids = g_key_file_get_string_list(key_file, INDEX_GROUP, "uid", &n_uids, NULL);
+    from = g_key_file_get_string_list(key_file, INDEX_GROUP, "from", &n_from, NULL);
+    subject = g_key_file_get_string_list(key_file, INDEX_GROUP, "subject", &n_subject, NULL);
+    if (n_uids != n_from || n_uids != n_subject) {
+        report(RPT_WARNING, "Ignoring inconsistent index %s", path);
+        goto out;
+    }
+
+    for (i = 0; i < n_uids; i++) {
+        struct index_entry *entry = g_new0(struct index_entry, 1);
+
+        /* GKeyFile is UTF-8, we are ISO-8859-1 */
+        entry->from = g_convert(from[i], -1, "ISO-8859-1", "UTF-8", NULL, NULL, NULL);
+        entry->subject = g_convert(subject[i], -1, "ISO-8859-1", "UTF-8", NULL, NULL, NULL);
+        g_hash_table_replace(index->entries, g_strdup(uids[i]), entry);
+    }
+
+out:
+    g_strfreev(uids);
+    g_strfreev(from);
+    g_strfreev(subject);
+    g_key_file_free(key_file);
+
+    return index;
+}
+
+/* -------------------------------------------------------------------------- */
+bool mail_index_lookup(struct mail_index    *index,
+                       const char           *uid,
+                       const char           **from,
+                       const char           **subject)
+{
+    struct index_entry *entry;
+
+    entry = g_hash_table_lookup(index->entries, uid);
+    if (!entry)
+        return false;
+
+    entry->generation = index->generation;
+    *from = entry->from;
+    *subject = entry->subject;
+
+    return true;
+}
+
+/* -------------------------------------------------------------------------- */
+void mail_index_touch(struct mail_index *index, const char *uid)
+{
+    struct index_entry *entry;
+
+    entry = g_hash_table_lookup(index->entries, uid);
+    if (entry)
+        entry->generation = index->generation;
+}
+
+/* -------------------------------------------------------------------------- */
+void mail_index_add(struct mail_index   *index,
+                    const char          *uid,
+                    const char          *from,
+                    const char          *subject)
+{
+    struct index_entry *entry = g_new0(struct index_entry, 1);
+
+    entry->from = g_strdup(from ? from : "");
+    entry->subject = g_strdup(subject ? subject : "");
+    entry->generation = index->generation;
+    g_hash_table_replace(index->entries, g_strdup(uid), entry);
+    index->dirty = true;
+}
+
+/* -------------------------------------------------------------------------- */
+static gboolean is_stale(gpointer key, gpointer value, gpointer user_data)
+{
+    struct index_entry *entry = (struct index_entry *)value;
+    struct mail_index  *index = (struct mail_index *)user_data;
+
+    return entry->generation != index->generation;
+}
+
+/* -------------------------------------------------------------------------- */
+unsigned int mail_index_prune(struct mail_index *index)
+{
+    unsigned int removed;
+
+    removed = g_hash_table_foreach_remove(index->entries, is_stale, index);
+    if (removed > 0)
+        index->dirty = true;
+    index->generation++;
+
+    return removed;
+}
+
+/* -------------------------------------------------------------------------- */
+struct save_data {
+    char            **uids;
+    char            **from;
+    char            **subject;
+    gsize           n;
+};
+
+/* -------------------------------------------------------------------------- */
+static void collect_entry(gpointer key, gpointer value, gpointer user_data)
+{
+    struct index_entry *entry = (struct index_entry *)value;
+    struct save_data   *data = (struct save_data *)user_data;
+
+    data->uids[data->n] = g_strdup(key);
+    data->from[data->n] = g_convert(entry->from ? entry->from : "", -1,
+                                    "UTF-8", "ISO-8859-1", NULL, NULL, NULL);
+    data->subject[data->n] = g_convert(entry->subject ? entry->subject : "", -1,
+                                       "UTF-8", "ISO-8859-1", NULL, NULL, NULL);
+    if (!data->from[data->n])
+        data->from[data->n] = g_strdup("");
+    if (!data->subject[data->n])
+        data->subject[data->n] = g_strdup("");
+    data->n++;
+}
+
+/* -------------------------------------------------------------------------- */
+void mail_index_save(struct mail_index *index)
+{
+    struct save_data data;
+    GKeyFile *key_file;
+    GError *err = NULL;
+    char *contents;
+    gsize size, len;
+
+    if (!index->path || !index->dirty)
+        return;
+
+    size = g_hash_table_size(index->entries);
+    data.uids = g_new0(char *, size + 1);
+    data.from = g_new0(char *, size + 1);
+    data.subject = g_new0(char *, size + 1);
+    data.n = 0;
+    g_hash_table_foreach(index->entries, collect_entry, &data);
+
+    key_file = g_key_file_new();
+    g_key_file_set_string_list(key_file, INDEX_GROUP, "uid",
+                               (const gchar * const *)data.uids, data.n);
+    g_key_file_set_string_list(key_file, INDEX_GROUP, "from",
+                               (const gchar * const *)data.from, data.n);
+    g_key_file_set_string_list(key_file, INDEX_GROUP, "subject",
+                               (const gchar * const *)data.subject, data.n);
+
+    contents = g_key_file_to_data(key_file, &len, NULL);
+    if (g_file_set_contents(index->path, contents, len, &err))
+        index->dirty = false;
+    else {
+        report(RPT_WARNING, "Cannot write %s: %s", index->path, err->message);
+        g_error_free(err);
+    }
+
+    g_free(contents);
+    g_key_file_free(key_file);
+    g_strfreev(data.uids);
+    g_strfreev(data.from);
+    g_strfreev(data.subject);
+}
+
+/* -------------------------------------------------------------------------- */
+void mail_index_free(struct mail_index *index)
+{
+    if (!index)
+        return;
+
+    g_hash_table_destroy(index->entries);
+    g_free(index->path);
+    g_free(index);
+}
+
+/* vim: set ts=4 sw=4 et: */
@@ -0,0 +1,102 @@
+/*
+ * This file is part of lcd-stuff.
+ *
+ * lcd-stuff is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License.
+ *
+ * lcd-stuff is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with lcd-stuff; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+#ifndef MAILINDEX_H
+#define MAILINDEX_H
+
+#include <stdbool.h>
+
+/**
+ * @file mailindex.h
+ * @brief Persistent index that maps message UIDs to From and Subject.
+ *
+ * Used for POP3, where the server has no flags and every check would
+ * otherwise download the headers of all messages again. The strings are
+ * stored already decoded (ISO-8859-1, like everything we display).
+ *
+ * Each check is a "generation": entries that are looked up or added are
+ * kept, mail_index_prune() removes all others.
+ */
+
+struct mail_index;
+
+/**
+ * @brief Creates an index and loads it from @p path.
+ *
+ * @param[in] path the file that holds the index or NULL for an index that
+ *            only lives in memory
+ * @return the index, never NULL
+ */
+struct mail_index *mail_index_load(const char *path);
+
+/**
+ * @brief Looks up a message and marks it as still present.
+ *
+ * @param[in] index the index
+ * @param[in] uid the UID of the message
+ * @param[out] from the decoded From, owned by the index
+ * @param[out] subject the decoded Subject, owned by the index
+ * @return @c true if the message is known
+ */
+bool mail_index_lookup(struct mail_index    *index,
+                       const char           *uid,
+                       const char           **from,
+                       const char           **subject);
+
+/**
+ * @brief Marks a message as still present without looking at it, for the
+ *        messages that are not listed.
+ *
+ * @param[in] index the index
+ * @param[in] uid the UID of the message
+ */
+void mail_index_touch(struct mail_index *index, const char *uid);
+
+/**
+ * @brief Adds a message (and marks it as present).
+ *
+ * @param[in] index the index
+ * @param[in] uid the UID of the message
+ * @param[in] from the decoded From, may be NULL
+ * @param[in] subject the decoded Subject, may be NULL
+ */
+void mail_index_add(struct mail_index   *index,
+                    const char          *uid,
+                    const char          *from,
+                    const char          *subject);
+
+/**
+ * @brief Removes all messages that have not been looked up, touched or added
+ *        since the last call and starts a new generation.
+ *
+ * @return the number of removed messages
+ */
+unsigned int mail_index_prune(struct mail_index *index);
+
+/**
+ * @brief Writes the index atomically if it has been modified.
+ */
+void mail_index_save(struct mail_index *index);
+
+/**
+ * @brief Frees the index (without saving).
+ */
+void mail_index_free(struct mail_index *index);
+
+#endif /* MAILINDEX_H */
+
+/* vim: set ts=4 sw=4 et: */
@@ -15,15 +15,26 @@
  * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
  *
  */
+#define _GNU_SOURCE
 #include <libetpan/libetpan.h>
 #include <string.h>
 
 #include <glib.h>
 #include <stdlib.h>
+#include <unistd.h>
 
 #include <shared/report.h>
 
 #include "maillib.h"
+#include "mailtls.h"
+#include "util.h"
+
+/* ---------------------- constants ----------------------------------------- */
+#define DECODE_CACHE_SIZE   1024    /* entries per generation */
+#define PART_VALUE_MAX      256
+#define PART_DEPTH_MAX      3
+#define FOLDER_NAME_MAX     256
+#define TAG_PREFIX          "lcds"
 
 /* from http://cvs.sourceforge.net/viewcvs.py/libetpan/libetpan/tests/readmsg-simple.c?rev=1.7&view=markup */
 
@@ -41,6 +52,17 @@ static struct storage_name storage_tab[] = {
     {MAILDIR_STORAGE, "maildir"},
 };
 
+/*
+ * Cache for decoded headers, keyed by the raw header value. Two generations
+ * keep the size bounded: when the current table is full, it becomes the
+ * previous one and the old previous one is dropped. Hits in the previous
+ * generation are moved to the current one, so the headers of mail that
+ * stays in the box survive.
+ */
+static GHashTable   *s_decode_cache[2];
+static volatile gint s_decode_hits;
+static volatile gint s_decode_misses;
+
 /* -------------------------------------------------------------------------- */
 int get_driver(char * name)
 {
@@ -58,6 +80,19 @@ int get_driver(char * name)
     return driver_type;
 }
 
+/* -------------------------------------------------------------------------- */
+int get_connection_type(const char *name)
+{
+    if (strcmp(name, "plain") == 0)
+        return CONNECTION_TYPE_PLAIN;
+    else if (strcmp(name, "tls") == 0)
+        return CONNECTION_TYPE_TLS;
+    else if (strcmp(name, "starttls") == 0)
+        return CONNECTION_TYPE_STARTTLS;
+    else
+        return -1;
+}
+
 /* -------------------------------------------------------------------------- */
 bool is_local(const char *driver)
 {
@@ -147,6 +182,144 @@ err:
     return r;
 }
 
+/* -------------------------------------------------------------------------- */
+static uint16_t default_port(int driver, int connection_type)
+{
+    bool tls = connection_type == CONNECTION_TYPE_TLS;
+
+    if (driver == IMAP_STORAGE)
+        return tls ? 993 : 143;
+    else
+        return tls ? 995 : 110;
+}
+
+/* -------------------------------------------------------------------------- */
+static mailstream *open_stream(int                 driver,
+                               const char          *server,
+                               int                 connection_type,
+                               struct mail_tls     *tls)
+{
+    mailstream_low *low;
+    mailstream *stream;
+    int fd;
+
+    fd = mail_tls_tcp_connect(server, default_port(driver, connection_type));
+    if (fd < 0)
+        return NULL;
+
+    if (connection_type == CONNECTION_TYPE_TLS)
+        low = mail_tls_handshake(tls, fd);
+    else
+        low = mailstream_low_socket_open(fd);
+    if (!low) {
+        close(fd);
+        return NULL;
+    }
+
+    stream = mailstream_new(low, 8192);
+    if (!stream) {
+        mailstream_low_close(low);
+        mailstream_low_free(low);
+    }
+
+    return stream;
+}
+
+/* -------------------------------------------------------------------------- */
+static bool session_starttls(mailsession        *session,
+                             int                driver,
+                             bool               cached,
+                             struct mail_tls    *tls)
+{
+    if (driver == IMAP_STORAGE) {
+        mailimap *imap;
+
+        if (cached)
+            session = ((struct imap_cached_session_state_data *)session->sess_data)->imap_ancestor;
+        imap = ((struct imap_session_state_data *)session->sess_data)->imap_session;
+
+        return mailimap_starttls(imap) == MAILIMAP_NO_ERROR &&
+               mail_tls_upgrade(tls, imap->imap_stream);
+    } else {
+        mailpop3 *pop3;
+
+        if (cached)
+            session = ((struct pop3_cached_session_state_data *)session->sess_data)->pop3_ancestor;
+        pop3 = ((struct pop3_session_state_data *)session->sess_data)->pop3_session;
+
+        return mailpop3_stls(pop3) == MAILPOP3_NO_ERROR &&
+               mail_tls_upgrade(tls, pop3->pop3_stream);
+    }
+}
+
+/* -------------------------------------------------------------------------- */
+int connect_storage(struct mailstorage  *storage,
+                    int                 driver,
+                    const char          *server,
+                    int                 connection_type,
+                    struct mail_tls     *tls,
+                    const char          *user,
+                    const char          *password,
+                    const char          *cache_directory,
+                    const char          *flags_directory)
+{
+    mailsession *session;
+    mailstream *stream;
+    bool cached = cache_directory != NULL;
+    int r;
+
+    if (driver == IMAP_STORAGE) {
+        session = mailsession_new(cached ? imap_cached_session_driver : imap_session_driver);
+        if (session && cached)
+            mailsession_parameters(session, IMAPDRIVER_CACHED_SET_CACHE_DIRECTORY,
+                                   (void *)cache_directory);
+    } else if (driver == POP3_STORAGE) {
+        session = mailsession_new(cached ? pop3_cached_session_driver : pop3_session_driver);
+        if (session && cached) {
+            mailsession_parameters(session, POP3DRIVER_CACHED_SET_CACHE_DIRECTORY,
+                                   (void *)cache_directory);
+            mailsession_parameters(session, POP3DRIVER_CACHED_SET_FLAGS_DIRECTORY,
+                                   (void *)flags_directory);
+        }
+    } else
+        return MAIL_ERROR_INVAL;
+
+    if (!session)
+        return MAIL_ERROR_MEMORY;
+
+    stream = open_stream(driver, server, connection_type, tls);
+    if (!stream) {
+        r = MAIL_ERROR_CONNECT;
+        goto err;
+    }
+
+    /* the session owns the stream now */
+    r = mailsession_connect_stream(session, stream);
+    if (r != MAIL_NO_ERROR && r != MAIL_NO_ERROR_AUTHENTICATED &&
+            r != MAIL_NO_ERROR_NON_AUTHENTICATED)
+        goto err;
+
+    if (connection_type == CONNECTION_TYPE_STARTTLS &&
+            !session_starttls(session, driver, cached, tls)) {
+        report(RPT_ERR, "STARTTLS with %s failed", server);
+        r = MAIL_ERROR_SSL;
+        goto err;
+    }
+
+    r = mailsession_login(session, user, password);
+    if (r != MAIL_NO_ERROR)
+        goto err;
+
+    /* mailfolder_connect() uses this session instead of connecting itself */
+    storage->sto_session = session;
+
+    return MAIL_NO_ERROR;
+
+err:
+    mailsession_free(session);
+    return r;
+}
+
 /* -------------------------------------------------------------------------- */
 char *mail_decode(const char *string)
 {
@@ -168,26 +341,852 @@ char *mail_decode(const char *string)
 }
 
 /* -------------------------------------------------------------------------- */
-char *display_from(struct mailimf_from *from)
+static char *decode_display(const char *string)
+{
+    return string_canon(mail_decode(string));
+}
+
+/* -------------------------------------------------------------------------- */
+static char *cached_decode(char kind, const char *raw, char *(*decode)(const char *))
+{
+    char *key, *value;
+
+    if (!s_decode_cache[0]) {
+        s_decode_cache[0] = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, g_free);
+        s_decode_cache[1] = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, g_free);
+    }
+
+    /* the kind keeps From and Subject with the same raw value apart */
+    key = g_strdup_printf("%c%s", kind, raw);
+
+    value = g_hash_table_lookup(s_decode_cache[0], key);
+    if (value) {
+        g_atomic_int_inc(&s_decode_hits);
+        g_free(key);
+        return g_strdup(value);
+    }
+
+    value = g_hash_table_lookup(s_decode_cache[1], key);
+    if (value) {
+        g_atomic_int_inc(&s_decode_hits);
+        value = g_strdup(value);
+    } else {
+        g_atomic_int_inc(&s_decode_misses);
+        value = decode(raw);
+    }
+
+    if (g_hash_table_size(s_decode_cache[0]) >= DECODE_CACHE_SIZE) {
+        GHashTable *old = s_decode_cache[1];
+
+        s_decode_cache[1] = s_decode_cache[0];
+        s_decode_cache[0] = old;
+        g_hash_table_remove_all(old);
+    }
+    g_hash_table_insert(s_decode_cache[0], key, g_strdup(value));
+
+    return value;
+}
+
+/* -------------------------------------------------------------------------- */
+static char *display_mailbox_list(struct mailimf_mailbox_list *mb_list)
 {
     clistiter *cur;
 
-    for (cur = clist_begin(from->frm_mb_list->mb_list); cur;
+    for (cur = clist_begin(mb_list->mb_list); cur;
             cur = clist_next(cur)) {
         struct mailimf_mailbox * mb;
 
         mb = clist_content(cur);
 
-        return mail_decode(mb->mb_display_name);
+        return mb->mb_display_name
+            ? cached_decode('P', mb->mb_display_name, decode_display)
+            : g_strdup("");
     }
     return g_strdup("");
 }
 
+/* -------------------------------------------------------------------------- */
+char *display_from(struct mailimf_from *from)
+{
+    return display_mailbox_list(from->frm_mb_list);
+}
+
+/* -------------------------------------------------------------------------- */
+static char *decode_from(const char *from)
+{
+    struct mailimf_mailbox_list *mb_list = NULL;
+    size_t cur_token = 0;
+    char *ret;
+    int err;
+
+    err = mailimf_mailbox_list_parse(from, strlen(from), &cur_token, &mb_list);
+    if (err != MAILIMF_NO_ERROR)
+        return decode_display(from);
+
+    ret = display_mailbox_list(mb_list);
+    mailimf_mailbox_list_free(mb_list);
+
+    return ret;
+}
+
+/* -------------------------------------------------------------------------- */
+char *display_from_raw(const char *from)
+{
+    if (!from)
+        return NULL;
+
+    return cached_decode('F', from, decode_from);
+}
+
 /* -------------------------------------------------------------------------- */
 char *display_subject(struct mailimf_subject * subject)
 {
-    return mail_decode(subject->sbj_value);
+    return display_subject_raw(subject->sbj_value);
+}
+
+/* -------------------------------------------------------------------------- */
+char *display_subject_raw(const char *subject)
+{
+    if (!subject)
+        return NULL;
+
+    return cached_decode('S', subject, decode_display);
+}
+
+/* -------------------------------------------------------------------------- */
+void display_cache_stats(unsigned int *hits, unsigned int *misses)
+{
+    *hits = g_atomic_int_get(&s_decode_hits);
+    *misses = g_atomic_int_get(&s_decode_misses);
+}
+
+/* -------------------------------------------------------------------------- */
+void display_cache_free(void)
+{
+    int i;
+
+    for (i = 0; i < 2; i++) {
+        if (s_decode_cache[i])
+            g_hash_table_destroy(s_decode_cache[i]);
+        s_decode_cache[i] = NULL;
+    }
+}
+
+/* -------------------------------------------------------------------------- */
+size_t mail_header_end(const char *buffer, size_t len)
+{
+    size_t i;
+
+    for (i = 0; i + 1 < len; i++) {
+        if (buffer[i] != '\n')
+            continue;
+
+        if (buffer[i+1] == '\n')
+            return i + 2;
+        if (buffer[i+1] == '\r' && i + 2 < len && buffer[i+2] == '\n')
+            return i + 3;
+    }
+
+    return 0;
+}
+
+/* -------------------------------------------------------------------------- */
+bool mail_header_get(const char     *buffer,
+                     size_t         len,
+                     const char     *name,
+                     char           *value,
+                     size_t         value_len)
+{
+    size_t name_len = strlen(name);
+    const char *end = buffer + len;
+    const char *line = buffer;
+
+    while (line < end) {
+        const char *eol = memchr(line, '\n', end - line);
+        const char *next = eol ? eol + 1 : end;
+
+        /* end of the header block */
+        if (line[0] == '\n' || (line[0] == '\r' && line + 1 < end && line[1] == '\n'))
+            break;
+
+        if ((size_t)(end - line) > name_len && line[name_len] == ':' &&
+                strncasecmp(line, name, name_len) == 0) {
+            const char *cur = line + name_len + 1;
+            size_t pos = 0;
+
+            while (cur < next && (*cur == ' ' || *cur == '\t'))
+                cur++;
+
+            /* copy the value and unfold continuation lines */
+            for (;;) {
+                for (; cur < next && *cur != '\r' && *cur != '\n'; cur++)
+                    if (pos + 1 < value_len)
+                        value[pos++] = *cur;
+
+                if (next >= end || (*next != ' ' && *next != '\t'))
+                    break;
+
+                cur = next;
+                eol = memchr(cur, '\n', end - cur);
+                next = eol ? eol + 1 : end;
+            }
+
+            value[pos] = '\0';
+            return true;
+        }
+
+        line = next;
+    }
+
+    return false;
+}
+
+/* -------------------------------------------------------------------------- */
+/*
+ * Copies the parameter @p name (e.g. "charset") of a Content-Type value to
+ * @p value, which is empty if there is none.
+ */
+static void content_type_param(const char   *content_type,
+                               const char   *name,
+                               char         *value,
+                               size_t       len)
+{
+    const char *param = content_type;
+    size_t name_len = strlen(name);
+    size_t pos = 0;
+
+    value[0] = '\0';
+
+    while ((param = strchr(param, ';')) != NULL) {
+        bool quoted;
+
+        param++;
+        while (*param == ' ' || *param == '\t')
+            param++;
+        if (g_ascii_strncasecmp(param, name, name_len) != 0 || param[name_len] != '=')
+            continue;
+
+        param += name_len + 1;
+        quoted = *param == '"';
+        if (quoted)
+            param++;
+        while (*param && *param != '"' && pos + 1 < len &&
+                (quoted || (*param != ';' && !g_ascii_isspace(*param))))
+            value[pos++] = *param++;
+        value[pos] = '\0';
+        return;
+    }
+}
+
+/* -------------------------------------------------------------------------- */
+static const char *skip_to_first_part(const char    *body,
+                                      size_t        *body_len,
+                                      char          *content_type,
+                                      char          *encoding)
+{
+    const char *end = body + *body_len;
+    const char *boundary, *part_header, *part, *eol, *p;
+    char delimiter[PART_VALUE_MAX + 3] = "\n--";
+    size_t header_len, delimiter_len;
+    bool known;
+
+    /*
+     * The boundary line, which may follow a preamble. Without the boundary
+     * parameter (IMAP TEXT of an unknown type), any line starting with "--"
+     * that is followed by a part header will do.
+     */
+    content_type_param(content_type, "boundary", delimiter + 3, PART_VALUE_MAX);
+    delimiter_len = strlen(delimiter);
+    known = delimiter_len > 3;
+
+    if (*body_len >= delimiter_len - 1 && memcmp(body, delimiter + 1, delimiter_len - 1) == 0)
+        boundary = body;
+    else {
+        boundary = memmem(body, *body_len, delimiter, delimiter_len);
+        if (!boundary)
+            return NULL;
+        boundary++;
+    }
+
+    eol = memchr(boundary, '\n', end - boundary);
+    if (!eol)
+        return NULL;
+
+    /* the part ends at the next boundary line, as found if unknown */
+    if (!known)
+        for (p = boundary + 2; p < eol && *p != '\r' && *p != ' ' && *p != '\t' &&
+                delimiter_len < sizeof(delimiter); p++)
+            delimiter[delimiter_len++] = *p;
+
+    part_header = eol + 1;
+    header_len = mail_header_end(part_header, end - part_header);
+    if (header_len == 0)
+        return NULL;
+
+    /* a part without type is text (RFC 2046), if we know it is a part */
+    if (!mail_header_get(part_header, header_len, "Content-Type",
+                         content_type, PART_VALUE_MAX)) {
+        if (!known)
+            return NULL;
+        g_strlcpy(content_type, "text/plain", PART_VALUE_MAX);
+    }
+
+    encoding[0] = '\0';
+    mail_header_get(part_header, header_len, "Content-Transfer-Encoding",
+                    encoding, PART_VALUE_MAX);
+
+    part = part_header + header_len;
+    p = memmem(part, end - part, delimiter, delimiter_len);
+    *body_len = (p ? p : end) - part;
+    return part;
+}
+
+/* -------------------------------------------------------------------------- */
+char *mail_preview(const char   *header,
+                   size_t       header_len,
+                   const char   *body,
+                   size_t       body_len)
+{
+    char encoding[PART_VALUE_MAX] = "";
+    char content_type[PART_VALUE_MAX] = "";
+    char charset[PART_VALUE_MAX];
+    guchar *decoded = NULL;
+    GString *text;
+    bool multipart = true;
+    bool space = false;
+    size_t i;
+    int depth;
+
+    /* without header (IMAP TEXT), look for MIME parts anyway */
+    if (header) {
+        mail_header_get(header, header_len, "Content-Transfer-Encoding",
+                        encoding, PART_VALUE_MAX);
+        mail_header_get(header, header_len, "Content-Type",
+                        content_type, PART_VALUE_MAX);
+        multipart = g_ascii_strncasecmp(content_type, "multipart/", 10) == 0;
+    }
+
+    /* the first part is usually the text, maybe nested (alternative) */
+    for (depth = 0; multipart && depth < PART_DEPTH_MAX; depth++) {
+        const char *part = skip_to_first_part(body, &body_len, content_type, encoding);
+        if (!part)
+            break;
+        body = part;
+
+        /* descend only into parts that have parts themselves */
+        multipart = g_ascii_strncasecmp(content_type, "multipart/", 10) == 0;
+    }
+
+    if (g_ascii_strncasecmp(encoding, "base64", 6) == 0) {
+        GString *b64 = g_string_sized_new(body_len);
+        gsize len;
+
+        /* decode only complete groups, the body is truncated */
+        for (i = 0; i < body_len; i++)
+            if (!g_ascii_isspace(body[i]))
+                g_string_append_c(b64, body[i]);
+        g_string_truncate(b64, b64->len & ~3);
+
+        decoded = g_base64_decode(b64->str, &len);
+        g_string_free(b64, true);
+        body = (const char *)decoded;
+        body_len = decoded ? len : 0;
+    }
+
+    text = g_string_sized_new(MAIL_PREVIEW_LEN);
+    for (i = 0; i < body_len && text->len < MAIL_PREVIEW_LEN; i++) {
+        char c = body[i];
+
+        if (c == '=' && g_ascii_strncasecmp(encoding, "quoted-printable", 16) == 0) {
+            if (i + 2 < body_len && g_ascii_xdigit_value(body[i+1]) >= 0 &&
+                    g_ascii_xdigit_value(body[i+2]) >= 0) {
+                c = g_ascii_xdigit_value(body[i+1]) * 16 + g_ascii_xdigit_value(body[i+2]);
+                i += 2;
+            } else {
+                /* soft line break */
+                while (i + 1 < body_len && (body[i+1] == '\r' || body[i+1] == '\n'))
+                    i++;
+                continue;
+            }
+        }
+
+        /* one line on the display */
+        if ((unsigned char)c <= ' ') {
+            space = text->len > 0;
+            continue;
+        }
+        if (space)
+            g_string_append_c(text, ' ');
+        g_string_append_c(text, c);
+        space = false;
+    }
+
+    g_free(decoded);
+
+    /* the display is Latin-1, the text may end in the middle of a character */
+    content_type_param(content_type, "charset", charset, PART_VALUE_MAX);
+    if (charset[0] && g_ascii_strcasecmp(charset, "us-ascii") != 0 &&
+            g_ascii_strcasecmp(charset, "iso-8859-1") != 0) {
+        gsize read;
+        char *latin1 = g_convert_with_fallback(text->str, text->len, "ISO-8859-1",
+                                               charset, "?", &read, NULL, NULL);
+        if (latin1) {
+            g_string_assign(text, latin1);
+            g_free(latin1);
+        }
+    }
+
+    return string_canon(g_string_free(text, false));
+}
+
+/* -------------------------------------------------------------------------- */
+static int section_type(struct mailimap_msg_att_body_section *body_section)
+{
+    struct mailimap_section *section = body_section->sec_section;
+
+    if (!section || !section->sec_spec ||
+            section->sec_spec->sec_type != MAILIMAP_SECTION_SPEC_SECTION_MSGTEXT)
+        return -1;
+
+    return section->sec_spec->sec_data.sec_msgtext->sec_type;
+}
+
+/* -------------------------------------------------------------------------- */
+/*
+ * Fetches the preview of message @p number on a selected session. Returns
+ * false if the connection failed, @p preview may be NULL anyway (the
+ * message is gone).
+ */
+static bool imap_preview_fetch(mailimap *imap, uint32_t number, char **preview)
+{
+    struct mailimap_fetch_type *fetch_type;
+    struct mailimap_fetch_att *fetch_att;
+    struct mailimap_set *set;
+    clist *result = NULL, *fields;
+    clistiter *cur, *item_cur;
+    int r;
+
+    /*
+     * The start of the text and, for messages that are not multipart, the
+     * header fields that tell how to decode it.
+     */
+    fields = clist_new();
+    clist_append(fields, strdup("Content-Type"));
+    clist_append(fields, strdup("Content-Transfer-Encoding"));
+    fetch_type = mailimap_fetch_type_new_fetch_att_list_empty();
+    fetch_att = mailimap_fetch_att_new_body_peek_section(
+            mailimap_section_new_header_fields(mailimap_header_list_new(fields)));
+    mailimap_fetch_type_new_fetch_att_list_add(fetch_type, fetch_att);
+    fetch_att = mailimap_fetch_att_new_body_peek_section_partial(
+            mailimap_section_new_text(), 0, MAIL_PREVIEW_LEN);
+    mailimap_fetch_type_new_fetch_att_list_add(fetch_type, fetch_att);
+
+    set = mailimap_set_new_single(number);
+    r = mailimap_uid_fetch(imap, set, fetch_type, &result);
+    mailimap_fetch_type_free(fetch_type);
+    mailimap_set_free(set);
+    if (r != MAILIMAP_NO_ERROR)
+        return false;
+
+    *preview = NULL;
+    for (cur = clist_begin(result); cur && !*preview; cur = clist_next(cur)) {
+        struct mailimap_msg_att *msg_att = clist_content(cur);
+        struct mailimap_msg_att_body_section *header = NULL, *text = NULL;
+
+        for (item_cur = clist_begin(msg_att->att_list); item_cur;
+                item_cur = clist_next(item_cur)) {
+            struct mailimap_msg_att_item *item = clist_content(item_cur);
+            struct mailimap_msg_att_body_section *section;
+
+            if (item->att_type != MAILIMAP_MSG_ATT_ITEM_STATIC ||
+                    item->att_data.att_static->att_type != MAILIMAP_MSG_ATT_BODY_SECTION)
+                continue;
+
+            section = item->att_data.att_static->att_data.att_body_section;
+            if (section_type(section) == MAILIMAP_SECTION_MSGTEXT_HEADER_FIELDS)
+                header = section;
+            else if (section_type(section) == MAILIMAP_SECTION_MSGTEXT_TEXT)
+                text = section;
+        }
+
+        if (!text)
+            continue;
+        if (header && header->sec_body_part)
+            *preview = mail_preview(header->sec_body_part, header->sec_length,
+                                    text->sec_body_part, text->sec_length);
+        else
+            *preview = mail_preview(NULL, 0, text->sec_body_part, text->sec_length);
+    }
+    mailimap_fetch_list_free(result);
+
+    return true;
+}
+
+/* -------------------------------------------------------------------------- */
+char *imap_fetch_preview(mailimap         **session,
+                         const char       *server,
+                         int              connection_type,
+                         struct mail_tls  *tls,
+                         const char       *user,
+                         const char       *password,
+                         const char       *mailbox,
+                         const char       *uid)
+{
+    const char *uid_number;
+    char *preview = NULL;
+    uint32_t number;
+    int attempt;
+
+    /* the UIDs of the libetpan driver are "<uidvalidity>-<uid>" */
+    uid_number = strrchr(uid, '-');
+    number = strtoul(uid_number ? uid_number + 1 : uid, NULL, 10);
+    if (number == 0)
+        return NULL;
+
+    /* the server may have closed a session that we kept, then reconnect */
+    for (attempt = *session ? 0 : 1; attempt < 2; attempt++) {
+        if (!*session) {
+            *session = imap_connect(server, connection_type, tls, user, password);
+            if (!*session)
+                return NULL;
+
+            /* read-only, and BODY.PEEK doesn't set \Seen either */
+            if (mailimap_examine(*session, mailbox) != MAILIMAP_NO_ERROR)
+                break;
+        }
+
+        if (imap_preview_fetch(*session, number, &preview))
+            return preview;
+
+        imap_disconnect(*session);
+        *session = NULL;
+    }
+
+    if (*session) {
+        imap_disconnect(*session);
+        *session = NULL;
+    }
+
+    return NULL;
+}
+
+/* -------------------------------------------------------------------------- */
+static gint compare_uid(gconstpointer a, gconstpointer b)
+{
+    uint32_t uid_a = *(const uint32_t *)a;
+    uint32_t uid_b = *(const uint32_t *)b;
+
+    return uid_a < uid_b ? -1 : uid_a > uid_b;
 }
 
+/* -------------------------------------------------------------------------- */
+int imap_get_unseen_messages_list(struct mailfolder         *folder,
+                                  unsigned int              max,
+                                  struct mailmessage_list   **result)
+{
+    struct mailimap_search_key *key;
+    mailsession *session = folder->fld_session;
+    mailimap *imap;
+    clist *search = NULL;
+    clistiter *cur;
+    GArray *uids;
+    carray *tab;
+    unsigned int i;
+    int r;
+
+    if (session->sess_driver == imap_cached_session_driver)
+        session = ((struct imap_cached_session_state_data *)session->sess_data)->imap_ancestor;
+    imap = ((struct imap_session_state_data *)session->sess_data)->imap_session;
+
+    /* the folder has been selected by mailfolder_connect() */
+    key = mailimap_search_key_new_unseen();
+    r = mailimap_uid_search(imap, NULL, key, &search);
+    mailimap_search_key_free(key);
+    if (r != MAILIMAP_NO_ERROR)
+        return MAIL_ERROR_FETCH;
+
+    /* servers usually sort the result, but they don't have to */
+    uids = g_array_sized_new(false, false, sizeof(uint32_t), clist_count(search));
+    for (cur = clist_begin(search); cur; cur = clist_next(cur))
+        g_array_append_val(uids, *(uint32_t *)clist_content(cur));
+    mailimap_search_result_free(search);
+    g_array_sort(uids, compare_uid);
+
+    tab = carray_new(MIN(max, uids->len) + 1);
+    if (!tab) {
+        r = MAIL_ERROR_MEMORY;
+        goto out;
+    }
+
+    /* the highest UIDs are the newest messages */
+    for (i = uids->len > max ? uids->len - max : 0; i < uids->len; i++) {
+        mailmessage *message;
+
+        r = mailfolder_get_message(folder, g_array_index(uids, uint32_t, i), &message);
+        if (r != MAIL_NO_ERROR)
+            goto err;
+        if (carray_add(tab, message, NULL) != 0) {
+            mailmessage_free(message);
+            r = MAIL_ERROR_MEMORY;
+            goto err;
+        }
+    }
+
+    *result = mailmessage_list_new(tab);
+    if (!*result) {
+        r = MAIL_ERROR_MEMORY;
+        goto err;
+    }
+    r = MAIL_NO_ERROR;
+    goto out;
+
+err:
+    for (i = 0; i < carray_count(tab); i++)
+        mailmessage_free(carray_get(tab, i));
+    carray_free(tab);
+
+out:
+    g_array_free(uids, true);
+
+    return r;
+}
+
+/* -------------------------------------------------------------------------- */
+mailimap *imap_connect(const char         *server,
+                       int                connection_type,
+                       struct mail_tls    *tls,
+                       const char         *user,
+                       const char         *password)
+{
+    mailstream *stream;
+    mailimap *imap;
+    int r;
+
+    imap = mailimap_new(0, NULL);
+    if (!imap)
+        return NULL;
+
+    stream = open_stream(IMAP_STORAGE, server, connection_type, tls);
+    if (!stream) {
+        mailimap_free(imap);
+        return NULL;
+    }
+
+    r = mailimap_connect(imap, stream);
+    if (r != MAILIMAP_NO_ERROR_NON_AUTHENTICATED && r != MAILIMAP_NO_ERROR_AUTHENTICATED) {
+        report(RPT_ERR, "Cannot connect to %s", server);
+        mailimap_free(imap);
+        return NULL;
+    }
+
+    if (connection_type == CONNECTION_TYPE_STARTTLS &&
+            (mailimap_starttls(imap) != MAILIMAP_NO_ERROR ||
+             !mail_tls_upgrade(tls, imap->imap_stream))) {
+        report(RPT_ERR, "STARTTLS with %s failed", server);
+        mailimap_free(imap);
+        return NULL;
+    }
+
+    if (mailimap_login(imap, user, password) != MAILIMAP_NO_ERROR) {
+        report(RPT_ERR, "Login to %s failed", server);
+        mailimap_free(imap);
+        return NULL;
+    }
+
+    return imap;
+}
+
+/* -------------------------------------------------------------------------- */
+void imap_disconnect(mailimap *imap)
+{
+    mailimap_logout(imap);
+    mailimap_free(imap);
+}
+
+/* -------------------------------------------------------------------------- */
+static void append_quoted(GString *cmd, const char *string)
+{
+    g_string_append_c(cmd, '"');
+    for (; *string; string++) {
+        if (*string == '"' || *string == '\\')
+            g_string_append_c(cmd, '\\');
+        g_string_append_c(cmd, *string);
+    }
+    g_string_append_c(cmd, '"');
+}
+
+/* -------------------------------------------------------------------------- */
+static const char *parse_astring(const char *p, char *out, size_t out_len)
+{
+    size_t pos = 0;
+
+    while (*p == ' ')
+        p++;
+
+    if (*p == '"') {
+        for (p++; *p && *p != '"'; p++) {
+            if (*p == '\\' && p[1])
+                p++;
+            if (pos + 1 < out_len)
+                out[pos++] = *p;
+        }
+        if (*p == '"')
+            p++;
+    } else {
+        for (; *p && *p != ' ' && *p != '(' && *p != ')'; p++)
+            if (pos + 1 < out_len)
+                out[pos++] = *p;
+    }
+    out[pos] = '\0';
+
+    return p;
+}
+
+/* -------------------------------------------------------------------------- */
+static int folder_index(const char *name, char **folders, unsigned int n)
+{
+    unsigned int i;
+
+    for (i = 0; i < n; i++) {
+        /* INBOX is case-insensitive */
+        if (strcmp(folders[i], name) == 0 ||
+                (g_ascii_strcasecmp(name, "INBOX") == 0 &&
+                 g_ascii_strcasecmp(folders[i], "INBOX") == 0))
+            return i;
+    }
+
+    return -1;
+}
+
+/* -------------------------------------------------------------------------- */
+static void parse_status(const char     *line,
+                         char           **folders,
+                         unsigned int   n,
+                         unsigned int   *messages,
+                         unsigned int   *unseen)
+{
+    char name[FOLDER_NAME_MAX];
+    const char *p;
+    int i;
+
+    /* * STATUS <mailbox> (MESSAGES <n> UNSEEN <n>), literals are not supported */
+    if (g_ascii_strncasecmp(line, "* STATUS ", 9) != 0)
+        return;
+
+    p = parse_astring(line + 9, name, FOLDER_NAME_MAX);
+    i = folder_index(name, folders, n);
+    if (i < 0)
+        return;
+
+    p = strchr(p, '(');
+    if (!p)
+        return;
+    p++;
+
+    while (*p && *p != ')') {
+        char att[16];
+        unsigned long value;
+        char *end;
+
+        p = parse_astring(p, att, sizeof(att));
+        value = strtoul(p, &end, 10);
+        if (end == p)
+            break;
+        p = end;
+
+        if (g_ascii_strcasecmp(att, "MESSAGES") == 0)
+            messages[i] = value;
+        else if (g_ascii_strcasecmp(att, "UNSEEN") == 0)
+            unseen[i] = value;
+    }
+}
+
+/* -------------------------------------------------------------------------- */
+static bool send_status_commands(mailimap       *imap,
+                                 GString        *cmd,
+                                 const char     *last_tag,
+                                 char           **folders,
+                                 unsigned int   n,
+                                 unsigned int   *messages,
+                                 unsigned int   *unseen)
+{
+    size_t tag_len = strlen(last_tag);
+    MMAPString *buffer;
+    bool ok = false;
+    char *line;
+
+    if (mailstream_write(imap->imap_stream, cmd->str, cmd->len) < 0 ||
+            mailstream_flush(imap->imap_stream) < 0)
+        return false;
+
+    /* the responses come in order, so we're done with the last tag */
+    buffer = mmap_string_new("");
+    while ((line = mailstream_read_line_remove_eol(imap->imap_stream, buffer)) != NULL) {
+        if (line[0] == '*')
+            parse_status(line, folders, n, messages, unseen);
+        else if (strncmp(line, last_tag, tag_len) == 0 && line[tag_len] == ' ') {
+            ok = g_ascii_strncasecmp(line + tag_len + 1, "OK", 2) == 0;
+            break;
+        }
+    }
+    mmap_string_free(buffer);
+
+    return ok;
+}
+
+/* -------------------------------------------------------------------------- */
+bool imap_folders_status(mailimap        *imap,
+                         char            **folders,
+                         unsigned int    n,
+                         unsigned int    *messages,
+                         unsigned int    *unseen)
+{
+    struct mailimap_capability_data *capabilities = NULL;
+    char last_tag[32];
+    GString *cmd;
+    unsigned int i;
+    bool ok = false;
+
+    memset(messages, 0, n * sizeof(unsigned int));
+    memset(unseen, 0, n * sizeof(unsigned int));
+
+    if (mailimap_capability(imap, &capabilities) == MAILIMAP_NO_ERROR)
+        mailimap_capability_data_free(capabilities);
+
+    cmd = g_string_new("");
+
+    /* RFC 5819, more than one pattern needs LIST-EXTENDED (RFC 5258) */
+    if (mailimap_has_extension(imap, "LIST-STATUS") &&
+            mailimap_has_extension(imap, "LIST-EXTENDED")) {
+        g_string_append(cmd, TAG_PREFIX "1 LIST \"\" (");
+        for (i = 0; i < n; i++) {
+            if (i > 0)
+                g_string_append_c(cmd, ' ');
+            append_quoted(cmd, folders[i]);
+        }
+        g_string_append(cmd, ") RETURN (STATUS (MESSAGES UNSEEN))\r\n");
+
+        ok = send_status_commands(imap, cmd, TAG_PREFIX "1", folders, n,
+                                  messages, unseen);
+        g_string_truncate(cmd, 0);
+    }
+
+    /* otherwise, all STATUS commands are sent at once */
+    if (!ok) {
+        for (i = 0; i < n; i++) {
+            g_string_append_printf(cmd, TAG_PREFIX "%u STATUS ", i + 2);
+            append_quoted(cmd, folders[i]);
+            g_string_append(cmd, " (MESSAGES UNSEEN)\r\n");
+        }
+        snprintf(last_tag, sizeof(last_tag), TAG_PREFIX "%u", n + 1);
+
+        ok = send_status_commands(imap, cmd, last_tag, folders, n,
+                                  messages, unseen);
+    }
+
+    g_string_free(cmd, true);
+
+    return ok;
+}
 
 /* vim: set ts=4 sw=4 et: */
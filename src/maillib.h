@@ -21,6 +21,8 @@
 #include <stdbool.h>
 #include <libetpan/libetpan.h>
 
+struct mail_tls;
+
 enum {
     POP3_STORAGE = 0,
     IMAP_STORAGE,
@@ -34,14 +36,120 @@ enum {
 int get_driver(char * name);
 bool is_local(const char *driver);
 
+/* "plain", "tls" or "starttls" to CONNECTION_TYPE_*, -1 if invalid */
+int get_connection_type(const char *name);
+
 int init_storage(struct mailstorage * storage,
     int driver, char * server, int port,
     int connection_type, char * user, char * password, int auth_type,
     char * path, char * cache_directory, char * flags_directory);
 
+/*
+ * Connects the session of @p storage (IMAP or POP3) over TLS
+ * (CONNECTION_TYPE_TLS) or with STARTTLS (CONNECTION_TYPE_STARTTLS), using
+ * the streams of mailtls.h that resume TLS sessions. The storage must have
+ * been initialised with init_storage() before.
+ */
+int connect_storage(struct mailstorage *storage, int driver,
+                    const char *server, int connection_type,
+                    struct mail_tls *tls, const char *user,
+                    const char *password, const char *cache_directory,
+                    const char *flags_directory);
+
 char *mail_decode(const char *string);
+
+/*
+ * The display_* functions return decoded and canonicalized strings that
+ * can be shown directly. Results are cached by the raw header value, so
+ * the same headers are decoded only once across checks.
+ */
 char *display_from(struct mailimf_from * from);
+char *display_from_raw(const char *from);
 char *display_subject(struct mailimf_subject *subject);
+char *display_subject_raw(const char *subject);
+
+/**
+ * Returns the number of hits and misses of the decoding cache.
+ */
+void display_cache_stats(unsigned int *hits, unsigned int *misses);
+
+/**
+ * Frees the decoding cache.
+ */
+void display_cache_free(void);
+
+/**
+ * Returns the length of the header block including the empty line that
+ * terminates it or 0 if @p buffer doesn't contain the complete header.
+ */
+size_t mail_header_end(const char *buffer, size_t len);
+
+/**
+ * Copies the unfolded value of header @p name from the header block in
+ * @p buffer into @p value (truncated to @p value_len). Returns false if
+ * the header is not present.
+ */
+bool mail_header_get(const char *buffer, size_t len, const char *name,
+                     char *value, size_t value_len);
+
+/** The number of body bytes used for a preview. */
+#define MAIL_PREVIEW_LEN    256
+
+/**
+ * Builds a one-line preview from the start of a message body. Transfer
+ * encoding, charset (converted to Latin-1) and the first MIME part are
+ * taken care of, whitespace is collapsed. @p header is the header block of the message or NULL if
+ * unknown. Returns a canonicalized string (maybe empty).
+ */
+char *mail_preview(const char *header, size_t header_len,
+                   const char *body, size_t body_len);
+
+/**
+ * Fetches only the first MAIL_PREVIEW_LEN bytes of the text of message
+ * @p uid (a libetpan IMAP UID) with its Content-Type and
+ * Content-Transfer-Encoding header fields, using BODY.PEEK, which doesn't
+ * touch the \Seen flag. Returns the preview or NULL on error.
+ *
+ * @p session is a connection with @p mailbox selected (read-only) from an
+ * earlier call, or NULL to connect. It is kept open for the next preview
+ * and set to NULL if the connection failed. Close it with
+ * imap_disconnect().
+ */
+char *imap_fetch_preview(mailimap **session, const char *server,
+                         int connection_type, struct mail_tls *tls,
+                         const char *user, const char *password,
+                         const char *mailbox, const char *uid);
+
+/**
+ * Lists the @p max unseen messages with the highest UIDs of the connected
+ * IMAP @p folder (UID SEARCH UNSEEN), oldest first. Unlike
+ * mailfolder_get_messages_list(), the other messages are not fetched at
+ * all. Returns a MAIL_* error code.
+ */
+int imap_get_unseen_messages_list(struct mailfolder *folder, unsigned int max,
+                                  struct mailmessage_list **result);
+
+/**
+ * Connects to the IMAP server and logs in. @p tls is only needed if
+ * @p connection_type is not CONNECTION_TYPE_PLAIN. Returns NULL on error.
+ */
+mailimap *imap_connect(const char *server, int connection_type,
+                       struct mail_tls *tls, const char *user,
+                       const char *password);
+
+/**
+ * Logs out and frees a connection of imap_connect().
+ */
+void imap_disconnect(mailimap *imap);
+
+/**
+ * Gets the number of messages and unseen messages of @p n folders in one
+ * round trip: with LIST-STATUS (RFC 5819) if the server supports it,
+ * otherwise with pipelined STATUS commands. Unknown folders count 0.
+ * Returns false if the connection failed.
+ */
+bool imap_folders_status(mailimap *imap, char **folders, unsigned int n,
+                         unsigned int *messages, unsigned int *unseen);
 
 #endif /* MAILLIB_H */
 
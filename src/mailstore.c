@@ -0,0 +1,65 @@
+/*
+ * This file is part of lcd-stuff.
+ *
+ * lcd-stuff is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License.
+ *
+ * lcd-stuff is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with lcd-stuff; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+#include <stdbool.h>
+
+#include <glib.h>
+
+#include "mailstore.h"
+
+/* -------------------------------------------------------------------------- */
+void mail_store_init(struct mail_store *store)
+{
+    store->email = g_array_new(false, false, sizeof(struct email));
+    store->strings = g_string_chunk_new(4096);
+}
+
+/* -------------------------------------------------------------------------- */
+void mail_store_reset(struct mail_store *store)
+{
+    g_array_set_size(store->email, 0);
+    g_string_chunk_clear(store->strings);
+}
+
+/* -------------------------------------------------------------------------- */
+void mail_store_free(struct mail_store *store)
+{
+    if (store->email)
+        g_array_free(store->email, true);
+    if (store->strings)
+        g_string_chunk_free(store->strings);
+    store->email = NULL;
+    store->strings = NULL;
+}
+
+/* -------------------------------------------------------------------------- */
+void mail_store_add(struct mail_store   *store,
+                    const char          *key,
+                    const char          *from,
+                    const char          *subject)
+{
+    struct email email;
+
+    email.message_number_in_box = store->email->len + 1;
+    email.key = key ? g_string_chunk_insert(store->strings, key) : NULL;
+    email.preview = NULL;
+    email.from = from ? g_string_chunk_insert(store->strings, from) : NULL;
+    email.subject = subject ? g_string_chunk_insert(store->strings, subject) : NULL;
+    g_array_append_val(store->email, email);
+}
+
+/* vim: set ts=4 sw=4 et: */
@@ -0,0 +1,76 @@
+/*
+ * This file is part of lcd-stuff.
+ *
+ * lcd-stuff is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License.
+ *
+ * lcd-stuff is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with lcd-stuff; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+#ifndef MAILSTORE_H
+#define MAILSTORE_H
+
+#include <glib.h>
+
+/**
+ * @file mailstore.h
+ * @brief The unseen mail of a mailbox.
+ *
+ * The messages are kept in an array, all their strings in one arena. A
+ * check fills a new store, which replaces the old one when it is done, so
+ * the memory of a check is released at once.
+ */
+
+/**
+ * @brief One unseen message.
+ */
+struct email {
+    int             message_number_in_box;
+    const char      *subject;       /**< in the string arena of the store */
+    const char      *from;          /**< in the string arena of the store */
+    const char      *key;           /**< UID, file name or offset, may be NULL */
+    const char      *preview;       /**< NULL until fetched */
+};
+
+/**
+ * @brief The unseen messages of a mailbox.
+ */
+struct mail_store {
+    GArray          *email;         /**< struct email */
+    GStringChunk    *strings;       /**< from and subject of all emails */
+};
+
+/**
+ * @brief Initialises an empty store.
+ */
+void mail_store_init(struct mail_store *store);
+
+/**
+ * @brief Removes all messages, the memory is kept for reuse.
+ */
+void mail_store_reset(struct mail_store *store);
+
+/**
+ * @brief Frees the messages and their strings.
+ */
+void mail_store_free(struct mail_store *store);
+
+/**
+ * @brief Appends a message, its number is the position in the store.
+ *
+ * The strings are copied to the arena, each of them may be NULL.
+ */
+void mail_store_add(struct mail_store *store, const char *key,
+                    const char *from, const char *subject);
+
+#endif /* MAILSTORE_H */
+
+/* vim: set ts=4 sw=4 et: */
@@ -0,0 +1,365 @@
+/*
+ * This file is part of lcd-stuff.
+ *
+ * lcd-stuff is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License.
+ *
+ * lcd-stuff is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with lcd-stuff; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <time.h>
+#include <netdb.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+
+#include <glib.h>
+
+#include <openssl/ssl.h>
+#include <openssl/err.h>
+#include <openssl/x509v3.h>
+
+#include <libetpan/libetpan.h>
+
+#include <shared/report.h>
+
+#include "mailtls.h"
+
+/* ---------------------- constants ----------------------------------------- */
+#define NETWORK_TIMEOUT_SEC     30
+
+/* ---------------------- types --------------------------------------------- */
+struct mail_tls {
+    char                    *server;
+    SSL_CTX                 *ctx;
+    SSL_SESSION             *session;   /* offered on the next handshake */
+    GMutex                  *mutex;     /* for the statistics */
+    struct mail_tls_stats   stats;
+};
+
+struct tls_stream {
+    int                     fd;
+    SSL                     *ssl;
+};
+
+/* ---------------------- static variables ---------------------------------- */
+static int s_tls_index = -1;
+
+/* -------------------------------------------------------------------------- */
+static void report_ssl_error(const char *what, const char *server)
+{
+    char buffer[256];
+
+    ERR_error_string_n(ERR_get_error(), buffer, sizeof(buffer));
+    report(RPT_ERR, "%s with %s failed: %s", what, server, buffer);
+    ERR_clear_error();
+}
+
+/* -------------------------------------------------------------------------- */
+static int new_session_cb(SSL *ssl, SSL_SESSION *session)
+{
+    struct mail_tls *tls = SSL_get_ex_data(ssl, s_tls_index);
+
+    if (!tls)
+        return 0;
+
+    /*
+     * Called after the handshake for TLS 1.2 and for each ticket with
+     * TLS 1.3. We keep the reference.
+     */
+    if (tls->session)
+        SSL_SESSION_free(tls->session);
+    tls->session = session;
+
+    return 1;
+}
+
+/* -------------------------------------------------------------------------- */
+struct mail_tls *mail_tls_new(const char *server, const char *ca_file)
+{
+    struct mail_tls *tls;
+
+    SSL_library_init();
+    SSL_load_error_strings();
+    if (s_tls_index < 0)
+        s_tls_index = SSL_get_ex_new_index(0, NULL, NULL, NULL, NULL);
+
+    tls = g_new0(struct mail_tls, 1);
+    tls->server = g_strdup(server);
+    tls->mutex = g_mutex_new();
+
+    tls->ctx = SSL_CTX_new(SSLv23_client_method());
+    if (!tls->ctx) {
+        report_ssl_error("Creating the TLS context", server);
+        goto err;
+    }
+
+    SSL_CTX_set_options(tls->ctx, SSL_OP_NO_SSLv2 | SSL_OP_NO_SSLv3);
+    SSL_CTX_set_verify(tls->ctx, SSL_VERIFY_PEER, NULL);
+    if (ca_file) {
+        if (SSL_CTX_load_verify_locations(tls->ctx, ca_file, NULL) != 1) {
+            report_ssl_error("Loading the CA file", ca_file);
+            goto err;
+        }
+    } else
+        SSL_CTX_set_default_verify_paths(tls->ctx);
+
+    /* we store the session ourselves, but the callback needs the mode */
+    SSL_CTX_set_session_cache_mode(tls->ctx, SSL_SESS_CACHE_CLIENT |
+                                             SSL_SESS_CACHE_NO_INTERNAL_STORE);
+    SSL_CTX_sess_set_new_cb(tls->ctx, new_session_cb);
+
+    return tls;
+
+err:
+    mail_tls_free(tls);
+    return NULL;
+}
+
+/* -------------------------------------------------------------------------- */
+int mail_tls_tcp_connect(const char *server, uint16_t port)
+{
+    struct addrinfo hints, *result, *cur;
+    struct timeval timeout;
+    char service[16];
+    int fd = -1;
+    int r;
+
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    snprintf(service, sizeof(service), "%u", port);
+
+    r = getaddrinfo(server, service, &hints, &result);
+    if (r != 0) {
+        report(RPT_ERR, "Cannot resolve %s: %s", server, gai_strerror(r));
+        return -1;
+    }
+
+    for (cur = result; cur; cur = cur->ai_next) {
+        fd = socket(cur->ai_family, cur->ai_socktype, cur->ai_protocol);
+        if (fd < 0)
+            continue;
+        if (connect(fd, cur->ai_addr, cur->ai_addrlen) == 0)
+            break;
+        close(fd);
+        fd = -1;
+    }
+    freeaddrinfo(result);
+
+    if (fd < 0) {
+        report(RPT_ERR, "Cannot connect to %s:%u", server, port);
+        return -1;
+    }
+
+    /* the TLS stream does blocking I/O */
+    timeout.tv_sec = NETWORK_TIMEOUT_SEC;
+    timeout.tv_usec = 0;
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+
+    return fd;
+}
+
+/* -------------------------------------------------------------------------- */
+static ssize_t tls_stream_read(mailstream_low *s, void *buf, size_t count)
+{
+    struct tls_stream *stream = (struct tls_stream *)s->data;
+    int r;
+
+    r = SSL_read(stream->ssl, buf, count);
+    if (r <= 0)
+        return SSL_get_error(stream->ssl, r) == SSL_ERROR_ZERO_RETURN ? 0 : -1;
+
+    return r;
+}
+
+/* -------------------------------------------------------------------------- */
+static ssize_t tls_stream_write(mailstream_low *s, const void *buf, size_t count)
+{
+    struct tls_stream *stream = (struct tls_stream *)s->data;
+    int r;
+
+    r = SSL_write(stream->ssl, buf, count);
+
+    return r <= 0 ? -1 : r;
+}
+
+/* -------------------------------------------------------------------------- */
+static int tls_stream_close(mailstream_low *s)
+{
+    struct tls_stream *stream = (struct tls_stream *)s->data;
+
+    SSL_shutdown(stream->ssl);
+    close(stream->fd);
+    stream->fd = -1;
+
+    return 0;
+}
+
+/* -------------------------------------------------------------------------- */
+static int tls_stream_get_fd(mailstream_low *s)
+{
+    struct tls_stream *stream = (struct tls_stream *)s->data;
+
+    return stream->fd;
+}
+
+/* -------------------------------------------------------------------------- */
+static void tls_stream_free(mailstream_low *s)
+{
+    struct tls_stream *stream = (struct tls_stream *)s->data;
+
+    SSL_free(stream->ssl);
+    g_free(stream);
+    free(s);
+}
+
+/* -------------------------------------------------------------------------- */
+static void tls_stream_cancel(mailstream_low *s)
+{
+}
+
+/* -------------------------------------------------------------------------- */
+static struct mailstream_low_driver tls_stream_driver = {
+    .mailstream_read    = tls_stream_read,
+    .mailstream_write   = tls_stream_write,
+    .mailstream_close   = tls_stream_close,
+    .mailstream_get_fd  = tls_stream_get_fd,
+    .mailstream_free    = tls_stream_free,
+    .mailstream_cancel  = tls_stream_cancel,
+};
+
+/* -------------------------------------------------------------------------- */
+static double elapsed_ms(const struct timespec *start)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return (now.tv_sec - start->tv_sec) * 1000.0 +
+           (now.tv_nsec - start->tv_nsec) / 1000000.0;
+}
+
+/* -------------------------------------------------------------------------- */
+mailstream_low *mail_tls_handshake(struct mail_tls *tls, int fd)
+{
+    struct tls_stream *stream;
+    struct timespec start;
+    mailstream_low *low;
+    SSL *ssl;
+    double ms;
+    bool resumed;
+
+    ssl = SSL_new(tls->ctx);
+    if (!ssl) {
+        report_ssl_error("Creating the TLS connection", tls->server);
+        return NULL;
+    }
+
+    SSL_set_ex_data(ssl, s_tls_index, tls);
+    SSL_set_fd(ssl, fd);
+    SSL_set_tlsext_host_name(ssl, tls->server);
+    X509_VERIFY_PARAM_set1_host(SSL_get0_param(ssl), tls->server, 0);
+    if (tls->session)
+        SSL_set_session(ssl, tls->session);
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    if (SSL_connect(ssl) != 1) {
+        report_ssl_error("TLS handshake", tls->server);
+        SSL_free(ssl);
+
+        /* maybe the session is the problem */
+        if (tls->session) {
+            SSL_SESSION_free(tls->session);
+            tls->session = NULL;
+        }
+        return NULL;
+    }
+    ms = elapsed_ms(&start);
+    resumed = SSL_session_reused(ssl);
+
+    g_mutex_lock(tls->mutex);
+    tls->stats.handshakes++;
+    if (resumed)
+        tls->stats.resumed++;
+    tls->stats.last_ms = ms;
+    tls->stats.total_ms += ms;
+    g_mutex_unlock(tls->mutex);
+
+    report(RPT_DEBUG, "TLS handshake with %s: %.1f ms%s", tls->server, ms,
+           resumed ? " (resumed)" : "");
+
+    stream = g_new0(struct tls_stream, 1);
+    stream->fd = fd;
+    stream->ssl = ssl;
+
+    low = mailstream_low_new(stream, &tls_stream_driver);
+    if (!low) {
+        SSL_free(ssl);
+        g_free(stream);
+    }
+
+    return low;
+}
+
+/* -------------------------------------------------------------------------- */
+bool mail_tls_upgrade(struct mail_tls *tls, mailstream *stream)
+{
+    mailstream_low *low, *new_low;
+    int fd;
+
+    low = mailstream_get_low(stream);
+    fd = mailstream_low_get_fd(low);
+    if (fd < 0)
+        return false;
+
+    new_low = mail_tls_handshake(tls, fd);
+    if (!new_low)
+        return false;
+
+    /* frees only the plain stream, the socket stays open */
+    mailstream_low_free(low);
+    mailstream_set_low(stream, new_low);
+
+    return true;
+}
+
+/* -------------------------------------------------------------------------- */
+void mail_tls_get_stats(struct mail_tls *tls, struct mail_tls_stats *stats)
+{
+    g_mutex_lock(tls->mutex);
+    *stats = tls->stats;
+    g_mutex_unlock(tls->mutex);
+}
+
+/* -------------------------------------------------------------------------- */
+void mail_tls_free(struct mail_tls *tls)
+{
+    if (!tls)
+        return;
+
+    if (tls->session)
+        SSL_SESSION_free(tls->session);
+    if (tls->ctx)
+        SSL_CTX_free(tls->ctx);
+    g_mutex_free(tls->mutex);
+    g_free(tls->server);
+    g_free(tls);
+}
+
+/* vim: set ts=4 sw=4 et: */
@@ -0,0 +1,93 @@
+/*
+ * This file is part of lcd-stuff.
+ *
+ * lcd-stuff is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License.
+ *
+ * lcd-stuff is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with lcd-stuff; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+#ifndef MAILTLS_H
+#define MAILTLS_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <libetpan/libetpan.h>
+
+/**
+ * @file mailtls.h
+ * @brief TLS streams for libetpan with session resumption.
+ *
+ * libetpan creates a new TLS context for each connection, so each check
+ * would pay a full handshake. Here, each account has its own context which
+ * keeps the last session (or TLS 1.3 ticket) and offers it on the next
+ * connect, so repeated handshakes are abbreviated.
+ */
+
+struct mail_tls;
+
+/**
+ * @brief Statistics of the handshakes of one account.
+ */
+struct mail_tls_stats {
+    unsigned int    handshakes;     /**< number of successful handshakes */
+    unsigned int    resumed;        /**< how many of them were abbreviated */
+    double          last_ms;        /**< duration of the last handshake */
+    double          total_ms;       /**< duration of all handshakes */
+};
+
+/**
+ * @brief Creates the TLS context of an account.
+ *
+ * @param[in] server the host name, used for SNI and certificate verification
+ * @param[in] ca_file file with trusted CA certificates or NULL for the
+ *            system default
+ * @return the context or NULL on error
+ */
+struct mail_tls *mail_tls_new(const char *server, const char *ca_file);
+
+/**
+ * @brief Opens a TCP connection.
+ *
+ * @return the socket or -1 on error
+ */
+int mail_tls_tcp_connect(const char *server, uint16_t port);
+
+/**
+ * @brief Does the TLS handshake on @p fd.
+ *
+ * @param[in] tls the context of the account
+ * @param[in] fd the connected socket, owned by the returned stream
+ * @return a libetpan stream or NULL if the handshake failed (@p fd is not
+ *         closed then)
+ */
+mailstream_low *mail_tls_handshake(struct mail_tls *tls, int fd);
+
+/**
+ * @brief Switches @p stream to TLS after a successful STARTTLS or STLS.
+ *
+ * @return @c true on success
+ */
+bool mail_tls_upgrade(struct mail_tls *tls, mailstream *stream);
+
+/**
+ * @brief Returns the handshake statistics.
+ */
+void mail_tls_get_stats(struct mail_tls *tls, struct mail_tls_stats *stats);
+
+/**
+ * @brief Frees the context.
+ */
+void mail_tls_free(struct mail_tls *tls);
+
+#endif /* MAILTLS_H */
+
+/* vim: set ts=4 sw=4 et: */
@@ -0,0 +1,338 @@
+/*
+ * This file is part of lcd-stuff.
+ *
+ * lcd-stuff is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License.
+ *
+ * lcd-stuff is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with lcd-stuff; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+
+#include <glib.h>
+
+#include <shared/report.h>
+
+#include "config.h"
+#include "mailwatch.h"
+
+#if HAVE_INOTIFY
+#  include <poll.h>
+#  include <sys/inotify.h>
+#endif
+
+/* ---------------------- constants ----------------------------------------- */
+
+/*
+ * After the first event, we wait until the directory is quiet for that time
+ * so that a burst of deliveries results in only one rescan.
+ */
+#define SETTLE_MS               20
+#define SETTLE_MAX_ROUNDS       10
+
+/* ---------------------- types --------------------------------------------- */
+struct watch_entry {
+    void            *cookie;
+    bool            mh;
+};
+
+struct mail_watch {
+    int             fd;
+    GHashTable      *entries;       /* wd -> struct watch_entry */
+    GHashTable      *changed;       /* cookie -> enum mail_watch_change */
+};
+
+/* -------------------------------------------------------------------------- */
+struct mail_watch *mail_watch_new(void)
+{
+    struct mail_watch *watch;
+
+    watch = g_new0(struct mail_watch, 1);
+    watch->entries = g_hash_table_new_full(g_direct_hash, g_direct_equal,
+                                           NULL, g_free);
+    watch->changed = g_hash_table_new(g_direct_hash, g_direct_equal);
+
+#if HAVE_INOTIFY
+    watch->fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (watch->fd < 0)
+        report(RPT_WARNING, "inotify_init1() failed: %s", strerror(errno));
+#else
+    watch->fd = -1;
+#endif
+
+    return watch;
+}
+
+#if HAVE_INOTIFY
+
+/* -------------------------------------------------------------------------- */
+/*
+ * Returns the watch descriptor or -1 on error.
+ */
+static int add_dir(struct mail_watch    *watch,
+                   const char           *path,
+                   uint32_t             mask,
+                   bool                 mh,
+                   void                 *cookie)
+{
+    struct watch_entry *entry;
+    int wd;
+
+    wd = inotify_add_watch(watch->fd, path, mask | IN_DELETE_SELF | IN_MOVE_SELF);
+    if (wd < 0) {
+        report(RPT_WARNING, "Cannot watch %s: %s", path, strerror(errno));
+        return -1;
+    }
+
+    entry = g_new0(struct watch_entry, 1);
+    entry->cookie = cookie;
+    entry->mh = mh;
+    g_hash_table_replace(watch->entries, GINT_TO_POINTER(wd), entry);
+
+    return wd;
+}
+
+/* -------------------------------------------------------------------------- */
+bool mail_watch_add(struct mail_watch   *watch,
+                    const char          *type,
+                    const char          *path,
+                    void                *cookie)
+{
+    if (watch->fd < 0)
+        return false;
+
+    if (strcmp(type, "maildir") == 0) {
+        /*
+         * New mail gets moved or linked from tmp/ to new/, flag changes
+         * rename files in cur/. We don't care about tmp/.
+         */
+        uint32_t mask = IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO;
+        char *dir;
+        int wd_new, wd_cur;
+
+        dir = g_build_filename(path, "new", NULL);
+        wd_new = add_dir(watch, dir, mask, false, cookie);
+        g_free(dir);
+        if (wd_new < 0)
+            return false;
+
+        dir = g_build_filename(path, "cur", NULL);
+        wd_cur = add_dir(watch, dir, mask, false, cookie);
+        g_free(dir);
+
+        /* the box gets polled, so it must not be half watched */
+        if (wd_cur < 0) {
+            inotify_rm_watch(watch->fd, wd_new);
+            g_hash_table_remove(watch->entries, GINT_TO_POINTER(wd_new));
+            return false;
+        }
+
+        return true;
+    } else if (strcmp(type, "mh") == 0) {
+        /*
+         * MH delivery writes the message file in place, so wait until
+         * it has been closed instead of reacting on the creation.
+         */
+        return add_dir(watch, path,
+                       IN_CLOSE_WRITE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO,
+                       true, cookie) >= 0;
+    }
+
+    return false;
+}
+
+/* -------------------------------------------------------------------------- */
+static bool is_relevant_name(const struct watch_entry *entry, const char *name)
+{
+    const char *cur;
+
+    if (entry->mh) {
+        if (strcmp(name, ".mh_sequences") == 0)
+            return true;
+
+        /* MH messages are plain numbers */
+        for (cur = name; *cur; cur++)
+            if (*cur < '0' || *cur > '9')
+                return false;
+
+        return cur != name;
+    }
+
+    /* ignore our own and other tools' hidden files in maildir */
+    return name[0] != '.';
+}
+
+/* -------------------------------------------------------------------------- */
+static void mark_changed(struct mail_watch          *watch,
+                         void                       *cookie,
+                         enum mail_watch_change     change)
+{
+    int old = GPOINTER_TO_INT(g_hash_table_lookup(watch->changed, cookie));
+
+    /* the most severe change wins */
+    g_hash_table_replace(watch->changed, cookie, GINT_TO_POINTER(MAX(old, (int)change)));
+}
+
+/* -------------------------------------------------------------------------- */
+static void mark_all_lost(gpointer key, gpointer value, gpointer user_data)
+{
+    struct watch_entry *entry = (struct watch_entry *)value;
+    struct mail_watch  *watch = (struct mail_watch *)user_data;
+
+    mark_changed(watch, entry->cookie, MAIL_WATCH_LOST);
+}
+
+/* -------------------------------------------------------------------------- */
+static bool read_events(struct mail_watch *watch)
+{
+    char buffer[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+    bool got_events = false;
+    ssize_t len;
+
+    while ((len = read(watch->fd, buffer, sizeof(buffer))) > 0) {
+        char *ptr;
+
+        for (ptr = buffer; ptr < buffer + len;
+                ptr += sizeof(struct inotify_event) + ((struct inotify_event *)ptr)->len) {
+            const struct inotify_event *event = (const struct inotify_event *)ptr;
+            struct watch_entry *entry;
+
+            if (event->mask & IN_Q_OVERFLOW) {
+                g_hash_table_foreach(watch->entries, mark_all_lost, watch);
+                got_events = true;
+                continue;
+            }
+
+            entry = g_hash_table_lookup(watch->entries, GINT_TO_POINTER(event->wd));
+            if (!entry)
+                continue;
+
+            if (event->mask & IN_MOVE_SELF) {
+                /* the path is no longer valid, IN_IGNORED follows */
+                inotify_rm_watch(watch->fd, event->wd);
+                continue;
+            }
+
+            if (event->mask & IN_IGNORED) {
+                mark_changed(watch, entry->cookie, MAIL_WATCH_REMOVED);
+                g_hash_table_remove(watch->entries, GINT_TO_POINTER(event->wd));
+                got_events = true;
+                continue;
+            }
+
+            if (event->len > 0 && !is_relevant_name(entry, event->name))
+                continue;
+
+            mark_changed(watch, entry->cookie, MAIL_WATCH_CHANGED);
+            got_events = true;
+        }
+    }
+
+    if (len < 0 && errno != EAGAIN && errno != EINTR)
+        report(RPT_ERR, "Reading inotify events failed: %s", strerror(errno));
+
+    return got_events;
+}
+
+/* -------------------------------------------------------------------------- */
+static bool wait_readable(int fd, int timeout_ms)
+{
+    struct pollfd pfd;
+
+    pfd.fd = fd;
+    pfd.events = POLLIN;
+    pfd.revents = 0;
+
+    return poll(&pfd, 1, timeout_ms) > 0 && (pfd.revents & POLLIN);
+}
+
+#else /* HAVE_INOTIFY */
+
+/* -------------------------------------------------------------------------- */
+bool mail_watch_add(struct mail_watch   *watch,
+                    const char          *type,
+                    const char          *path,
+                    void                *cookie)
+{
+    return false;
+}
+
+#endif /* HAVE_INOTIFY */
+
+/* -------------------------------------------------------------------------- */
+struct dispatch_data {
+    mail_watch_fun  fun;
+    int             count;
+};
+
+/* -------------------------------------------------------------------------- */
+static gboolean dispatch_changed(gpointer key, gpointer value, gpointer user_data)
+{
+    struct dispatch_data *data = (struct dispatch_data *)user_data;
+
+    data->fun(key, (enum mail_watch_change)GPOINTER_TO_INT(value));
+    data->count++;
+
+    return true;
+}
+
+/* -------------------------------------------------------------------------- */
+int mail_watch_wait(struct mail_watch *watch, int timeout_ms, mail_watch_fun fun)
+{
+    struct dispatch_data data;
+
+    if (watch->fd < 0 || g_hash_table_size(watch->entries) == 0) {
+        g_usleep(timeout_ms * 1000);
+        return 0;
+    }
+
+#if HAVE_INOTIFY
+    if (!wait_readable(watch->fd, timeout_ms) || !read_events(watch))
+        return 0;
+
+    /* let bursts settle */
+    {
+        int round;
+
+        for (round = 0; round < SETTLE_MAX_ROUNDS; round++) {
+            if (!wait_readable(watch->fd, SETTLE_MS))
+                break;
+            read_events(watch);
+        }
+    }
+#endif
+
+    data.fun = fun;
+    data.count = 0;
+    g_hash_table_foreach_remove(watch->changed, dispatch_changed, &data);
+
+    return data.count;
+}
+
+/* -------------------------------------------------------------------------- */
+void mail_watch_free(struct mail_watch *watch)
+{
+    if (!watch)
+        return;
+
+    if (watch->fd >= 0)
+        close(watch->fd);
+    g_hash_table_destroy(watch->entries);
+    g_hash_table_destroy(watch->changed);
+    g_free(watch);
+}
+
+/* vim: set ts=4 sw=4 et: */
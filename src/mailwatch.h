@@ -0,0 +1,99 @@
+/*
+ * This file is part of lcd-stuff.
+ *
+ * lcd-stuff is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License.
+ *
+ * lcd-stuff is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with lcd-stuff; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+#ifndef MAILWATCH_H
+#define MAILWATCH_H
+
+#include <stdbool.h>
+
+/**
+ * @file mailwatch.h
+ * @brief Change notification for local mailboxes (maildir and MH).
+ *
+ * On Linux, inotify is used. On other systems, mail_watch_add() always
+ * fails and the caller has to fall back to polling.
+ */
+
+struct mail_watch;
+
+/**
+ * @brief What happened to a watched mailbox.
+ */
+enum mail_watch_change {
+    MAIL_WATCH_CHANGED,     /**< files were added, removed or renamed */
+    MAIL_WATCH_LOST,        /**< events were lost (queue overflow), the
+                                 mailbox needs a full rescan */
+    MAIL_WATCH_REMOVED      /**< the watch has been removed by the kernel
+                                 (e.g. because the directory was deleted),
+                                 the mailbox has to be polled again */
+};
+
+/**
+ * @brief Callback that is called for each mailbox that changed.
+ *
+ * @param[in] cookie the cookie that was passed to mail_watch_add()
+ * @param[in] change the most severe change since the last call
+ */
+typedef void (*mail_watch_fun)(void *cookie, enum mail_watch_change change);
+
+/**
+ * @brief Creates a new watch object.
+ *
+ * @return the new object, never NULL (but the object might be unable to
+ *         watch anything)
+ */
+struct mail_watch *mail_watch_new(void);
+
+/**
+ * @brief Adds a local mailbox to the watch.
+ *
+ * @param[in] watch the watch object
+ * @param[in] type the type of the mailbox, only "maildir" and "mh" are
+ *            supported
+ * @param[in] path the path of the mailbox
+ * @param[in] cookie the cookie that is passed to the callback
+ * @return @c true on success, @c false if the mailbox cannot be watched
+ */
+bool mail_watch_add(struct mail_watch   *watch,
+                    const char          *type,
+                    const char          *path,
+                    void                *cookie);
+
+/**
+ * @brief Waits for changes.
+ *
+ * Waits at most @p timeout_ms milliseconds. If there are no watches, this
+ * function simply sleeps. For each changed mailbox, @p fun is called exactly
+ * once, even if there were multiple events for that mailbox.
+ *
+ * @param[in] watch the watch object
+ * @param[in] timeout_ms the timeout in milliseconds
+ * @param[in] fun the callback
+ * @return the number of changed mailboxes
+ */
+int mail_watch_wait(struct mail_watch *watch, int timeout_ms, mail_watch_fun fun);
+
+/**
+ * @brief Frees the watch object and removes all watches.
+ *
+ * @param[in] watch the watch object
+ */
+void mail_watch_free(struct mail_watch *watch);
+
+#endif /* MAILWATCH_H */
+
+/* vim: set ts=4 sw=4 et: */
@@ -49,6 +49,9 @@
 #if HAVE_LCDSTUFF_RSS
 #  include "rss.h"
 #endif
+#if HAVE_LCDSTUFF_RSS || HAVE_LCDSTUFF_WEATHER
+#  include "http.h"
+#endif
 
 /* ========================= global variables =============================== */
 volatile bool  g_exit                  = false;
@@ -275,6 +278,10 @@ int main(int argc, char *argv[])
         g_thread_init(NULL);
     }
 
+#if HAVE_LCDSTUFF_RSS || HAVE_LCDSTUFF_WEATHER
+    http_global_init();
+#endif
+
 
     /* parse command line */
     err = parse_command_line(&lcd_stuff, argc, argv);
@@ -346,6 +353,9 @@ int main(int argc, char *argv[])
     }
 
     sock_close(lcd_stuff.socket);
+#if HAVE_LCDSTUFF_RSS || HAVE_LCDSTUFF_WEATHER
+    http_global_cleanup();
+#endif
 
     return 0;
 }
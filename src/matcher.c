@@ -0,0 +1,242 @@
+/*
+ * This file is part of lcd-stuff.
+ *
+ * lcd-stuff is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License.
+ *
+ * lcd-stuff is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with lcd-stuff; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+#include <stdio.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include <glib.h>
+
+#include "matcher.h"
+
+/* ---------------------- types --------------------------------------------- */
+struct keyword {
+    char                *text;          /* case-folded */
+    int                 value;
+};
+
+struct output {
+    int                 value;
+    guint32             next;           /* index + 1 in outputs, or 0 */
+};
+
+/*
+ * The automaton works on character classes instead of bytes: each
+ * character that occurs in a keyword has its own class, all others share
+ * class 0. That keeps the transition table small.
+ */
+struct matcher {
+    GArray              *keywords;      /* struct keyword, until compiled */
+    guint8              fold[256];      /* case folding of Latin-1 */
+    guint8              classes[256];   /* of the folded characters */
+    unsigned int        n_classes;
+    unsigned int        n_states;
+    guint32             *delta;         /* n_states * n_classes transitions */
+    guint32             *first_output;  /* per state, index + 1 in outputs */
+    guint32             *output_link;   /* next state on the failure path
+                                           with outputs, or 0 */
+    GArray              *outputs;       /* struct output */
+};
+
+/* -------------------------------------------------------------------------- */
+struct matcher *matcher_new(void)
+{
+    struct matcher *matcher;
+    int c;
+
+    matcher = g_new0(struct matcher, 1);
+    matcher->keywords = g_array_new(false, false, sizeof(struct keyword));
+    matcher->outputs = g_array_new(false, false, sizeof(struct output));
+
+    for (c = 0; c < 256; c++) {
+        matcher->fold[c] = c;
+
+        /* Latin-1 letters, but not the multiplication sign */
+        if ((c >= 'A' && c <= 'Z') || (c >= 0xC0 && c <= 0xDE && c != 0xD7))
+            matcher->fold[c] = c + 0x20;
+    }
+
+    return matcher;
+}
+
+/* -------------------------------------------------------------------------- */
+void matcher_add(struct matcher *matcher, const char *keyword, int value)
+{
+    struct keyword kw;
+    char *p;
+
+    if (!keyword || !*keyword || matcher->delta)
+        return;
+
+    kw.text = g_strdup(keyword);
+    kw.value = value;
+    for (p = kw.text; *p; p++)
+        *p = matcher->fold[(guint8)*p];
+
+    g_array_append_val(matcher->keywords, kw);
+}
+
+/* -------------------------------------------------------------------------- */
+static guint32 *transition(struct matcher *matcher, guint32 state, guint8 c)
+{
+    return &matcher->delta[state * matcher->n_classes + matcher->classes[c]];
+}
+
+/* -------------------------------------------------------------------------- */
+void matcher_compile(struct matcher *matcher)
+{
+    guint32 *fail, *queue;
+    unsigned int i, max_states = 1, head = 0, tail = 0, c;
+
+    /* the classes, and an upper bound for the states */
+    matcher->n_classes = 1;
+    for (i = 0; i < matcher->keywords->len; i++) {
+        struct keyword *kw = &g_array_index(matcher->keywords, struct keyword, i);
+        const char *p;
+
+        for (p = kw->text; *p; p++) {
+            if (!matcher->classes[(guint8)*p])
+                matcher->classes[(guint8)*p] = matcher->n_classes++;
+            max_states++;
+        }
+    }
+
+    matcher->delta = g_new0(guint32, max_states * matcher->n_classes);
+    matcher->first_output = g_new0(guint32, max_states);
+    matcher->output_link = g_new0(guint32, max_states);
+    matcher->n_states = 1;
+
+    /* the trie, 0 is the root and no child of anything */
+    for (i = 0; i < matcher->keywords->len; i++) {
+        struct keyword *kw = &g_array_index(matcher->keywords, struct keyword, i);
+        struct output out;
+        guint32 state = 0;
+        const char *p;
+
+        for (p = kw->text; *p; p++) {
+            guint32 *next = transition(matcher, state, *p);
+
+            if (!*next)
+                *next = matcher->n_states++;
+            state = *next;
+        }
+
+        out.value = kw->value;
+        out.next = matcher->first_output[state];
+        g_array_append_val(matcher->outputs, out);
+        matcher->first_output[state] = matcher->outputs->len;
+
+        g_free(kw->text);
+    }
+    g_array_free(matcher->keywords, true);
+    matcher->keywords = NULL;
+
+    /*
+     * Breadth first, so that the failure state of each state is complete
+     * when it's needed. Missing transitions are taken from the failure
+     * state, which makes it a DFA.
+     */
+    fail = g_new0(guint32, matcher->n_states);
+    queue = g_new0(guint32, matcher->n_states);
+    queue[tail++] = 0;
+
+    while (head < tail) {
+        guint32 state = queue[head++];
+        guint32 *row = &matcher->delta[state * matcher->n_classes];
+        guint32 *fail_row = &matcher->delta[fail[state] * matcher->n_classes];
+
+        for (c = 1; c < matcher->n_classes; c++) {
+            guint32 child = row[c];
+
+            if (child) {
+                if (state == 0)
+                    fail[child] = 0;
+                else
+                    fail[child] = fail_row[c];
+
+                matcher->output_link[child] = matcher->first_output[fail[child]]
+                                                ? fail[child]
+                                                : matcher->output_link[fail[child]];
+                queue[tail++] = child;
+            } else if (state != 0)
+                row[c] = fail_row[c];
+        }
+    }
+
+    g_free(fail);
+    g_free(queue);
+}
+
+/* -------------------------------------------------------------------------- */
+bool matcher_is_empty(const struct matcher *matcher)
+{
+    if (matcher->keywords)
+        return matcher->keywords->len == 0;
+
+    return matcher->outputs->len == 0;
+}
+
+/* -------------------------------------------------------------------------- */
+void matcher_match(const struct matcher *matcher, const char *text,
+                   matcher_fun fun, void *cookie)
+{
+    guint32 state = 0;
+    const guint8 *p;
+
+    if (!matcher->delta || matcher->outputs->len == 0)
+        return;
+
+    for (p = (const guint8 *)text; *p; p++) {
+        guint32 out_state;
+
+        state = matcher->delta[state * matcher->n_classes +
+                               matcher->classes[matcher->fold[*p]]];
+
+        out_state = matcher->first_output[state] ? state : matcher->output_link[state];
+        while (out_state) {
+            guint32 out = matcher->first_output[out_state];
+
+            while (out) {
+                struct output *o = &g_array_index(matcher->outputs, struct output, out - 1);
+                fun(o->value, cookie);
+                out = o->next;
+            }
+            out_state = matcher->output_link[out_state];
+        }
+    }
+}
+
+/* -------------------------------------------------------------------------- */
+void matcher_free(struct matcher *matcher)
+{
+    unsigned int i;
+
+    if (!matcher)
+        return;
+
+    for (i = 0; matcher->keywords && i < matcher->keywords->len; i++)
+        g_free(g_array_index(matcher->keywords, struct keyword, i).text);
+    if (matcher->keywords)
+        g_array_free(matcher->keywords, true);
+    g_array_free(matcher->outputs, true);
+    g_free(matcher->delta);
+    g_free(matcher->first_output);
+    g_free(matcher->output_link);
+    g_free(matcher);
+}
+
+/* vim: set ts=4 sw=4 et: */
@@ -0,0 +1,80 @@
+/*
+ * This file is part of lcd-stuff.
+ *
+ * lcd-stuff is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License.
+ *
+ * lcd-stuff is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with lcd-stuff; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+#ifndef MATCHER_H
+#define MATCHER_H
+
+#include <stdbool.h>
+
+/**
+ * @file matcher.h
+ * @brief Finds many keywords in a text at once (Aho-Corasick).
+ *
+ * All keywords are compiled into one automaton, so a text is scanned only
+ * once, however many keywords there are. Texts and keywords are Latin-1
+ * and compared case-insensitively.
+ */
+
+struct matcher;
+
+/**
+ * @brief Called for each keyword that is found in the text.
+ *
+ * @param[in] value the value of the keyword, see matcher_add()
+ * @param[in] cookie as passed to matcher_match()
+ */
+typedef void (*matcher_fun)(int value, void *cookie);
+
+/**
+ * @brief Creates an empty matcher.
+ */
+struct matcher *matcher_new(void);
+
+/**
+ * @brief Adds a keyword. Only before matcher_compile().
+ *
+ * @param[in] keyword the keyword, empty ones are ignored
+ * @param[in] value passed to the callback when the keyword is found
+ */
+void matcher_add(struct matcher *matcher, const char *keyword, int value);
+
+/**
+ * @brief Builds the automaton of all keywords.
+ */
+void matcher_compile(struct matcher *matcher);
+
+/**
+ * @brief Returns @c true if no keyword has been added.
+ */
+bool matcher_is_empty(const struct matcher *matcher);
+
+/**
+ * @brief Finds the keywords in @p text.
+ *
+ * @p fun is called for each occurrence of each keyword.
+ */
+void matcher_match(const struct matcher *matcher, const char *text,
+                   matcher_fun fun, void *cookie);
+
+/**
+ * @brief Frees the matcher.
+ */
+void matcher_free(struct matcher *matcher);
+
+#endif /* MATCHER_H */
+
+/* vim: set ts=4 sw=4 et: */
@@ -0,0 +1,477 @@
+/*
+ * This file is part of lcd-stuff.
+ *
+ * lcd-stuff is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License.
+ *
+ * lcd-stuff is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with lcd-stuff; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include <glib.h>
+
+#include <shared/report.h>
+
+#include "mbox.h"
+#include "maillib.h"
+
+/* ---------------------- constants ----------------------------------------- */
+#define SEPARATOR           "\nFrom "
+#define SEPARATOR_LEN       (sizeof(SEPARATOR) - 1)
+#define TAIL_CHECK_LEN      4096
+#define READ_CHUNK          (256*1024)
+#define HEADER_MAX          (64*1024)
+#define VALUE_MAX           1024
+#define FLAGS_MAX           32
+#define PREVIEW_HEADER_MAX  (16*1024)
+
+/* ---------------------- types --------------------------------------------- */
+struct mbox_message {
+    uint64_t        offset;
+    char            *from;
+    char            *subject;
+};
+
+struct mbox_state {
+    dev_t           dev;
+    ino_t           ino;
+    off_t           size;
+    struct timespec mtime;
+    off_t           scanned;        /* start of the first message not scanned */
+    uint32_t        tail_hash;      /* hash of the bytes before 'scanned' */
+    unsigned int    total;
+    unsigned int    unseen;
+    GPtrArray       *messages;      /* unseen messages */
+    unsigned int    max_messages;   /* size of the ring, 0 for no limit */
+    unsigned int    first;          /* oldest message if the ring is full */
+};
+
+struct mbox_reader {
+    int             fd;
+    off_t           end;            /* size of the file */
+    char            *buffer;        /* READ_CHUNK bytes */
+    off_t           start;          /* offset of the buffer in the file */
+    size_t          len;            /* valid bytes in the buffer */
+    int             error;          /* errno of a failed read, or 0 */
+};
+
+/* -------------------------------------------------------------------------- */
+struct mbox_state *mbox_state_new(unsigned int max_messages)
+{
+    struct mbox_state *state;
+
+    state = g_new0(struct mbox_state, 1);
+    state->messages = g_ptr_array_new();
+    state->max_messages = max_messages;
+
+    return state;
+}
+
+/* -------------------------------------------------------------------------- */
+static void free_message(struct mbox_message *msg)
+{
+    g_free(msg->from);
+    g_free(msg->subject);
+    g_free(msg);
+}
+
+/* -------------------------------------------------------------------------- */
+static void mbox_state_reset(struct mbox_state *state)
+{
+    unsigned int i;
+
+    for (i = 0; i < state->messages->len; i++)
+        free_message(g_ptr_array_index(state->messages, i));
+    g_ptr_array_set_size(state->messages, 0);
+    state->first = 0;
+
+    state->dev = 0;
+    state->ino = 0;
+    state->size = 0;
+    state->mtime.tv_sec = state->mtime.tv_nsec = 0;
+    state->scanned = 0;
+    state->tail_hash = 0;
+    state->total = 0;
+    state->unseen = 0;
+}
+
+/* -------------------------------------------------------------------------- */
+void mbox_state_free(struct mbox_state *state)
+{
+    if (!state)
+        return;
+
+    mbox_state_reset(state);
+    g_ptr_array_free(state->messages, true);
+    g_free(state);
+}
+
+/* -------------------------------------------------------------------------- */
+/*
+ * Returns the data at @p offset, at least @p min bytes unless the file ends
+ * before, and the number of bytes that are available in @p avail. The file
+ * is read with pread() and not mapped, because another process may truncate
+ * or rewrite it during the scan, and a mapping gets SIGBUS then.
+ */
+static const char *reader_get(struct mbox_reader    *reader,
+                              off_t                 offset,
+                              size_t                min,
+                              size_t                *avail)
+{
+    off_t buffer_end = reader->start + reader->len;
+
+    if (offset < reader->start || offset > buffer_end ||
+            (offset + (off_t)min > buffer_end && buffer_end < reader->end)) {
+        size_t len = 0;
+
+        while (len < READ_CHUNK && offset + (off_t)len < reader->end) {
+            ssize_t n = pread(reader->fd, reader->buffer + len,
+                              MIN(READ_CHUNK - len, (size_t)(reader->end - offset - len)),
+                              offset + len);
+            if (n < 0 && errno == EINTR)
+                continue;
+            if (n < 0) {
+                reader->error = errno;
+                return NULL;
+            }
+            if (n == 0) {
+                /* truncated since the fstat() */
+                reader->end = offset + len;
+                break;
+            }
+            len += n;
+        }
+
+        reader->start = offset;
+        reader->len = len;
+    }
+
+    *avail = reader->start + reader->len - offset;
+    return reader->buffer + (offset - reader->start);
+}
+
+/* -------------------------------------------------------------------------- */
+static off_t find_separator(struct mbox_reader *reader, off_t offset)
+{
+    for (;;) {
+        const char *data, *found;
+        size_t avail;
+
+        data = reader_get(reader, offset, SEPARATOR_LEN, &avail);
+        if (!data || avail < SEPARATOR_LEN)
+            return -1;
+
+        /* glibc's memmem() is vectorised, we don't need more */
+        found = memmem(data, avail, SEPARATOR, SEPARATOR_LEN);
+        if (found)
+            return offset + (found - data);
+
+        /* a separator may cross the end of the buffer */
+        offset += avail - (SEPARATOR_LEN - 1);
+    }
+}
+
+/* -------------------------------------------------------------------------- */
+static uint32_t tail_hash(const char *data, size_t len)
+{
+    uint32_t hash = 2166136261U;    /* FNV-1a */
+    size_t i;
+
+    for (i = 0; i < len; i++) {
+        hash ^= (unsigned char)data[i];
+        hash *= 16777619U;
+    }
+
+    return hash;
+}
+
+/* -------------------------------------------------------------------------- */
+static void scan_message(struct mbox_state *state, const char *msg,
+                         uint64_t offset, size_t header_len)
+{
+    char value[VALUE_MAX], flags[FLAGS_MAX];
+    struct mbox_message *message;
+    const char *header;
+
+    /* skip the "From " line */
+    header = memchr(msg, '\n', header_len);
+    if (!header)
+        return;
+    header++;
+    header_len -= header - msg;
+
+    /* folder internal data of the UW IMAP server */
+    if (mail_header_get(header, header_len, "X-IMAP", value, VALUE_MAX) ||
+            mail_header_get(header, header_len, "X-IMAPbase", value, VALUE_MAX))
+        return;
+
+    /* deleted but not yet expunged */
+    if (mail_header_get(header, header_len, "X-Status", flags, FLAGS_MAX) &&
+            strchr(flags, 'D'))
+        return;
+
+    state->total++;
+
+    if (mail_header_get(header, header_len, "Status", flags, FLAGS_MAX) &&
+            strchr(flags, 'R'))
+        return;
+
+    state->unseen++;
+
+    message = g_new0(struct mbox_message, 1);
+    message->offset = offset;
+    if (mail_header_get(header, header_len, "From", value, VALUE_MAX))
+        message->from = g_strdup(value);
+    if (mail_header_get(header, header_len, "Subject", value, VALUE_MAX))
+        message->subject = g_strdup(value);
+
+    /* a full ring replaces its oldest message */
+    if (state->max_messages > 0 && state->messages->len == state->max_messages) {
+        free_message(g_ptr_array_index(state->messages, state->first));
+        g_ptr_array_index(state->messages, state->first) = message;
+        state->first = (state->first + 1) % state->max_messages;
+    } else
+        g_ptr_array_add(state->messages, message);
+}
+
+/* -------------------------------------------------------------------------- */
+static void scan_messages(struct mbox_state *state, struct mbox_reader *reader)
+{
+    off_t pos = state->scanned;
+    const char *tail;
+    size_t tail_len, avail;
+
+    while (pos < reader->end) {
+        const char *start;
+        size_t msg_len, header_len;
+        off_t next;
+
+        next = find_separator(reader, pos);
+        if (reader->error)
+            return;
+        msg_len = next >= 0 ? (size_t)(next + 1 - pos) : (size_t)(reader->end - pos);
+
+        start = reader_get(reader, pos, MIN(msg_len, HEADER_MAX), &avail);
+        if (!start)
+            return;
+        avail = MIN(avail, msg_len);
+
+        header_len = mail_header_end(start, avail);
+        if (header_len == 0) {
+            /* the last message is still being written, try again later */
+            if (next < 0 && avail == msg_len)
+                break;
+            header_len = avail;
+        }
+
+        scan_message(state, start, pos, header_len);
+
+        pos += msg_len;
+        if (next < 0) {
+            /* complete message at the end of the file */
+            break;
+        }
+    }
+
+    state->scanned = pos;
+
+    tail_len = MIN(pos, TAIL_CHECK_LEN);
+    tail = reader_get(reader, pos - tail_len, tail_len, &avail);
+    if (tail)
+        state->tail_hash = tail_hash(tail, MIN(avail, tail_len));
+}
+
+/* -------------------------------------------------------------------------- */
+static bool same_time(const struct timespec *a, const struct timespec *b)
+{
+    return a->tv_sec == b->tv_sec && a->tv_nsec == b->tv_nsec;
+}
+
+/* -------------------------------------------------------------------------- */
+static bool is_append(struct mbox_state     *state,
+                      const struct stat     *st,
+                      struct mbox_reader    *reader)
+{
+    size_t tail_len = MIN(state->scanned, TAIL_CHECK_LEN), avail;
+    const char *tail;
+
+    if (st->st_dev != state->dev || st->st_ino != state->ino)
+        return false;
+    if (st->st_size < state->size)
+        return false;
+
+    /* rewritten, e.g. by a MUA that changed the Status of a message */
+    if (st->st_size == state->size && !same_time(&st->st_mtim, &state->mtime))
+        return false;
+
+    /* the data we've already seen must be unchanged */
+    tail = reader_get(reader, state->scanned - tail_len, tail_len + 5, &avail);
+    if (!tail || avail < tail_len || tail_hash(tail, tail_len) != state->tail_hash)
+        return false;
+
+    /* new data starts with a new message */
+    if (st->st_size > state->scanned &&
+            (avail < tail_len + 5 || strncmp(tail + tail_len, "From ", 5) != 0))
+        return false;
+
+    return true;
+}
+
+/* -------------------------------------------------------------------------- */
+bool mbox_scan(struct mbox_state    *state,
+               const char           *path,
+               unsigned int         *total,
+               unsigned int         *unseen)
+{
+    struct mbox_reader reader;
+    struct timespec now;
+    struct stat st;
+    int fd;
+
+    fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        if (errno != ENOENT) {
+            report(RPT_ERR, "Cannot open %s: %s", path, strerror(errno));
+            return false;
+        }
+
+        /* many MUAs remove empty mbox files */
+        mbox_state_reset(state);
+        goto out;
+    }
+
+    if (fstat(fd, &st) != 0) {
+        report(RPT_ERR, "Cannot stat %s: %s", path, strerror(errno));
+        close(fd);
+        return false;
+    }
+
+    /* unchanged? */
+    if (st.st_dev == state->dev && st.st_ino == state->ino &&
+            st.st_size == state->size && same_time(&st.st_mtim, &state->mtime)) {
+        close(fd);
+        goto out;
+    }
+
+    if (st.st_size == 0) {
+        mbox_state_reset(state);
+    } else {
+        memset(&reader, 0, sizeof(reader));
+        reader.fd = fd;
+        reader.end = st.st_size;
+        reader.buffer = g_malloc(READ_CHUNK);
+
+        if (!is_append(state, &st, &reader))
+            mbox_state_reset(state);
+
+        /* only the new tail gets read */
+        posix_fadvise(fd, state->scanned, 0, POSIX_FADV_SEQUENTIAL);
+        if (!reader.error)
+            scan_messages(state, &reader);
+        g_free(reader.buffer);
+
+        if (reader.error) {
+            report(RPT_ERR, "Cannot read %s: %s", path, strerror(reader.error));
+            mbox_state_reset(state);
+            close(fd);
+            return false;
+        }
+    }
+    close(fd);
+
+    state->dev = st.st_dev;
+    state->ino = st.st_ino;
+    state->size = st.st_size;
+    state->mtime = st.st_mtim;
+
+    /*
+     * A rewrite in the same second as this scan may keep size and mtime
+     * on file systems with coarse timestamps, so such an mtime is not
+     * trusted and the next scan checks the file again.
+     */
+    clock_gettime(CLOCK_REALTIME, &now);
+    if (st.st_mtim.tv_sec >= now.tv_sec)
+        state->mtime.tv_sec = state->mtime.tv_nsec = 0;
+
+out:
+    *total = state->total;
+    *unseen = state->unseen;
+
+    return true;
+}
+
+/* -------------------------------------------------------------------------- */
+void mbox_foreach_unseen(struct mbox_state  *state,
+                         mbox_message_fun   fun,
+                         void               *cookie)
+{
+    unsigned int i, len = state->messages->len;
+
+    for (i = 0; i < len; i++) {
+        struct mbox_message *msg = g_ptr_array_index(state->messages,
+                                                     (state->first + i) % len);
+        fun(msg->offset, msg->from, msg->subject, cookie);
+    }
+}
+
+/* -------------------------------------------------------------------------- */
+char *mbox_preview(const char *path, uint64_t offset)
+{
+    const size_t max = PREVIEW_HEADER_MAX + MAIL_PREVIEW_LEN;
+    const char *header;
+    char *buffer, *preview = NULL;
+    size_t header_len;
+    ssize_t n;
+    int fd;
+
+    fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return NULL;
+
+    buffer = g_malloc(max);
+    n = pread(fd, buffer, max, offset);
+    close(fd);
+
+    /* the file could have been rewritten, check that it's still a message */
+    if (n < 5 || strncmp(buffer, "From ", 5) != 0)
+        goto out;
+
+    header = memchr(buffer, '\n', n);
+    if (!header)
+        goto out;
+    header++;
+
+    header_len = mail_header_end(header, buffer + n - header);
+    if (header_len == 0)
+        goto out;
+
+    preview = mail_preview(header, header_len, header + header_len,
+                           MIN((size_t)(buffer + n - header - header_len),
+                               MAIL_PREVIEW_LEN));
+
+out:
+    g_free(buffer);
+
+    return preview;
+}
+
+/* vim: set ts=4 sw=4 et: */
@@ -0,0 +1,98 @@
+/*
+ * This file is part of lcd-stuff.
+ *
+ * lcd-stuff is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License.
+ *
+ * lcd-stuff is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with lcd-stuff; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+#ifndef MBOX_H
+#define MBOX_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/**
+ * @file mbox.h
+ * @brief Incremental scanner for mbox files.
+ *
+ * The file is read in chunks and the messages are located by searching for
+ * "\nFrom " separators. The scanner remembers how far it got together with
+ * size and modification time of the file, so if mail only got appended,
+ * only the new tail is read on the next call. Any other modification, also
+ * a change of the modification time without growth, results in a complete
+ * rescan.
+ */
+
+struct mbox_state;
+
+/**
+ * @brief Callback for each unseen message.
+ *
+ * @param[in] offset the offset of the "From " line of the message
+ * @param[in] from the raw value of the From header or NULL
+ * @param[in] subject the raw value of the Subject header or NULL
+ * @param[in] cookie the cookie passed to mbox_foreach_unseen()
+ */
+typedef void (*mbox_message_fun)(uint64_t      offset,
+                                 const char    *from,
+                                 const char    *subject,
+                                 void          *cookie);
+
+/**
+ * @brief Creates a new (empty) scanner state.
+ *
+ * @param[in] max_messages the number of unseen messages that are kept, the
+ *            older ones are dropped during the scan (0 keeps all)
+ */
+struct mbox_state *mbox_state_new(unsigned int max_messages);
+
+/**
+ * @brief Updates @p state from the mbox file @p path.
+ *
+ * A missing file is treated as empty mailbox.
+ *
+ * @param[in] state the state of the previous scan
+ * @param[in] path the path of the mbox file
+ * @param[out] total the number of messages
+ * @param[out] unseen the number of messages without 'R' in the Status header
+ * @return @c true on success, @c false if the file could not be read
+ */
+bool mbox_scan(struct mbox_state    *state,
+               const char           *path,
+               unsigned int         *total,
+               unsigned int         *unseen);
+
+/**
+ * @brief Calls @p fun for each unseen message of the last scan in file order
+ *        (only the newest ones if the state has a limit).
+ */
+void mbox_foreach_unseen(struct mbox_state  *state,
+                         mbox_message_fun   fun,
+                         void               *cookie);
+
+/**
+ * @brief Reads the start of the message at @p offset and builds a preview
+ *        from it (see mail_preview()).
+ *
+ * @return the preview or NULL if there's no message at @p offset any more
+ */
+char *mbox_preview(const char *path, uint64_t offset);
+
+/**
+ * @brief Frees the scanner state.
+ */
+void mbox_state_free(struct mbox_state *state);
+
+#endif /* MBOX_H */
+
+/* vim: set ts=4 sw=4 et: */
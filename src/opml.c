@@ -0,0 +1,114 @@
+/*
+ * This file is part of lcd-stuff.
+ *
+ * lcd-stuff is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License.
+ *
+ * lcd-stuff is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with lcd-stuff; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+#include <stdio.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+
+#include <glib.h>
+#include <expat.h>
+
+#include <shared/report.h>
+
+#include "opml.h"
+
+/* ---------------------- constants ----------------------------------------- */
+#define BUFFER_SIZE         8192
+
+/* ---------------------- types --------------------------------------------- */
+struct opml_reader {
+    opml_feed_fun       fun;
+    void                *cookie;
+};
+
+/* -------------------------------------------------------------------------- */
+static const char *attribute(const XML_Char **atts, const char *name)
+{
+    int i;
+
+    for (i = 0; atts[i] && atts[i+1]; i += 2)
+        if (strcmp(atts[i], name) == 0)
+            return atts[i+1];
+
+    return NULL;
+}
+
+/* -------------------------------------------------------------------------- */
+static void start_element(void *data, const XML_Char *name, const XML_Char **atts)
+{
+    struct opml_reader *reader = (struct opml_reader *)data;
+    const char *url, *title;
+
+    if (strcmp(name, "outline") != 0)
+        return;
+
+    url = attribute(atts, "xmlUrl");
+    if (!url || !*url)
+        return;
+
+    title = attribute(atts, "title");
+    if (!title || !*title)
+        title = attribute(atts, "text");
+    if (!title || !*title)
+        title = url;
+
+    reader->fun(url, title, reader->cookie);
+}
+
+/* -------------------------------------------------------------------------- */
+bool opml_read(const char *filename, opml_feed_fun fun, void *cookie)
+{
+    struct opml_reader reader = { fun, cookie };
+    XML_Parser parser;
+    char buffer[BUFFER_SIZE];
+    bool ok = true;
+    size_t len;
+    FILE *fp;
+
+    fp = fopen(filename, "r");
+    if (!fp) {
+        report(RPT_ERR, "Cannot open %s: %s", filename, strerror(errno));
+        return false;
+    }
+
+    parser = XML_ParserCreate(NULL);
+    XML_SetUserData(parser, &reader);
+    XML_SetStartElementHandler(parser, start_element);
+
+    do {
+        len = fread(buffer, 1, sizeof(buffer), fp);
+        if (XML_Parse(parser, buffer, len, len == 0) == XML_STATUS_ERROR) {
+            report(RPT_ERR, "Error parsing %s in line %lu: %s", filename,
+                   (unsigned long)XML_GetCurrentLineNumber(parser),
+                   XML_ErrorString(XML_GetErrorCode(parser)));
+            ok = false;
+        }
+    } while (ok && len > 0);
+
+    if (ferror(fp)) {
+        report(RPT_ERR, "Cannot read %s: %s", filename, strerror(errno));
+        ok = false;
+    }
+
+    XML_ParserFree(parser);
+    fclose(fp);
+
+    return ok;
+}
+
+/* vim: set ts=4 sw=4 et: */
@@ -0,0 +1,56 @@
+/*
+ * This file is part of lcd-stuff.
+ *
+ * lcd-stuff is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License.
+ *
+ * lcd-stuff is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with lcd-stuff; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+#ifndef OPML_H
+#define OPML_H
+
+#include <stdbool.h>
+
+/**
+ * @file opml.h
+ * @brief Reads the feed subscriptions of an OPML file.
+ *
+ * OPML is the format that feed readers use to export their subscriptions.
+ * Each outline with an xmlUrl attribute is a feed, the outlines around
+ * them (categories) are ignored.
+ */
+
+/**
+ * @brief Called for each feed of the file.
+ *
+ * @param[in] url the URL of the feed
+ * @param[in] name the title or text of the outline (UTF-8), the URL if the
+ *            outline has neither
+ * @param[in] cookie as passed to opml_read()
+ */
+typedef void (*opml_feed_fun)(const char *url, const char *name, void *cookie);
+
+/**
+ * @brief Reads an OPML file.
+ *
+ * @param[in] filename the file
+ * @param[in] fun called for each feed
+ * @param[in] cookie for @p fun
+ * @return @c true on success, @c false if the file cannot be read or is not
+ *         well-formed (the error has been reported, feeds before the error
+ *         have been passed to @p fun)
+ */
+bool opml_read(const char *filename, opml_feed_fun fun, void *cookie);
+
+#endif /* OPML_H */
+
+/* vim: set ts=4 sw=4 et: */
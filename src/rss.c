@@ -24,8 +24,6 @@
 #include <string.h>
 #include <errno.h>
 
-#include <mrss.h>
-
 #include <shared/report.h>
 #include <shared/sockets.h>
 #include <shared/str.h>
@@ -38,27 +36,88 @@
 #include "keyfile.h"
 #include "util.h"
 #include "screen.h"
+#include "http.h"
+#include "feedparser.h"
+#include "opml.h"
+#include "matcher.h"
 
 /* ---------------------- constants ----------------------------------------- */
 #define MODULE_NAME           "rss"
+#define CACHE_FILE            "feeds"
+#define CACHE_SAVE_SEC        300
+#define HOUR_SEC              (60*60)
+#define WEEK_HOURS            (7*24)
+#define FNV_OFFSET_BASIS      G_GUINT64_CONSTANT(14695981039346656037)
+#define FNV_PRIME             G_GUINT64_CONSTANT(1099511628211)
 
 /* ---------------------- types --------------------------------------------- */
+enum rule_kind {
+    RULE_INCLUDE,
+    RULE_EXCLUDE,
+    RULE_ALERT,
+    RULE_KINDS
+};
+
 struct rss_feed {
-    char *url;
-    char *name;
-    int  items;
+    char                    *url;
+    char                    *name;
+    char                    *name_marked;   /* for unread items */
+    int                     items;
+    int                     interval;   /* configured, 0 to follow the hints */
+    struct feed_hints       hints;      /* of the last parsed document */
+    long                    max_age;    /* of the last response */
+    const struct size       *display;   /* the headlines are wrapped for */
+    GMutex                  *mutex;     /* of the module, for the unread flags */
+    unsigned int            index;      /* in the feeds, from 1 */
+    const struct matcher    *filter;    /* the keywords of all feeds */
+    bool                    included;   /* only items with include keywords */
+    struct http_validator   validator;  /* of the current news */
+    GPtrArray               *news;      /* struct newsitem, newest first */
+    GPtrArray               *new_news;  /* merged, replaces news after the check */
+    bool                    updated;    /* new_news is valid */
+    struct feed_parser      *parser;    /* during the download */
+    time_t                  fetched;    /* last successful download */
+    time_t                  next_due;   /* next download */
 };
 
 struct newsitem {
-    char *site;
-    char *headline;
+    char        *site;
+    char        *site_marked;   /* the title for unread items */
+    char        *headline;      /* Latin-1 */
+    char        **lines;        /* headline wrapped for wrap_size */
+    struct size wrap_size;
+    guint64     id;             /* hash of the guid, the link or the title */
+    guint64     title_hash;     /* of the UTF-8 title, to detect changes */
+    time_t      date;           /* published, or first seen if unknown */
+    unsigned int pos;           /* in the feed, for items of the same date */
+    bool        unread;         /* new since it was last displayed */
+    bool        keep;           /* still in the feed, during the merge */
+    bool        listed;         /* in the displayed news */
+    bool        hidden;         /* by include and exclude keywords */
+    bool        alert;          /* has alert keywords */
+    bool        alert_pending;  /* new, the alert is not raised yet */
 };
 
 struct lcd_stuff_rss {
     struct lcd_stuff    *lcd;
     int                 interval;
+    int                 min_interval;   /* bounds of the interval of a feed */
+    int                 max_interval;
+    int                 connections;    /* parallel downloads */
+    int                 timeout;        /* per download, in seconds */
+    int                 items;          /* default of the feeds */
+    int                 max_news;       /* of all feeds, 0 for all */
     GPtrArray           *feeds;
-    GList               *news;
+    GHashTable          *feed_urls;     /* url -> struct rss_feed */
+    GMutex              *mutex;     /* news, current_screen and the lines and
+                                       unread flags of the listed items, the
+                                       service thread shows them */
+    GPtrArray           *news;      /* the newest news of all feeds, not owned */
+    char                *cache_file;    /* NULL if disabled */
+    time_t              cache_saved;
+    struct matcher      *filter;        /* NULL if there are no keywords */
+    int                 alert_time;     /* seconds at alert priority */
+    time_t              alert_until;    /* 0 if there's no alert */
     int                 current_screen;
     struct screen       screen;
 };
@@ -72,135 +131,825 @@ static void update_screen_receiving(struct lcd_stuff_rss *rss, const char *title
 }
 
 /* -------------------------------------------------------------------------- */
-static void update_screen_text(struct lcd_stuff_rss *rss, const char *title, GString *text)
+static guint64 hash_string(const char *str)
 {
-    int lineno = 0;
-    char *line;
+    guint64 hash = FNV_OFFSET_BASIS;
 
-    screen_set_title(&rss->screen, title);
-    screen_clear(&rss->screen);
+    /* FNV-1a */
+    for (; *str; str++) {
+        hash ^= (guchar)*str;
+        hash *= FNV_PRIME;
+    }
 
-    do {
-        line = stringbuffer_get_line(text, lineno);
-        screen_show_text(&rss->screen, lineno++, line);
-    } while (line);
+    return hash;
+}
+
+/* -------------------------------------------------------------------------- */
+/*
+ * Wraps the headline for the display, unless it has already been wrapped
+ * for that size.
+ */
+static void newsitem_wrap(struct newsitem *item, const struct size *size)
+{
+    GString *headline, *wrapped;
+
+    if (item->lines && item->wrap_size.width == size->width &&
+            item->wrap_size.height == size->height)
+        return;
+
+    g_strfreev(item->lines);
+    item->lines = NULL;
+
+    headline = g_string_new(item->headline);
+    wrapped = stringbuffer_wrap(headline, size->width, size->height-1);
+    if (wrapped) {
+        item->lines = g_strsplit(wrapped->str, "\n", -1);
+        g_string_free(wrapped, true);
+    }
+    g_string_free(headline, true);
+
+    item->wrap_size = *size;
 }
 
 /* -------------------------------------------------------------------------- */
 static void update_screen_news(struct lcd_stuff_rss *rss)
 {
-    int     i;
-    int     tot = g_list_length(rss->news);
+    struct newsitem *item;
+    int             tot;
+    int             i;
+    bool            end = false;
 
+    g_mutex_lock(rss->mutex);
+
+    tot = rss->news->len;
     if (rss->current_screen < 0)
         rss->current_screen = tot - 1;
     else if (rss->current_screen >= tot)
         rss->current_screen = 0;
 
-    if (tot != 0) {
-        GList *cur = g_list_first(rss->news);
-        i = 0;
+    if (tot == 0)
+        goto out;
+    item = g_ptr_array_index(rss->news, rss->current_screen);
 
-        while (cur) {
-            struct newsitem *item = (struct newsitem *)cur->data;
-            if (!item)
-                break;
+    /* mark the news that are new since they were last shown */
+    screen_set_title(&rss->screen, item->unread ? item->site_marked : item->site);
 
-            if (i++ == rss->current_screen) {
-                GString *newsitem;
+    /* the listed items have been wrapped when they were collected */
+    for (i = 0; i < rss->lcd->display_size.height; i++) {
+        if (!item->lines || !item->lines[i])
+            end = true;
+        screen_show_text(&rss->screen, i, end ? "" : item->lines[i]);
+    }
 
-                newsitem = g_string_new(item->headline);
-                if (newsitem) {
-                    GString *wrapped;
+out:
+    g_mutex_unlock(rss->mutex);
+}
 
-                    wrapped = stringbuffer_wrap(newsitem,
-                                                rss->lcd->display_size.width,
-                                                rss->lcd->display_size.height-1);
-                    if (wrapped) {
-                        update_screen_text(rss, item->site, wrapped);
-                        g_string_free(wrapped, true);
-                    }
-                    g_string_free(newsitem, true);
-                }
+/* -------------------------------------------------------------------------- */
+/*
+ * Called before the display moves to another item: the current one has been
+ * seen. The caller holds rss->mutex.
+ */
+static void mark_current_read(struct lcd_stuff_rss *rss)
+{
+    if (rss->current_screen >= 0 && rss->current_screen < (int)rss->news->len) {
+        struct newsitem *item = g_ptr_array_index(rss->news, rss->current_screen);
+        item->unread = false;
+    }
+}
 
-                break;
+/* -------------------------------------------------------------------------- */
+struct filter_result {
+    unsigned int    feed;           /* index of the feed */
+    bool            matched[RULE_KINDS];
+};
+
+/* -------------------------------------------------------------------------- */
+static void filter_match(int value, void *cookie)
+{
+    struct filter_result *result = (struct filter_result *)cookie;
+    unsigned int feed = value / RULE_KINDS;
+
+    /* the global keywords, or those of the feed */
+    if (feed == 0 || feed == result->feed)
+        result->matched[value % RULE_KINDS] = true;
+}
+
+/* -------------------------------------------------------------------------- */
+/*
+ * One pass over the headline for all keywords. Excluded items are hidden,
+ * alerts are shown even without include keywords.
+ */
+static void newsitem_filter(struct newsitem *item, struct rss_feed *feed)
+{
+    struct filter_result result;
+
+    item->hidden = item->alert = false;
+    if (!feed->filter)
+        return;
+
+    memset(&result, 0, sizeof(result));
+    result.feed = feed->index;
+    matcher_match(feed->filter, item->headline, filter_match, &result);
+
+    item->alert = result.matched[RULE_ALERT] && !result.matched[RULE_EXCLUDE];
+    item->hidden = result.matched[RULE_EXCLUDE] ||
+                   (feed->included && !result.matched[RULE_INCLUDE] && !item->alert);
+}
+
+/* -------------------------------------------------------------------------- */
+/*
+ * The headline is wrapped when the item gets into the displayed news.
+ */
+static struct newsitem *newsitem_new(struct rss_feed *feed, const char *title,
+                                     guint64 id, time_t date)
+{
+    struct newsitem *newsitem = (struct newsitem *)malloc(sizeof(struct newsitem));
+    if (!newsitem) {
+        report(RPT_ERR, MODULE_NAME ": Out of memory");
+        return NULL;
+    }
+
+    newsitem->headline = g_convert_with_fallback(title, -1, "ISO-8859-1",
+                                                 "UTF-8", "?", NULL, NULL, NULL);
+    if (!newsitem->headline)
+        newsitem->headline = g_strdup("");
+    newsitem->site = feed->name;
+    newsitem->site_marked = feed->name_marked;
+    newsitem->lines = NULL;
+    newsitem->id = id;
+    newsitem->title_hash = hash_string(title);
+    newsitem->date = date;
+    newsitem->pos = 0;
+    newsitem->unread = true;
+    newsitem->keep = false;
+    newsitem->listed = false;
+    newsitem->alert_pending = false;
+    newsitem_filter(newsitem, feed);
+
+    return newsitem;
+}
+
+/* -------------------------------------------------------------------------- */
+static struct newsitem *find_news(GPtrArray *news, guint64 id)
+{
+    unsigned int i;
+
+    for (i = 0; news && i < news->len; i++) {
+        struct newsitem *item = g_ptr_array_index(news, i);
+
+        /* the same id twice in a feed are two items */
+        if (item->id == id && !item->keep)
+            return item;
+    }
+
+    return NULL;
+}
+
+/* -------------------------------------------------------------------------- */
+static void free_newsitem(struct newsitem *item)
+{
+    free(item->headline);
+    g_strfreev(item->lines);
+    free(item);
+}
+
+/* -------------------------------------------------------------------------- */
+static void free_news(GPtrArray *news)
+{
+    unsigned int i;
+
+    if (!news)
+        return;
+
+    for (i = 0; i < news->len; i++)
+        free_newsitem(g_ptr_array_index(news, i));
+    g_ptr_array_free(news, true);
+}
+
+/* -------------------------------------------------------------------------- */
+static int newsitem_compare(const struct newsitem *a, const struct newsitem *b)
+{
+    /* newest first */
+    if (a->date != b->date)
+        return a->date > b->date ? -1 : 1;
+
+    return (int)a->pos - (int)b->pos;
+}
+
+/* -------------------------------------------------------------------------- */
+static gint newsitem_sort(gconstpointer a, gconstpointer b)
+{
+    return newsitem_compare(*(const struct newsitem **)a,
+                            *(const struct newsitem **)b);
+}
+
+/* -------------------------------------------------------------------------- */
+/*
+ * RSS has RFC 822 dates, Atom and Dublin Core ISO 8601.
+ */
+static time_t parse_date(const char *date)
+{
+    GTimeVal tv;
+
+    if (!date)
+        return 0;
+    if (g_time_val_from_iso8601(date, &tv))
+        return tv.tv_sec;
+
+    return http_parse_date(date);
+}
+
+/* -------------------------------------------------------------------------- */
+static bool rss_feed_data(struct http_transfer *transfer, const char *data, size_t len)
+{
+    struct rss_feed *feed = (struct rss_feed *)transfer->cookie;
+
+    /* stops the download when we have enough items */
+    return feed_parser_parse(feed->parser, data, len);
+}
+
+/* -------------------------------------------------------------------------- */
+/*
+ * Called for each feed as soon as its download is finished, while the other
+ * downloads continue. The items that we already have are taken over (marked
+ * with keep), so only new items are converted. The displayed news are
+ * replaced when all are done.
+ */
+static void rss_parse_feed(struct http_transfer *transfer)
+{
+    struct rss_feed           *feed = (struct rss_feed *)transfer->cookie;
+    GPtrArray                 *items;
+    int                       i;
+
+    if (transfer->result != HTTP_ERROR) {
+        feed->fetched = time(NULL);
+        feed->max_age = transfer->max_age;
+    }
+
+    switch (transfer->result) {
+        case HTTP_NOT_MODIFIED:
+            /* the news we have are current */
+            return;
+
+        case HTTP_ERROR:
+            /* keep the old news, and get the complete feed next time */
+            http_validator_clear(&feed->validator);
+            return;
+
+        case HTTP_MODIFIED:
+            break;
+    }
+
+    items = feed_parser_finish(feed->parser);
+    if (!items) {
+        report(RPT_ERR, "Error reading RSS feed %s", feed->url);
+        http_validator_clear(&feed->validator);
+        return;
+    }
+
+    feed->updated = true;
+    feed->new_news = g_ptr_array_sized_new(MIN((int)items->len, feed->items));
+    feed_parser_get_hints(feed->parser, &feed->hints);
+
+    for (i = 0; i < (int)items->len && i < feed->items; i++) {
+        struct feed_item *item = g_ptr_array_index(items, i);
+        struct newsitem  *newsitem;
+        time_t           date;
+        guint64          id;
+
+        id = hash_string(item->id ? item->id : item->title);
+        date = parse_date(item->date);
+        newsitem = find_news(feed->news, id);
+
+        if (newsitem && newsitem->title_hash == hash_string(item->title))
+            newsitem->keep = true;
+        else {
+            /* a changed title is no news */
+            bool unread = true;
+
+            if (newsitem) {
+                g_mutex_lock(feed->mutex);
+                unread = newsitem->unread;
+                g_mutex_unlock(feed->mutex);
             }
 
-            cur = cur->next;
+            if (date == 0)
+                date = newsitem ? newsitem->date : feed->fetched;
+            newsitem = newsitem_new(feed, item->title, id, date);
+            if (!newsitem)
+                break;
+            newsitem->unread = unread;
+            newsitem->alert_pending = newsitem->alert;
         }
+
+        if (date != 0)
+            newsitem->date = date;
+        newsitem->pos = i;
+        g_ptr_array_add(feed->new_news, newsitem);
     }
+
+    /* for the merge */
+    g_ptr_array_sort(feed->new_news, newsitem_sort);
+}
+
+/* -------------------------------------------------------------------------- */
+struct news_cursor {
+    GPtrArray       *news;          /* of a feed, newest first */
+    unsigned int    next;
+};
+
+/* -------------------------------------------------------------------------- */
+static bool cursor_newer(struct news_cursor *a, struct news_cursor *b)
+{
+    return newsitem_compare(g_ptr_array_index(a->news, a->next),
+                            g_ptr_array_index(b->news, b->next)) < 0;
 }
 
 /* -------------------------------------------------------------------------- */
-void free_news(struct lcd_stuff_rss *rss)
+static void heap_sift_down(struct news_cursor *heap, unsigned int n, unsigned int i)
 {
-    GList *cur = g_list_first(rss->news);
-    while (cur) {
-        struct newsitem *item = (struct newsitem *)cur->data;
-        free(item->headline);
-        free(cur->data);
-        cur = cur->next;
+    for (;;) {
+        unsigned int newest = i, child = 2*i + 1;
+        struct news_cursor tmp;
+
+        if (child < n && cursor_newer(&heap[child], &heap[newest]))
+            newest = child;
+        if (child + 1 < n && cursor_newer(&heap[child + 1], &heap[newest]))
+            newest = child + 1;
+        if (newest == i)
+            return;
+
+        tmp = heap[i];
+        heap[i] = heap[newest];
+        heap[newest] = tmp;
+        i = newest;
     }
-    g_list_free(rss->news);
-    rss->news = NULL;
 }
 
 /* -------------------------------------------------------------------------- */
-static void rss_check(struct lcd_stuff_rss *rss)
+/*
+ * Merges the news of all feeds by date: a heap holds the newest item of
+ * each feed, so that only the max_news items that are displayed are looked
+ * at. Only those are kept wrapped for the display. The service thread sees
+ * the new list with the items wrapped, so the items that are not in it any
+ * more may be freed afterwards.
+ */
+static void rss_collect_news(struct lcd_stuff_rss *rss)
 {
+    struct news_cursor *heap;
+    struct newsitem *current = NULL;
+    GPtrArray *news, *old;
+    unsigned int nf, i, n = 0, max, total = 0;
+
+    heap = g_new(struct news_cursor, rss->feeds->len);
+    for (nf = 0; nf < rss->feeds->len; nf++) {
+        struct rss_feed *feed = g_ptr_array_index(rss->feeds, nf);
+
+        if (!feed->news || feed->news->len == 0)
+            continue;
+
+        for (i = 0; i < feed->news->len; i++)
+            ((struct newsitem *)g_ptr_array_index(feed->news, i))->listed = false;
+
+        heap[n].news = feed->news;
+        heap[n++].next = 0;
+        total += feed->news->len;
+    }
+
+    for (i = n / 2; i > 0; i--)
+        heap_sift_down(heap, n, i - 1);
+
+    max = rss->max_news > 0 ? MIN((unsigned int)rss->max_news, total) : total;
+    news = g_ptr_array_sized_new(max);
+
+    while (n > 0 && news->len < max) {
+        struct newsitem *item = g_ptr_array_index(heap[0].news, heap[0].next++);
+
+        if (!item->hidden) {
+            item->listed = true;
+            g_ptr_array_add(news, item);
+        }
+
+        if (heap[0].next >= heap[0].news->len)
+            heap[0] = heap[--n];
+        heap_sift_down(heap, n, 0);
+    }
+    g_free(heap);
+
+    /* stay at the displayed item if it's still there */
+    g_mutex_lock(rss->mutex);
+    if (rss->current_screen >= 0 && rss->current_screen < (int)rss->news->len)
+        current = g_ptr_array_index(rss->news, rss->current_screen);
+    for (i = 0; current && i < news->len; i++) {
+        if (g_ptr_array_index(news, i) == current) {
+            rss->current_screen = i;
+            break;
+        }
+    }
+
+    /* the budget for the wrapped lines */
+    for (nf = 0; nf < rss->feeds->len; nf++) {
+        struct rss_feed *feed = g_ptr_array_index(rss->feeds, nf);
+
+        for (i = 0; feed->news && i < feed->news->len; i++) {
+            struct newsitem *item = g_ptr_array_index(feed->news, i);
+
+            if (item->listed)
+                newsitem_wrap(item, feed->display);
+            else if (item->lines) {
+                g_strfreev(item->lines);
+                item->lines = NULL;
+            }
+        }
+    }
+
+    old = rss->news;
+    rss->news = news;
+    g_mutex_unlock(rss->mutex);
+
+    g_ptr_array_free(old, true);
+}
+
+/* -------------------------------------------------------------------------- */
+static void rss_cache_save(struct lcd_stuff_rss *rss, bool force)
+{
+    GKeyFile *cache;
+    GError   *err = NULL;
+    char     *data;
+    gsize    len;
     unsigned int nf;
+    time_t   now = time(NULL);
+
+    if (!rss->cache_file)
+        return;
 
-    rss->current_screen = 0;
+    /* with many feeds, one of them is fetched every few seconds */
+    if (!force && now - rss->cache_saved < CACHE_SAVE_SEC)
+        return;
+    rss->cache_saved = now;
 
-    /* free old mail */
-    free_news(rss);
+    cache = g_key_file_new();
 
     for (nf = 0; nf < rss->feeds->len; nf++) {
-        struct rss_feed           *feed       = g_ptr_array_index(rss->feeds, nf);
-        mrss_error_t              err_read;
-        mrss_t                    *data_cur = NULL;
-        mrss_item_t               *item_cur = NULL;
-        int                       i = 0;
+        struct rss_feed *feed = g_ptr_array_index(rss->feeds, nf);
+        char     *group, **titles, **ids, **dates;
+        gboolean *unread;
+        gsize    n, i;
 
-        if (!feed) {
-            break;
+        if (feed->fetched == 0)
+            continue;
+
+        /* GKeyFile wants UTF-8 */
+        n = feed->news ? feed->news->len : 0;
+        titles = g_new0(char *, n + 1);
+        ids = g_new0(char *, n + 1);
+        dates = g_new0(char *, n + 1);
+        unread = g_new0(gboolean, n + 1);
+        g_mutex_lock(rss->mutex);
+        for (i = 0; i < n; i++) {
+            struct newsitem *item = g_ptr_array_index(feed->news, i);
+
+            titles[i] = g_convert(item->headline, -1, "UTF-8", "ISO-8859-1",
+                                  NULL, NULL, NULL);
+            if (!titles[i])
+                titles[i] = g_strdup("");
+            ids[i] = g_strdup_printf("%" G_GUINT64_FORMAT, item->id);
+            dates[i] = g_strdup_printf("%ld", (long)item->date);
+            unread[i] = item->unread;
         }
+        g_mutex_unlock(rss->mutex);
+
+        group = g_strdup_printf("feed%u", nf);
+        g_key_file_set_string(cache, group, "url", feed->url);
+        if (feed->validator.etag)
+            g_key_file_set_string(cache, group, "etag", feed->validator.etag);
+        if (feed->validator.last_modified)
+            g_key_file_set_string(cache, group, "last_modified",
+                                  feed->validator.last_modified);
+        g_key_file_set_int64(cache, group, "fetched", feed->fetched);
+        g_key_file_set_integer(cache, group, "ttl", feed->hints.ttl);
+        g_key_file_set_integer(cache, group, "skip_hours", feed->hints.skip_hours);
+        g_key_file_set_integer(cache, group, "skip_days", feed->hints.skip_days);
+        g_key_file_set_int64(cache, group, "max_age", feed->max_age);
+        g_key_file_set_string_list(cache, group, "titles",
+                                   (const gchar * const *)titles, n);
+        g_key_file_set_string_list(cache, group, "ids",
+                                   (const gchar * const *)ids, n);
+        g_key_file_set_string_list(cache, group, "dates",
+                                   (const gchar * const *)dates, n);
+        g_key_file_set_boolean_list(cache, group, "unread", unread, n);
+        g_free(group);
+        g_strfreev(titles);
+        g_strfreev(ids);
+        g_strfreev(dates);
+        g_free(unread);
+    }
+
+    /* written atomically */
+    data = g_key_file_to_data(cache, &len, NULL);
+    if (!g_file_set_contents(rss->cache_file, data, len, &err)) {
+        report(RPT_WARNING, MODULE_NAME ": Cannot write %s: %s", rss->cache_file,
+               err->message);
+        g_error_free(err);
+    }
+
+    g_free(data);
+    g_key_file_free(cache);
+}
+
+/* -------------------------------------------------------------------------- */
+static bool feed_skipped(struct rss_feed *feed, time_t time)
+{
+    struct tm tm;
+
+    /* skipHours and skipDays are in GMT */
+    gmtime_r(&time, &tm);
+
+    return (feed->hints.skip_hours & (1U << tm.tm_hour)) ||
+           (feed->hints.skip_days & (1U << tm.tm_wday));
+}
 
-        update_screen_receiving(rss, feed->name);
+/* -------------------------------------------------------------------------- */
+/*
+ * The configured interval of the feed wins. Else the publisher's hints are
+ * followed: the longest of ttl (or the syndication module) and the
+ * freshness of the HTTP response, but not in skipped hours and days.
+ */
+static time_t feed_next_due(struct lcd_stuff_rss *rss, struct rss_feed *feed,
+                            time_t from)
+{
+    long   interval = feed->interval;
+    time_t next;
+    int    i;
+
+    if (interval <= 0) {
+        interval = MAX((long)feed->hints.ttl, feed->max_age);
+        if (interval <= 0)
+            interval = rss->interval;
+    }
+
+    interval = CLAMP(interval, (long)rss->min_interval, (long)rss->max_interval);
+    next = from + interval;
+
+    /*
+     * Spread the feeds over the interval, so that each comes at its own
+     * time (from the hash of its URL) instead of all at once.
+     */
+    if (interval > 1) {
+        long phase = hash_string(feed->url) % interval;
+        long delta = ((phase - next % interval) % interval + interval) % interval;
+
+        if (delta > interval / 2)
+            delta -= interval;
+        next = MAX(next + delta, from + rss->min_interval);
+    }
+
+    if (feed->interval > 0)
+        return next;
 
-        err_read = mrss_parse_url(feed->url, &data_cur);
-		if (err_read != MRSS_OK) {
-			report(RPT_ERR, "Error reading RSS feed: %s", mrss_strerror(err_read));
+    /* the next full hour that isn't skipped, but not if all are */
+    for (i = 0; i < WEEK_HOURS && feed_skipped(feed, next); i++)
+        next = next - next % HOUR_SEC + HOUR_SEC;
+
+    return i < WEEK_HOURS ? next : from + interval;
+}
+
+/* -------------------------------------------------------------------------- */
+static struct rss_feed *find_feed(struct lcd_stuff_rss *rss, const char *url)
+{
+    return g_hash_table_lookup(rss->feed_urls, url);
+}
+
+/* -------------------------------------------------------------------------- */
+/*
+ * Shows the news from before the restart. Feeds that are still fresh are
+ * not downloaded before their interval is over.
+ */
+static void rss_cache_load(struct lcd_stuff_rss *rss)
+{
+    GKeyFile *cache;
+    char     **groups = NULL;
+    gsize    n_groups = 0, g;
+
+    if (!rss->cache_file)
+        return;
+
+    cache = g_key_file_new();
+    if (!g_key_file_load_from_file(cache, rss->cache_file, G_KEY_FILE_NONE, NULL))
+        goto out;
+
+    groups = g_key_file_get_groups(cache, &n_groups);
+    for (g = 0; g < n_groups; g++) {
+        struct rss_feed *feed;
+        char     *url, **titles, **ids, **dates;
+        gboolean *unread;
+        gsize    n = 0, n_ids = 0, n_dates = 0, n_unread = 0, i;
+
+        url = g_key_file_get_string(cache, groups[g], "url", NULL);
+        feed = url ? find_feed(rss, url) : NULL;
+        g_free(url);
+        if (!feed || feed->fetched != 0)
             continue;
-		}
 
-        item_cur = data_cur->item;
-        while(item_cur && i++ < feed->items) {
-            gsize written;
+        feed->validator.etag = g_key_file_get_string(cache, groups[g], "etag", NULL);
+        feed->validator.last_modified = g_key_file_get_string(cache, groups[g],
+                                                              "last_modified", NULL);
+        feed->fetched = g_key_file_get_int64(cache, groups[g], "fetched", NULL);
+        feed->hints.ttl = g_key_file_get_integer(cache, groups[g], "ttl", NULL);
+        feed->hints.skip_hours = g_key_file_get_integer(cache, groups[g], "skip_hours", NULL);
+        feed->hints.skip_days = g_key_file_get_integer(cache, groups[g], "skip_days", NULL);
+        feed->max_age = g_key_file_get_int64(cache, groups[g], "max_age", NULL);
+        feed->next_due = feed_next_due(rss, feed, feed->fetched);
+
+        titles = g_key_file_get_string_list(cache, groups[g], "titles", &n, NULL);
+        ids = g_key_file_get_string_list(cache, groups[g], "ids", &n_ids, NULL);
+        dates = g_key_file_get_string_list(cache, groups[g], "dates", &n_dates, NULL);
+        unread = g_key_file_get_boolean_list(cache, groups[g], "unread", &n_unread, NULL);
+        feed->news = g_ptr_array_sized_new(MIN((int)n, feed->items));
+        for (i = 0; i < n && (int)i < feed->items; i++) {
+            struct newsitem *newsitem;
+            time_t          date;
+            guint64         id;
+
+            id = i < n_ids ? g_ascii_strtoull(ids[i], NULL, 10) : hash_string(titles[i]);
+            date = i < n_dates ? (time_t)g_ascii_strtoll(dates[i], NULL, 10) : feed->fetched;
+            newsitem = newsitem_new(feed, titles[i], id, date);
+            if (!newsitem)
+                break;
+            newsitem->pos = i;
+            newsitem->unread = i < n_unread ? unread[i] : false;
+            g_ptr_array_add(feed->news, newsitem);
+        }
+        g_strfreev(titles);
+        g_strfreev(ids);
+        g_strfreev(dates);
+        g_free(unread);
+    }
+
+    rss_collect_news(rss);
 
-            /* create a new newsitem */
-            struct newsitem *newsitem = (struct newsitem *)malloc(sizeof(struct newsitem));
-            if (!newsitem) {
-                report(RPT_ERR, MODULE_NAME ": Out of memory");
-                goto end_loop;
-            }
+out:
+    g_strfreev(groups);
+    g_key_file_free(cache);
+}
 
-            newsitem->headline = g_convert(item_cur->title, -1, "ISO-8859-1",
-                                           data_cur->encoding, NULL, &written, NULL);
-            if (!newsitem->headline) {
-                newsitem->headline = g_strdup("");
+/* -------------------------------------------------------------------------- */
+/*
+ * Shows the newest of the new items with alert keywords in the foreground
+ * for alert_time.
+ */
+static void rss_check_alerts(struct lcd_stuff_rss *rss, struct rss_feed **feeds,
+                             unsigned int n)
+{
+    unsigned int i, nf;
+
+    for (i = 0; i < rss->news->len; i++) {
+        struct newsitem *item = g_ptr_array_index(rss->news, i);
+
+        if (item->alert_pending) {
+            g_mutex_lock(rss->mutex);
+            rss->current_screen = i;
+            g_mutex_unlock(rss->mutex);
+            if (rss->alert_time > 0) {
+                if (rss->alert_until == 0)
+                    screen_set_priority(&rss->screen, "alert");
+                rss->alert_until = time(NULL) + rss->alert_time;
             }
+            break;
+        }
+    }
 
-            newsitem->site = feed->name;
+    /* also those that are too old to be shown */
+    for (nf = 0; nf < n; nf++)
+        for (i = 0; feeds[nf]->news && i < feeds[nf]->news->len; i++)
+            ((struct newsitem *)g_ptr_array_index(feeds[nf]->news, i))->alert_pending = false;
+}
 
-            rss->news = g_list_append(rss->news, newsitem);
-            item_cur = item_cur->next;
+/* -------------------------------------------------------------------------- */
+/*
+ * The merge takes the unchanged items over, so a feed without news has the
+ * same items in the same order.
+ */
+static bool news_changed(GPtrArray *news, GPtrArray *new_news)
+{
+    unsigned int i;
+
+    if (!news || news->len != new_news->len)
+        return true;
+
+    for (i = 0; i < news->len; i++)
+        if (g_ptr_array_index(news, i) != g_ptr_array_index(new_news, i))
+            return true;
+
+    return false;
+}
+
+/* -------------------------------------------------------------------------- */
+static void rss_check(struct lcd_stuff_rss *rss)
+{
+    struct http_transfer *transfers;
+    struct rss_feed **due;
+    GPtrArray **old;
+    unsigned int nf, i, n = 0;
+    bool changed = false;
+    time_t now = time(NULL);
+
+    /* only the feeds whose news are not fresh any more */
+    due = g_new0(struct rss_feed *, rss->feeds->len);
+    for (nf = 0; nf < rss->feeds->len; nf++) {
+        struct rss_feed *feed = g_ptr_array_index(rss->feeds, nf);
+
+        if (feed->next_due <= now)
+            due[n++] = feed;
+    }
+    if (n == 0)
+        goto out;
+
+    /* only show that we're receiving if there's nothing else to show */
+    if (rss->news->len == 0)
+        update_screen_receiving(rss, "RSS");
+
+    /* all feeds at once, each is parsed when it arrives */
+    transfers = g_new0(struct http_transfer, n);
+    for (nf = 0; nf < n; nf++) {
+        struct rss_feed *feed = due[nf];
+
+        /* parses while downloading, only as many items as we show */
+        feed->parser = feed_parser_new(MAX(feed->items, 1));
+
+        transfers[nf].url = feed->url;
+        transfers[nf].validator = &feed->validator;
+        transfers[nf].data = rss_feed_data;
+        transfers[nf].cookie = feed;
+    }
+
+    http_get_all(transfers, n, rss->connections, rss->timeout, rss_parse_feed);
+
+    old = g_new0(GPtrArray *, n);
+    for (nf = 0; nf < n; nf++) {
+        struct rss_feed *feed = due[nf];
+
+        if (feed->updated && news_changed(feed->news, feed->new_news)) {
+            old[nf] = feed->news;
+            feed->news = feed->new_news;
+            changed = true;
+        } else if (feed->updated) {
+            /* the same items in the same order, nothing to collect */
+            for (i = 0; i < feed->new_news->len; i++)
+                ((struct newsitem *)g_ptr_array_index(feed->new_news, i))->keep = false;
+            g_ptr_array_free(feed->new_news, true);
         }
+        feed->new_news = NULL;
+        feed->updated = false;
+
+        /* failed ones are tried again after the interval as well */
+        feed->next_due = feed_next_due(rss, feed, time(NULL));
+        feed_parser_free(feed->parser);
+        feed->parser = NULL;
+    }
+    g_free(transfers);
+
+    /* with many feeds one is due every few seconds, most are unchanged */
+    if (changed)
+        rss_collect_news(rss);
+
+    /* free the items that have gone, the others have been taken over */
+    for (nf = 0; nf < n; nf++) {
+        for (i = 0; old[nf] && i < old[nf]->len; i++) {
+            struct newsitem *item = g_ptr_array_index(old[nf], i);
 
-end_loop:
-        if (data_cur)
-            mrss_free(data_cur);
+            if (item->keep)
+                item->keep = false;
+            else
+                free_newsitem(item);
+        }
+        if (old[nf])
+            g_ptr_array_free(old[nf], true);
     }
+    g_free(old);
+
+    if (changed)
+        rss_check_alerts(rss, due, n);
+    rss_cache_save(rss, false);
+
+out:
+    g_free(due);
+}
+
+/* -------------------------------------------------------------------------- */
+static time_t rss_next_due(struct lcd_stuff_rss *rss)
+{
+    time_t next = time(NULL) + rss->max_interval;
+    unsigned int nf;
+
+    for (nf = 0; nf < rss->feeds->len; nf++) {
+        struct rss_feed *feed = g_ptr_array_index(rss->feeds, nf);
+
+        next = MIN(next, feed->next_due);
+    }
+
+    return next;
 }
 
 /* -------------------------------------------------------------------------- */
@@ -208,10 +957,13 @@ static void rss_key_handler(const char *str, void *cookie)
 {
     struct lcd_stuff_rss *rss = (struct lcd_stuff_rss *)cookie;
 
+    g_mutex_lock(rss->mutex);
+    mark_current_read(rss);
     if (strcmp(str, "Up") == 0)
         rss->current_screen++;
     else
         rss->current_screen--;
+    g_mutex_unlock(rss->mutex);
     update_screen_news(rss);
 }
 
@@ -220,7 +972,11 @@ static void rss_ignore_handler(void *cookie)
 {
     struct lcd_stuff_rss *rss = (struct lcd_stuff_rss *)cookie;
 
+    /* the item has been on the display */
+    g_mutex_lock(rss->mutex);
+    mark_current_read(rss);
     rss->current_screen++;
+    g_mutex_unlock(rss->mutex);
     update_screen_news(rss);
 }
 
@@ -231,13 +987,100 @@ static struct client rss_client = {
     .ignore_callback = rss_ignore_handler
 };
 
+/* -------------------------------------------------------------------------- */
+/*
+ * Takes @url and @name (Latin-1).
+ */
+static struct rss_feed *rss_add_feed(struct lcd_stuff_rss  *rss,
+                                     char                  *url,
+                                     char                  *name)
+{
+    struct rss_feed *feed;
+
+    if (g_hash_table_lookup(rss->feed_urls, url)) {
+        report(RPT_WARNING, MODULE_NAME ": Feed %s is configured twice", url);
+        g_free(url);
+        g_free(name);
+        return NULL;
+    }
+
+    feed = malloc(sizeof(struct rss_feed));
+    if (!feed) {
+        report(RPT_ERR, MODULE_NAME ": Out of memory");
+        g_free(url);
+        g_free(name);
+        return NULL;
+    }
+    memset(feed, 0, sizeof(struct rss_feed));
+
+    feed->url = url;
+    feed->name = name;
+    feed->name_marked = g_strdup_printf("*%s", feed->name);
+    feed->display = &rss->lcd->display_size;
+    feed->mutex = rss->mutex;
+
+    g_hash_table_insert(rss->feed_urls, feed->url, feed);
+    g_ptr_array_add(rss->feeds, feed);
+    feed->index = rss->feeds->len;
+
+    return feed;
+}
+
+/* -------------------------------------------------------------------------- */
+static void rss_add_opml_feed(const char *url, const char *name, void *cookie)
+{
+    struct lcd_stuff_rss *rss = (struct lcd_stuff_rss *)cookie;
+    struct rss_feed *feed;
+    char *name_l1;
+
+    name_l1 = g_convert_with_fallback(name, -1, "ISO-8859-1", "UTF-8", "?",
+                                      NULL, NULL, NULL);
+    feed = rss_add_feed(rss, g_strdup(url), name_l1 ? name_l1 : g_strdup(""));
+    if (feed)
+        feed->items = rss->items;
+}
+
+/* -------------------------------------------------------------------------- */
+/*
+ * Adds the keywords of @key (a list) for the feed with @index, or for all
+ * feeds if it's 0. Returns their number.
+ */
+static gsize rss_add_keywords(struct lcd_stuff_rss  *rss,
+                              const char            *key,
+                              unsigned int          index,
+                              enum rule_kind        kind)
+{
+    char  **keywords;
+    gsize n, i;
+
+    keywords = key_file_get_string_list(MODULE_NAME, key, &n);
+    for (i = 0; i < n; i++) {
+        char *keyword;
+
+        /* the headlines are Latin-1 */
+        keyword = g_convert_with_fallback(keywords[i], -1, "ISO-8859-1", "UTF-8",
+                                          "?", NULL, NULL, NULL);
+        matcher_add(rss->filter, keyword, index * RULE_KINDS + kind);
+        g_free(keyword);
+    }
+    g_strfreev(keywords);
+
+    return n;
+}
+
 /* -------------------------------------------------------------------------- */
 static bool rss_init(struct lcd_stuff_rss *rss)
 {
     int      i;
     int      number_of_feeds;
+    unsigned int nf;
+    bool     included;
     char     *tmp;
 
+    /* the key handler shows them */
+    rss->mutex = g_mutex_new();
+    rss->news = g_ptr_array_new();
+
     /* register client */
     service_thread_register_client(rss->lcd->service_thread, &rss_client, rss);
 
@@ -250,37 +1093,91 @@ static bool rss_init(struct lcd_stuff_rss *rss)
 
     /* get config items */
     rss->interval = key_file_get_integer_default(MODULE_NAME, "interval", 1800);
+    rss->min_interval = key_file_get_integer_default(MODULE_NAME, "min_interval", 60);
+    rss->max_interval = key_file_get_integer_default(MODULE_NAME, "max_interval", 86400);
+    rss->max_interval = MAX(rss->max_interval, rss->min_interval);
+    rss->connections = key_file_get_integer_default(MODULE_NAME, "connections", 4);
+    rss->timeout = key_file_get_integer_default(MODULE_NAME, "timeout", 60);
+    rss->items = key_file_get_integer_default(MODULE_NAME, "items", 5);
+    rss->max_news = key_file_get_integer_default(MODULE_NAME, "max_news", 100);
+    rss->alert_time = key_file_get_integer_default(MODULE_NAME, "alert_time", 60);
+
+    /* the keywords of all feeds go into one matcher */
+    rss->filter = matcher_new();
+    included = rss_add_keywords(rss, "include", 0, RULE_INCLUDE) > 0;
+    rss_add_keywords(rss, "exclude", 0, RULE_EXCLUDE);
+    rss_add_keywords(rss, "alert", 0, RULE_ALERT);
+
+    tmp = cache_dir_get(MODULE_NAME, MODULE_NAME);
+    if (tmp)
+        rss->cache_file = g_build_filename(tmp, CACHE_FILE, NULL);
+    g_free(tmp);
 
     number_of_feeds = key_file_get_integer_default(MODULE_NAME, "number_of_feeds", 0);
-    if (number_of_feeds == 0) {
-        report(RPT_ERR, MODULE_NAME ": No feed sources specified");
-        return false;
-    }
 
-    /* create the linked list of mailboxes */
     rss->feeds = g_ptr_array_sized_new(number_of_feeds);
+    rss->feed_urls = g_hash_table_new(g_str_hash, g_str_equal);
 
-    /* process the mailboxes */
+    /* process the feeds */
     for (i = 1; i <= number_of_feeds; i++) {
-        struct rss_feed *cur = malloc(sizeof(struct rss_feed));
-        if (!cur) {
-            report(RPT_ERR, MODULE_NAME ": Out of memory");
-            return false;
-        }
+        struct rss_feed *cur;
+        char *url, *name;
 
         tmp = g_strdup_printf("url%d", i);
-        cur->url = key_file_get_string_default(MODULE_NAME, tmp, "");
+        url = key_file_get_string_default(MODULE_NAME, tmp, "");
         g_free(tmp);
 
         tmp = g_strdup_printf("name%d", i);
-        cur->name = key_file_get_string_default_l1(MODULE_NAME, tmp, "");
+        name = key_file_get_string_default_l1(MODULE_NAME, tmp, "");
         g_free(tmp);
 
+        cur = rss_add_feed(rss, url, name);
+        if (!cur)
+            continue;
+
         tmp = g_strdup_printf("items%d", i);
-        cur->items = key_file_get_integer_default(MODULE_NAME, tmp, 0);
+        cur->items = key_file_get_integer_default(MODULE_NAME, tmp, rss->items);
+        g_free(tmp);
+
+        tmp = g_strdup_printf("interval%d", i);
+        cur->interval = key_file_get_integer_default(MODULE_NAME, tmp, 0);
         g_free(tmp);
 
-        g_ptr_array_add(rss->feeds, cur);
+        tmp = g_strdup_printf("include%d", i);
+        cur->included = rss_add_keywords(rss, tmp, cur->index, RULE_INCLUDE) > 0;
+        g_free(tmp);
+
+        tmp = g_strdup_printf("exclude%d", i);
+        rss_add_keywords(rss, tmp, cur->index, RULE_EXCLUDE);
+        g_free(tmp);
+
+        tmp = g_strdup_printf("alert%d", i);
+        rss_add_keywords(rss, tmp, cur->index, RULE_ALERT);
+        g_free(tmp);
+    }
+
+    /* the subscriptions of a feed reader */
+    tmp = key_file_get_string_default(MODULE_NAME, "opml", "");
+    if (*tmp)
+        opml_read(tmp, rss_add_opml_feed, rss);
+    g_free(tmp);
+
+    if (rss->feeds->len == 0) {
+        report(RPT_ERR, MODULE_NAME ": No feed sources specified");
+        return false;
+    }
+
+    if (matcher_is_empty(rss->filter)) {
+        matcher_free(rss->filter);
+        rss->filter = NULL;
+    } else
+        matcher_compile(rss->filter);
+
+    for (nf = 0; nf < rss->feeds->len; nf++) {
+        struct rss_feed *feed = g_ptr_array_index(rss->feeds, nf);
+
+        feed->filter = rss->filter;
+        feed->included = feed->included || included;
     }
 
     return true;
@@ -297,7 +1194,13 @@ void *rss_run(void *cookie)
     rss.lcd = (struct lcd_stuff *)cookie;
     rss.interval = 0;
     rss.feeds = NULL;
+    rss.feed_urls = NULL;
     rss.news = NULL;
+    rss.mutex = NULL;
+    rss.cache_file = NULL;
+    rss.cache_saved = 0;
+    rss.filter = NULL;
+    rss.alert_until = 0;
     rss.current_screen = 0;
 
     result = key_file_has_group(MODULE_NAME);
@@ -313,32 +1216,50 @@ void *rss_run(void *cookie)
     }
     conf_dec_count();
 
-    /* check mails instantly */
-    next_check = time(NULL);
+    /* show the cached news, and check the stale feeds instantly */
+    rss_cache_load(&rss);
+    update_screen_news(&rss);
+    next_check = rss_next_due(&rss);
 
     /* dispatcher */
     while (!g_exit) {
         g_usleep(1000000);
 
-        /* check emails? */
-        if (time(NULL) > next_check) {
+        /* check feeds? */
+        if (time(NULL) >= next_check) {
             rss_check(&rss);
             update_screen_news(&rss);
-            next_check = time(NULL) + rss.interval;
+            next_check = rss_next_due(&rss);
+        }
+
+        /* back to normal after an alert */
+        if (rss.alert_until != 0 && time(NULL) >= rss.alert_until) {
+            screen_set_priority(&rss.screen, "info");
+            rss.alert_until = 0;
         }
     }
 
     service_thread_unregister_client(rss.lcd->service_thread, MODULE_NAME);
 
+    /* what was fetched since the last save */
+    rss_cache_save(&rss, true);
+
     for (i = 0; i < rss.feeds->len; i++) {
         struct rss_feed *cur = (struct rss_feed *)g_ptr_array_index(rss.feeds, i);
+        free_news(cur->news);
+        http_validator_clear(&cur->validator);
         g_free(cur->url);
         g_free(cur->name);
+        g_free(cur->name_marked);
         free(cur);
     }
     g_ptr_array_free(rss.feeds, true);
+    g_hash_table_destroy(rss.feed_urls);
+    matcher_free(rss.filter);
 
-    free_news(&rss);
+    g_ptr_array_free(rss.news, true);
+    g_mutex_free(rss.mutex);
+    g_free(rss.cache_file);
     screen_destroy(&rss.screen);
 
     return NULL;
@@ -32,8 +32,12 @@
 #include <glib.h>
 #include <glib/gstdio.h>
 
+#include <shared/report.h>
+
 #include "util.h"
 #include "global.h"
+#include "keyfile.h"
+#include "constants.h"
 
 /* ---------------------- static variables ---------------------------------- */
 static char s_valid_chars[256];
@@ -288,4 +292,29 @@ bool starts_with(const char *string, const char *start)
         return strncmp(string, start, strlen(start)) == 0;
 }
 
+/* -------------------------------------------------------------------------- */
+char *cache_dir_get(const char *group, const char *name)
+{
+    char *base;
+    char *dir;
+
+    base = key_file_get_string_default(group, "cache_directory", DEFAULT_CACHE_DIR);
+    if (strlen(base) == 0) {
+        g_free(base);
+        return NULL;
+    }
+
+    dir = g_build_filename(base, name, NULL);
+    g_free(base);
+
+    if (g_mkdir_with_parents(dir, 0700) != 0) {
+        report(RPT_WARNING, "Cannot create cache directory %s (%s), caching disabled",
+               dir, strerror(errno));
+        g_free(dir);
+        return NULL;
+    }
+
+    return dir;
+}
+
 /* vim: set ts=4 sw=4 et: */
@@ -34,6 +34,12 @@ char *stringbuffer_get_line(GString *buffer, int line);
 int stringbuffer_get_lines(GString *buffer);
 bool starts_with(const char *string, const char *start);
 
+/*
+ * cache functions -------------------------------------------------------------
+ */
+
+char *cache_dir_get(const char *group, const char *name);
+
 #endif /* UTIL_H */
 
 /* vim: set ts=4 sw=4 et: */
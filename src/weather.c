@@ -33,9 +33,13 @@
 #include "weatherlib.h"
 #include "keyfile.h"
 #include "screen.h"
+#include "util.h"
 
 /* ---------------------- constants ----------------------------------------- */
 #define MODULE_NAME           "weather"
+#define CACHE_FILE            "current"
+#define RETRY_SEC             300
+#define MAX_TITLE_LEN         64
 
 /* ---------------------- types --------------------------------------------- */
 struct lcd_stuff_weather {
@@ -44,39 +48,175 @@ struct lcd_stuff_weather {
     char                city[MAX_CITYCODE_LEN];
     enum unit           unit;
     struct screen       screen;
+    char                title[MAX_TITLE_LEN];
+    int                 stale;          /* seconds after which data is old */
+    char                *cache_file;    /* NULL if disabled */
+    struct weather_data data;           /* last good data */
+    time_t              data_time;      /* 0 if there is no data */
+    int                 shown_age;      /* in the title, -1 for none */
 };
 
 /* -------------------------------------------------------------------------- */
-static void weather_update(struct lcd_stuff_weather *weather)
+static void weather_show(struct lcd_stuff_weather *weather)
 {
     char *line1 = NULL, *line2 = NULL, *line3 = NULL;
+    struct weather_data *data = &weather->data;
+
+    line1 = g_strdup_printf("%s", data->weather);
+    if (weather->lcd->display_size.height >= 3) {
+        line2 = g_strdup_printf("%d%s (%d%s)  %.1f%s",
+                                data->temp_c, get_unit_for_type(weather->unit, TYPE_TEMPERATURE),
+                                data->temp_fl_c, get_unit_for_type(weather->unit, TYPE_TEMPERATURE),
+                                data->pressure_hPa, get_unit_for_type(weather->unit, TYPE_PRESSURE));
+        line3 = g_strdup_printf("%d%s  %d%s %s",
+                                data->humid, get_unit_for_type(weather->unit, TYPE_HUMIDITY),
+                                data->wind_speed, get_unit_for_type(weather->unit, TYPE_WINDSPEED),
+                                data->wind_dir);
+    } else {
+        line2 = g_strdup_printf("%d%s %d%s  %d%s %s",
+                                data->temp_c, get_unit_for_type(weather->unit, TYPE_TEMPERATURE),
+                                data->humid, get_unit_for_type(weather->unit, TYPE_HUMIDITY),
+                                data->wind_speed, get_unit_for_type(weather->unit, TYPE_WINDSPEED),
+                                data->wind_dir);
+    }
+    screen_show_text(&weather->screen, 0, line1);
+    screen_show_text(&weather->screen, 1, line2);
+    screen_show_text(&weather->screen, 2, line3);
+    g_free(line1);
+    g_free(line2);
+    g_free(line3);
+}
+
+/* -------------------------------------------------------------------------- */
+/*
+ * Marks old data by its age in the title, in hours (or days). The title is
+ * only sent when the age changes.
+ */
+static void weather_show_age(struct lcd_stuff_weather *weather)
+{
+    int age = -1;
+    time_t now = time(NULL);
+
+    if (weather->data_time != 0 && now - weather->data_time > weather->stale)
+        age = (now - weather->data_time) / 3600;
+
+    if (age == weather->shown_age)
+        return;
+    weather->shown_age = age;
+
+    if (age < 0)
+        screen_set_title(&weather->screen, weather->title);
+    else if (age < 48)
+        screen_set_title_format(&weather->screen, "%s (%dh)", weather->title, age);
+    else
+        screen_set_title_format(&weather->screen, "%s (%dd)", weather->title, age / 24);
+}
+
+/* -------------------------------------------------------------------------- */
+static void weather_cache_save(struct lcd_stuff_weather *weather)
+{
+    GKeyFile *cache;
+    GError   *err = NULL;
+    char     *data;
+    gsize    len;
+
+    if (!weather->cache_file)
+        return;
+
+    cache = g_key_file_new();
+    g_key_file_set_string(cache, MODULE_NAME, "citycode", weather->city);
+    g_key_file_set_integer(cache, MODULE_NAME, "unit", weather->unit);
+    g_key_file_set_int64(cache, MODULE_NAME, "time", weather->data_time);
+    g_key_file_set_integer(cache, MODULE_NAME, "temp", weather->data.temp_c);
+    g_key_file_set_integer(cache, MODULE_NAME, "temp_fl", weather->data.temp_fl_c);
+    g_key_file_set_integer(cache, MODULE_NAME, "humid", weather->data.humid);
+    g_key_file_set_double(cache, MODULE_NAME, "pressure", weather->data.pressure_hPa);
+    g_key_file_set_string(cache, MODULE_NAME, "weather", weather->data.weather);
+    g_key_file_set_string(cache, MODULE_NAME, "wind_dir", weather->data.wind_dir);
+    g_key_file_set_integer(cache, MODULE_NAME, "wind_speed", weather->data.wind_speed);
+
+    /* written atomically */
+    data = g_key_file_to_data(cache, &len, NULL);
+    if (!g_file_set_contents(weather->cache_file, data, len, &err)) {
+        report(RPT_WARNING, MODULE_NAME ": Cannot write %s: %s", weather->cache_file,
+               err->message);
+        g_error_free(err);
+    }
+
+    g_free(data);
+    g_key_file_free(cache);
+}
+
+/* -------------------------------------------------------------------------- */
+/*
+ * Restores the data from before the restart if it is for the same city in
+ * the same units.
+ */
+static void weather_cache_load(struct lcd_stuff_weather *weather)
+{
+    GKeyFile *cache;
+    char     *tmp;
+    bool     same;
+
+    if (!weather->cache_file)
+        return;
+
+    cache = g_key_file_new();
+    if (!g_key_file_load_from_file(cache, weather->cache_file, G_KEY_FILE_NONE, NULL))
+        goto out;
+
+    tmp = g_key_file_get_string(cache, MODULE_NAME, "citycode", NULL);
+    same = tmp && strcmp(tmp, weather->city) == 0 &&
+        g_key_file_get_integer(cache, MODULE_NAME, "unit", NULL) == (int)weather->unit;
+    g_free(tmp);
+    if (!same)
+        goto out;
+
+    weather->data.temp_c = g_key_file_get_integer(cache, MODULE_NAME, "temp", NULL);
+    weather->data.temp_fl_c = g_key_file_get_integer(cache, MODULE_NAME, "temp_fl", NULL);
+    weather->data.humid = g_key_file_get_integer(cache, MODULE_NAME, "humid", NULL);
+    weather->data.pressure_hPa = g_key_file_get_double(cache, MODULE_NAME, "pressure", NULL);
+    weather->data.wind_speed = g_key_file_get_integer(cache, MODULE_NAME, "wind_speed", NULL);
+
+    tmp = g_key_file_get_string(cache, MODULE_NAME, "weather", NULL);
+    if (tmp) {
+        g_strlcpy(weather->data.weather, tmp, MAX_WEATHER_LEN);
+        g_free(tmp);
+    }
+    tmp = g_key_file_get_string(cache, MODULE_NAME, "wind_dir", NULL);
+    if (tmp) {
+        g_strlcpy(weather->data.wind_dir, tmp, MAX_WIND_LEN);
+        g_free(tmp);
+    }
+
+    weather->data_time = g_key_file_get_int64(cache, MODULE_NAME, "time", NULL);
+
+out:
+    g_key_file_free(cache);
+}
+
+/* -------------------------------------------------------------------------- */
+/*
+ * Returns the time of the next update. While it runs and when it fails, the
+ * last good data stays on the screen.
+ */
+static time_t weather_update(struct lcd_stuff_weather *weather)
+{
     struct weather_data data;
 
-    if (retrieve_weather_data(weather->city, &data, weather->unit) == 0) {
-        line1 = g_strdup_printf("%s", data.weather);
-        if (weather->lcd->display_size.height >= 3) {
-            line2 = g_strdup_printf("%d%s (%d%s)  %.1f%s",
-                                    data.temp_c, get_unit_for_type(weather->unit, TYPE_TEMPERATURE),
-                                    data.temp_fl_c, get_unit_for_type(weather->unit, TYPE_TEMPERATURE),
-                                    data.pressure_hPa, get_unit_for_type(weather->unit, TYPE_PRESSURE));
-            line3 = g_strdup_printf("%d%s  %d%s %s",
-                                    data.humid, get_unit_for_type(weather->unit, TYPE_HUMIDITY),
-                                    data.wind_speed, get_unit_for_type(weather->unit, TYPE_WINDSPEED),
-                                    data.wind_dir);
-        } else {
-            line2 = g_strdup_printf("%d%s %d%s  %d%s %s",
-                                    data.temp_c, get_unit_for_type(weather->unit, TYPE_TEMPERATURE),
-                                    data.humid, get_unit_for_type(weather->unit, TYPE_HUMIDITY),
-                                    data.wind_speed, get_unit_for_type(weather->unit, TYPE_WINDSPEED),
-                                    data.wind_dir);
-        }
-        screen_show_text(&weather->screen, 0, line1);
-        screen_show_text(&weather->screen, 1, line2);
-        screen_show_text(&weather->screen, 2, line3);
-        g_free(line1);
-        g_free(line2);
-        g_free(line3);
+    memset(&data, 0, sizeof(data));
+    if (retrieve_weather_data(weather->city, &data, weather->unit) != 0) {
+        weather_show_age(weather);
+        return time(NULL) + MIN(weather->interval, RETRY_SEC);
     }
+
+    weather->data = data;
+    weather->data_time = time(NULL);
+    weather_show(weather);
+    weather_show_age(weather);
+    weather_cache_save(weather);
+
+    return weather->data_time + weather->interval;
 }
 
 /* -------------------------------------------------------------------------- */
@@ -102,11 +242,14 @@ static bool weather_init(struct lcd_stuff_weather *weather)
 
     /* add the title */
     tmp = key_file_get_string_default_l1(MODULE_NAME, "name", "Weather");
-    screen_set_title(&weather->screen, tmp);
+    g_strlcpy(weather->title, tmp, MAX_TITLE_LEN);
+    screen_set_title(&weather->screen, weather->title);
     g_free(tmp);
 
     /* get config items */
     weather->interval = key_file_get_integer_default(MODULE_NAME, "interval", 3600);
+    weather->stale = key_file_get_integer_default(MODULE_NAME, "stale",
+                                                  3 * weather->interval);
     tmp = key_file_get_string_default(MODULE_NAME, "citycode", "");
     strncpy(weather->city, tmp, MAX_CITYCODE_LEN);
     g_free(tmp);
@@ -118,6 +261,11 @@ static bool weather_init(struct lcd_stuff_weather *weather)
         weather->unit = UNIT_IMPERIAL;
     g_free(tmp);
 
+    tmp = cache_dir_get(MODULE_NAME, MODULE_NAME);
+    if (tmp)
+        weather->cache_file = g_build_filename(tmp, CACHE_FILE, NULL);
+    g_free(tmp);
+
     return true;
 }
 
@@ -133,6 +281,11 @@ void *weather_run(void *cookie)
     weather.interval = 0;
     weather.city[0] = '\0';
     weather.unit = UNIT_METRIC;
+    weather.stale = 0;
+    weather.cache_file = NULL;
+    memset(&weather.data, 0, sizeof(weather.data));
+    weather.data_time = 0;
+    weather.shown_age = -1;
 
     result = key_file_has_group(MODULE_NAME);
     if (!result) {
@@ -146,22 +299,29 @@ void *weather_run(void *cookie)
     }
     conf_dec_count();
 
-    /* check mails instantly */
+    /* show the cached data instantly, check only if it is not current */
     next_check = time(NULL);
+    weather_cache_load(&weather);
+    if (weather.data_time != 0) {
+        weather_show(&weather);
+        weather_show_age(&weather);
+        next_check = MAX(next_check, weather.data_time + weather.interval);
+    }
 
     /* dispatcher */
     while (!g_exit) {
         g_usleep(100000);
 
-        /* check emails? */
-        if (time(NULL) > next_check) {
-            weather_update(&weather);
-            next_check = time(NULL) + weather.interval;
-        }
+        /* check the weather? */
+        if (time(NULL) >= next_check)
+            next_check = weather_update(&weather);
+        else
+            weather_show_age(&weather);
     }
 
     service_thread_unregister_client(weather.lcd->service_thread, MODULE_NAME);
     screen_destroy(&weather.screen);
+    g_free(weather.cache_file);
 
     return NULL;
 }
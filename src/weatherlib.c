@@ -17,113 +17,244 @@
  */
 #include "weatherlib.h"
 
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+
 #include <glib.h>
-#include <nxml.h>
+#include <expat.h>
 
 #include <shared/report.h>
 
+#include "http.h"
+
 #define PARTNER_ID  "1135709469"
 #define LICENSE_KEY "ad4915c997bebd9c"
-#define WEATHER_URL ("http://xoap.weather.com/weather/local/%s?unit=%c&cc=*&par=" PARTNER_ID "&key=" LICENSE_KEY)
+/* the soak test points it at a local server */
+#ifndef WEATHER_URL
+#  define WEATHER_URL ("http://xoap.weather.com/weather/local/%s?unit=%c&cc=*&par=" PARTNER_ID "&key=" LICENSE_KEY)
+#endif
+#define MAX_URL_LEN         256
+#define TIMEOUT_SEC         60
+
+/*
+ * The values we need, with their path below the root element:
+ * cc/tmp, cc/flik, cc/hmid, cc/t, cc/bar/r, cc/wind/s and cc/wind/t.
+ */
+enum field {
+    FIELD_NONE,
+    FIELD_TMP,
+    FIELD_FLIK,
+    FIELD_HMID,
+    FIELD_T,
+    FIELD_BAR,
+    FIELD_BAR_R,
+    FIELD_WIND,
+    FIELD_WIND_S,
+    FIELD_WIND_T
+};
+
+/*
+ * Fills the weather data in one pass while the response is downloaded. Only
+ * the text of the element that is currently wanted is collected, in a
+ * fixed buffer.
+ */
+struct weather_extractor {
+    XML_Parser          parser;
+    struct weather_data *data;
+    int                 depth;          /* of the open element, root is 1 */
+    bool                in_cc;
+    bool                found;          /* cc has been seen */
+    bool                done;           /* cc is complete */
+    bool                error;          /* not well-formed */
+    enum field          group;          /* the open child of cc */
+    enum field          field;          /* the element whose text we want */
+    char                text[MAX_WEATHER_LEN];
+    size_t              len;
+};
+
+/* -------------------------------------------------------------------------- */
+static enum field cc_child(const char *name)
+{
+    if (strcmp(name, "tmp") == 0)
+        return FIELD_TMP;
+    else if (strcmp(name, "flik") == 0)
+        return FIELD_FLIK;
+    else if (strcmp(name, "hmid") == 0)
+        return FIELD_HMID;
+    else if (strcmp(name, "t") == 0)
+        return FIELD_T;
+    else if (strcmp(name, "bar") == 0)
+        return FIELD_BAR;
+    else if (strcmp(name, "wind") == 0)
+        return FIELD_WIND;
+    else
+        return FIELD_NONE;
+}
+
+/* -------------------------------------------------------------------------- */
+static void start_element(void *cookie, const XML_Char *name, const XML_Char **atts)
+{
+    struct weather_extractor *ex = (struct weather_extractor *)cookie;
+
+    ex->depth++;
+
+    if (ex->depth == 2 && !ex->found && strcmp(name, "cc") == 0) {
+        ex->in_cc = true;
+        ex->found = true;
+    } else if (ex->in_cc && ex->depth == 3) {
+        ex->group = cc_child(name);
+        if (ex->group != FIELD_BAR && ex->group != FIELD_WIND)
+            ex->field = ex->group;
+    } else if (ex->in_cc && ex->depth == 4) {
+        if (ex->group == FIELD_BAR && strcmp(name, "r") == 0)
+            ex->field = FIELD_BAR_R;
+        else if (ex->group == FIELD_WIND && strcmp(name, "s") == 0)
+            ex->field = FIELD_WIND_S;
+        else if (ex->group == FIELD_WIND && strcmp(name, "t") == 0)
+            ex->field = FIELD_WIND_T;
+    }
+
+    ex->len = 0;
+}
+
+/* -------------------------------------------------------------------------- */
+static void store_field(struct weather_extractor *ex)
+{
+    struct weather_data *data = ex->data;
+
+    ex->text[ex->len] = 0;
+
+    switch (ex->field) {
+        case FIELD_TMP:
+            data->temp_c = atoi(ex->text);
+            break;
+        case FIELD_FLIK:
+            data->temp_fl_c = atoi(ex->text);
+            break;
+        case FIELD_HMID:
+            data->humid = atoi(ex->text);
+            break;
+        case FIELD_T:
+            g_strlcpy(data->weather, ex->text, MAX_WEATHER_LEN);
+            break;
+        case FIELD_BAR_R:
+            data->pressure_hPa = atof(ex->text);
+            break;
+        case FIELD_WIND_S:
+            data->wind_speed = atoi(ex->text);
+            break;
+        case FIELD_WIND_T:
+            g_strlcpy(data->wind_dir, ex->text, MAX_WIND_LEN);
+            break;
+        default:
+            break;
+    }
+}
+
+/* -------------------------------------------------------------------------- */
+static void end_element(void *cookie, const XML_Char *name)
+{
+    struct weather_extractor *ex = (struct weather_extractor *)cookie;
+
+    /* the wanted elements have no children */
+    if (ex->field != FIELD_NONE) {
+        store_field(ex);
+        ex->field = FIELD_NONE;
+    }
+
+    if (ex->in_cc && ex->depth == 3)
+        ex->group = FIELD_NONE;
+    else if (ex->in_cc && ex->depth == 2) {
+        ex->in_cc = false;
+        ex->done = true;
+    }
+
+    ex->depth--;
+}
+
+/* -------------------------------------------------------------------------- */
+static void character_data(void *cookie, const XML_Char *s, int len)
+{
+    struct weather_extractor *ex = (struct weather_extractor *)cookie;
+    size_t n;
+
+    if (ex->field == FIELD_NONE)
+        return;
+
+    n = MIN((size_t)len, sizeof(ex->text) - 1 - ex->len);
+    memcpy(ex->text + ex->len, s, n);
+    ex->len += n;
+}
+
+/* -------------------------------------------------------------------------- */
+static bool weather_data_received(struct http_transfer *transfer, const char *data, size_t len)
+{
+    struct weather_extractor *ex = (struct weather_extractor *)transfer->cookie;
+
+    if (XML_Parse(ex->parser, data, len, false) == XML_STATUS_ERROR) {
+        ex->error = true;
+        return false;
+    }
+
+    /* the rest of the document is not needed */
+    return !ex->done;
+}
 
 /* -------------------------------------------------------------------------- */
 int retrieve_weather_data(const char            *code,
                           struct weather_data   *data,
                           enum unit             unit)
 {
-     nxml_t *nxml;
-     nxml_data_t *element, *cc;
-     char *url;
-     char *string;
-     nxml_error_t err;
-
-     if (!data)
-         return -EINVAL;
-
-     url = g_strdup_printf(WEATHER_URL, code, unit == UNIT_IMPERIAL ? 'i' : 'm');
-
-     nxml_new(&nxml);
-     if (nxml_parse_url(nxml, url) != NXML_OK)
-         return -1;
-     nxml_root_element(nxml, &element);
-
-     if (nxml_find_element(nxml, element, "cc", &cc) == NXML_OK && cc) {
-         /* temperatur */
-         if (nxml_find_element(nxml, cc, "tmp", &element) == NXML_OK && element) {
-             string = nxmle_get_string(element, &err);
-             if (err == NXML_OK) {
-                 data->temp_c = atoi(string);
-                 free(string);
-             }
-         }
-
-         /* temperature feels like */
-         if (nxml_find_element(nxml, cc, "flik", &element) == NXML_OK && element) {
-             string = nxmle_get_string(element, &err);
-             if (err == NXML_OK) {
-                 data->temp_fl_c = atoi(string);
-                 free(string);
-             }
-         }
-
-         /* humidity */
-         if (nxml_find_element(nxml, cc, "hmid", &element) == NXML_OK && element) {
-             string = nxmle_get_string(element, &err);
-             if (err == NXML_OK) {
-                 data->humid = atoi(string);
-                 free(string);
-             }
-         }
-
-         /* weather */
-         if (nxml_find_element(nxml, cc, "t", &element) == NXML_OK && element) {
-             string = nxmle_get_string(element, &err);
-             if (err == NXML_OK) {
-                 strncpy(data->weather, string, MAX_WEATHER_LEN);
-                 data->weather[MAX_WEATHER_LEN-1] = 0;
-                 free(string);
-             }
-         }
-
-         /* pressure */
-         if (nxml_find_element(nxml, cc, "bar", &element) == NXML_OK && element &&
-                nxml_find_element(nxml, element, "r", &element) == NXML_OK && element) {
-             string = nxmle_get_string(element, &err);
-             if (err == NXML_OK) {
-                 data->pressure_hPa = atof(string);
-                 free(string);
-             }
-         }
-
-         /* wind speed */
-         if (nxml_find_element(nxml, cc, "wind", &element) == NXML_OK && element &&
-                nxml_find_element(nxml, element, "s", &element) == NXML_OK && element) {
-             string = nxmle_get_string(element, &err);
-             if (err == NXML_OK) {
-                 data->wind_speed = atoi(string);
-                 free(string);
-             }
-         }
-
-         /* wind direction */
-         if (nxml_find_element(nxml, cc, "wind", &element) == NXML_OK && element &&
-                nxml_find_element(nxml, element, "t", &element) == NXML_OK && element) {
-             string = nxmle_get_string(element, &err);
-             if (err == NXML_OK) {
-                 strncpy(data->wind_dir, string, MAX_WIND_LEN);
-                 data->wind_dir[MAX_WIND_LEN-1] = 0;
-                 free(string);
-             }
-         }
-     } else {
-         report(RPT_ERR, "URL (%s) does not contain valid weather data", url);
-         return -1;
-     }
-
-     nxml_free(nxml);
-     g_free(url);
-
-     return 0;
+    struct weather_extractor ex;
+    struct http_transfer transfer;
+    char url[MAX_URL_LEN];
+    int ret = 0;
+
+    if (!data)
+        return -EINVAL;
+
+    g_snprintf(url, sizeof(url), WEATHER_URL, code, unit == UNIT_IMPERIAL ? 'i' : 'm');
+
+    memset(&ex, 0, sizeof(ex));
+    ex.data = data;
+    ex.parser = XML_ParserCreate(NULL);
+    XML_SetUserData(ex.parser, &ex);
+    XML_SetElementHandler(ex.parser, start_element, end_element);
+    XML_SetCharacterDataHandler(ex.parser, character_data);
+
+    /* parsed while it arrives, with the connections of the shared client */
+    memset(&transfer, 0, sizeof(transfer));
+    transfer.url = url;
+    transfer.data = weather_data_received;
+    transfer.result = HTTP_ERROR;
+    transfer.cookie = &ex;
+    http_get_all(&transfer, 1, 1, TIMEOUT_SEC, NULL);
+
+    if (transfer.result != HTTP_MODIFIED) {
+        ret = -1;
+        goto out;
+    }
+
+    if (!ex.done && !ex.error &&
+            XML_Parse(ex.parser, NULL, 0, true) == XML_STATUS_ERROR)
+        ex.error = true;
+
+    if (ex.error) {
+        report(RPT_ERR, "Error parsing %s in line %lu: %s", url,
+               (unsigned long)XML_GetCurrentLineNumber(ex.parser),
+               XML_ErrorString(XML_GetErrorCode(ex.parser)));
+        ret = -1;
+    } else if (!ex.found) {
+        report(RPT_ERR, "URL (%s) does not contain valid weather data", url);
+        ret = -1;
+    }
+
+out:
+    XML_ParserFree(ex.parser);
+
+    return ret;
 }
 
 static char *units[UNIT_MAXLEN][TYPE_MAXLEN] = {
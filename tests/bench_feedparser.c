@@ -0,0 +1,222 @@
+/*
+ * This file is part of lcd-stuff.
+ *
+ * lcd-stuff is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License.
+ *
+ * lcd-stuff is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with lcd-stuff; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+/*
+ * Compares the streaming feed parser with libmrss (if it was found by
+ * cmake) on a large generated RSS 2.0 feed with full HTML content, like
+ * the feeds of news sites.
+ *
+ * Usage: bench_feedparser [items [runs [max_items]]]
+ *
+ * The feed is passed in pieces of 16 KiB, as curl delivers it. For each
+ * parser, the time per feed and the heap that the parsed feed holds are
+ * printed. Each item also has an itunes:title and a media:title, which
+ * must not replace the headline.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+
+#include <glib.h>
+#if HAVE_MRSS
+#  include <mrss.h>
+#endif
+
+#include "feedparser.h"
+#include "testutil.h"
+
+/* ---------------------- constants ----------------------------------------- */
+#define DEFAULT_ITEMS       500
+#define DEFAULT_RUNS        20
+#define DEFAULT_MAX_ITEMS   5
+#define CHUNK_SIZE          16384
+
+/* ---------------------- types --------------------------------------------- */
+struct result {
+    double          ms;
+    size_t          heap;
+    size_t          bytes;          /* of the feed that were parsed */
+    unsigned int    items;
+    unsigned int    headlines;      /* items with the title of <title> */
+};
+
+/* -------------------------------------------------------------------------- */
+static GString *make_feed(unsigned int items)
+{
+    GString *feed = g_string_sized_new(items * 4096);
+    unsigned int i, p;
+
+    g_string_append(feed,
+            "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n"
+            "<rss version=\"2.0\" xmlns:content=\"http://purl.org/rss/1.0/modules/content/\"\n"
+            "     xmlns:itunes=\"http://www.itunes.com/dtds/podcast-1.0.dtd\"\n"
+            "     xmlns:media=\"http://search.yahoo.com/mrss/\">\n"
+            "<channel>\n"
+            "<title>Benchmark News</title>\n"
+            "<link>http://www.example.org/</link>\n"
+            "<description>Generated feed</description>\n"
+            "<ttl>30</ttl>\n");
+
+    for (i = 0; i < items; i++) {
+        g_string_append_printf(feed,
+                "<item>\n"
+                "<title>Headline number %u: something happened somewhere</title>\n"
+                "<itunes:title>Episode %u</itunes:title>\n"
+                "<link>http://www.example.org/news/%u.html</link>\n"
+                "<guid isPermaLink=\"false\">news-%u</guid>\n"
+                "<pubDate>Mon, %02u Nov 2010 %02u:%02u:00 +0100</pubDate>\n"
+                "<description><![CDATA[<p>",
+                items - i, items - i, items - i, items - i, 1 + i % 28, i % 24, i % 60);
+        for (p = 0; p < 8; p++)
+            g_string_append(feed, "The teaser of the article, with <b>markup</b> "
+                                  "and <a href=\"http://www.example.org/\">links</a>. ");
+        g_string_append(feed, "</p>]]></description>\n<content:encoded><![CDATA[");
+        for (p = 0; p < 6; p++)
+            g_string_append(feed, "<p>A paragraph of the full article. It is "
+                                  "long enough to make the feed as big as the "
+                                  "ones of real news sites, &amp; has entities "
+                                  "and <i>inline</i> <em>markup</em>.</p>\n");
+        g_string_append(feed, "]]></content:encoded>\n"
+                              "<media:title>Video of the article</media:title>\n"
+                              "</item>\n");
+    }
+
+    g_string_append(feed, "</channel>\n</rss>\n");
+
+    return feed;
+}
+
+/* -------------------------------------------------------------------------- */
+static void run_feedparser(GString *feed, unsigned int max_items, struct result *r)
+{
+    struct feed_parser *parser;
+    GPtrArray *items;
+    size_t heap = test_heap_in_use(), pos;
+    double start = test_time_ms();
+    unsigned int i;
+
+    parser = feed_parser_new(max_items);
+    for (pos = 0; pos < feed->len; pos += CHUNK_SIZE) {
+        size_t len = MIN(CHUNK_SIZE, feed->len - pos);
+
+        if (!feed_parser_parse(parser, feed->str + pos, len)) {
+            pos += len;
+            break;
+        }
+    }
+    items = feed_parser_finish(parser);
+
+    r->ms += test_time_ms() - start;
+    r->heap = test_heap_in_use() - heap;
+    r->bytes = MIN(pos, feed->len);
+    r->items = items ? items->len : 0;
+    r->headlines = 0;
+    for (i = 0; i < r->items; i++) {
+        struct feed_item *item = (struct feed_item *)g_ptr_array_index(items, i);
+
+        if (g_str_has_prefix(item->title, "Headline number "))
+            r->headlines++;
+    }
+
+    feed_parser_free(parser);
+}
+
+#if HAVE_MRSS
+
+/* -------------------------------------------------------------------------- */
+static void run_mrss(GString *feed, struct result *r)
+{
+    mrss_t *mrss = NULL;
+    mrss_item_t *item;
+    size_t heap = test_heap_in_use();
+    double start = test_time_ms();
+
+    /* mrss wants the whole document, like mrss_parse_url() */
+    if (mrss_parse_buffer(feed->str, feed->len, &mrss) != MRSS_OK) {
+        fprintf(stderr, "mrss_parse_buffer() failed\n");
+        exit(EXIT_FAILURE);
+    }
+
+    r->ms += test_time_ms() - start;
+    r->heap = test_heap_in_use() - heap;
+    r->bytes = feed->len;
+    r->items = 0;
+    for (item = mrss->item; item; item = item->next)
+        r->items++;
+
+    mrss_free(mrss);
+}
+
+#endif
+
+/* -------------------------------------------------------------------------- */
+static void print_result(const char *name, const struct result *r, unsigned int runs)
+{
+    printf("%-22s %8.2f ms %8zu KiB held %8zu KiB parsed %4u items\n",
+           name, r->ms / runs, r->heap / 1024, r->bytes / 1024, r->items);
+}
+
+/* -------------------------------------------------------------------------- */
+int main(int argc, char *argv[])
+{
+    unsigned int items = argc > 1 ? atoi(argv[1]) : DEFAULT_ITEMS;
+    unsigned int runs = argc > 2 ? atoi(argv[2]) : DEFAULT_RUNS;
+    unsigned int max_items = argc > 3 ? atoi(argv[3]) : DEFAULT_MAX_ITEMS;
+    struct result first = { 0 }, all = { 0 };
+    GString *feed;
+    unsigned int i;
+    char *name;
+
+    if (runs == 0)
+        return EXIT_FAILURE;
+
+    feed = make_feed(items);
+    printf("RSS 2.0 feed with %u items, %zu KiB, average of %u runs\n\n",
+           items, feed->len / 1024, runs);
+
+    for (i = 0; i < runs; i++) {
+        run_feedparser(feed, max_items, &first);
+        run_feedparser(feed, 0, &all);
+    }
+    name = g_strdup_printf("feedparser, %u items:", max_items);
+    print_result(name, &first, runs);
+    print_result("feedparser, all items:", &all, runs);
+    g_free(name);
+
+#if HAVE_MRSS
+    {
+        struct result mrss = { 0 };
+
+        for (i = 0; i < runs; i++)
+            run_mrss(feed, &mrss);
+        print_result("mrss:", &mrss, runs);
+    }
+#else
+    printf("mrss:                  not found by cmake\n");
+#endif
+
+    g_string_free(feed, true);
+
+    if (first.headlines != first.items || all.headlines != all.items)
+        printf("\nWrong titles: %u of %u and %u of %u items have the headline\n",
+               first.headlines, first.items, all.headlines, all.items);
+
+    return all.items == items && all.headlines == items ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+/* vim: set ts=4 sw=4 et: */
@@ -0,0 +1,198 @@
+/*
+ * This file is part of lcd-stuff.
+ *
+ * lcd-stuff is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License.
+ *
+ * lcd-stuff is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with lcd-stuff; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+/*
+ * Compares the native maildir scanner with the libetpan maildir driver on a
+ * generated maildir.
+ *
+ * Usage: bench_maildir [messages [unseen_percent]]
+ *
+ * The maildir is created in $TMPDIR and removed afterwards. The libetpan
+ * driver runs last because it moves the messages from new/ to cur/.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <glib.h>
+#include <libetpan/libetpan.h>
+
+#include "maildir.h"
+#include "maillib.h"
+#include "testutil.h"
+
+/* ---------------------- constants ----------------------------------------- */
+#define DEFAULT_MESSAGES    100000
+#define DEFAULT_UNSEEN      10
+#define BODY_LINES          40
+
+/* -------------------------------------------------------------------------- */
+static void write_message(const char *path, unsigned int i, bool seen)
+{
+    GString *msg = g_string_sized_new(4096);
+    const char *dir = seen || i % 2 ? "cur" : "new";
+    char *name;
+    int line;
+
+    g_string_append_printf(msg,
+            "Return-Path: <sender%u@example.org>\n"
+            "Received: from mx.example.org (mx.example.org [192.0.2.1])\n"
+            "\tby mail.example.com with ESMTP id %u\n"
+            "\tfor <user@example.com>; Mon, 1 Nov 2010 10:00:00 +0100\n"
+            "Message-ID: <%u@example.org>\n"
+            "Date: Mon, 1 Nov 2010 10:00:00 +0100\n"
+            "From: =?ISO-8859-1?Q?J=FCrgen_Sender_%u?= <sender%u@example.org>\n"
+            "To: user@example.com\n"
+            "Subject: Benchmark message number %u with a\n"
+            " folded subject line\n"
+            "MIME-Version: 1.0\n"
+            "Content-Type: text/plain; charset=ISO-8859-1\n"
+            "\n",
+            i, i, i, i, i, i);
+    for (line = 0; line < BODY_LINES; line++)
+        g_string_append(msg, "The body is never read by the scanner, only the "
+                             "header block is.\n");
+
+    /* seen messages have the S flag, unseen ones in cur/ have none */
+    if (strcmp(dir, "new") == 0)
+        name = g_strdup_printf("%s/new/%010u.M%uP1.bench", path, 1280000000 + i, i);
+    else
+        name = g_strdup_printf("%s/cur/%010u.M%uP1.bench:2,%s", path,
+                               1280000000 + i, i, seen ? "S" : "");
+
+    if (!g_file_set_contents(name, msg->str, msg->len, NULL)) {
+        fprintf(stderr, "Cannot write %s\n", name);
+        exit(EXIT_FAILURE);
+    }
+
+    g_free(name);
+    g_string_free(msg, true);
+}
+
+/* -------------------------------------------------------------------------- */
+static void count_message(const char *filename, const char *from,
+                          const char *subject, void *cookie)
+{
+    unsigned int *n = (unsigned int *)cookie;
+
+    if (from && subject)
+        (*n)++;
+}
+
+/* -------------------------------------------------------------------------- */
+static void bench_native(const char *path, unsigned int max_messages, bool headers)
+{
+    unsigned int total = 0, unseen = 0, read = 0;
+    double start = test_time_ms(), cpu = test_cpu_ms();
+
+    if (!maildir_scan(path, &total, &unseen, max_messages,
+                      headers ? count_message : NULL, &read)) {
+        fprintf(stderr, "maildir_scan() failed\n");
+        exit(EXIT_FAILURE);
+    }
+
+    printf("native, %-24s %6u total %6u unseen %6u headers %9.1f ms %9.1f ms CPU\n",
+           !headers ? "counts only:" : max_messages ? "newest 10 unseen:" : "all unseen:",
+           total, unseen, read, test_time_ms() - start, test_cpu_ms() - cpu);
+}
+
+/* -------------------------------------------------------------------------- */
+static void bench_libetpan(char *path)
+{
+    struct mailstorage *storage;
+    struct mailfolder *folder = NULL;
+    struct mailmessage_list *messages = NULL;
+    unsigned int total = 0, seen = 0, unseen = 0;
+    double start = test_time_ms(), cpu = test_cpu_ms(), status_ms = 0;
+    int r;
+
+    storage = mailstorage_new(NULL);
+    r = init_storage(storage, MAILDIR_STORAGE, NULL, 0, CONNECTION_TYPE_PLAIN,
+                     NULL, NULL, POP3_AUTH_TYPE_PLAIN, path, NULL, NULL);
+    if (r == MAIL_NO_ERROR) {
+        folder = mailfolder_new(storage, path, NULL);
+        r = folder ? mailfolder_connect(folder) : MAIL_ERROR_MEMORY;
+    }
+    if (r == MAIL_NO_ERROR)
+        r = mailfolder_status(folder, &total, &seen, &unseen);
+    status_ms = test_time_ms() - start;
+    if (r == MAIL_NO_ERROR)
+        r = mailfolder_get_messages_list(folder, &messages);
+    if (r == MAIL_NO_ERROR)
+        r = mailfolder_get_envelopes_list(folder, messages);
+
+    if (r != MAIL_NO_ERROR)
+        printf("libetpan: failed with error %d\n", r);
+    else {
+        printf("libetpan, status:         %6u total %6u unseen %23.1f ms\n",
+               total, unseen, status_ms);
+        printf("libetpan, all envelopes:  %6u total %6u unseen %6u headers %9.1f ms %9.1f ms CPU\n",
+               total, unseen, carray_count(messages->msg_tab),
+               test_time_ms() - start, test_cpu_ms() - cpu);
+    }
+
+    if (messages)
+        mailmessage_list_free(messages);
+    if (folder) {
+        mailfolder_disconnect(folder);
+        mailfolder_free(folder);
+    }
+    mailstorage_free(storage);
+}
+
+/* -------------------------------------------------------------------------- */
+int main(int argc, char *argv[])
+{
+    unsigned int messages = argc > 1 ? atoi(argv[1]) : DEFAULT_MESSAGES;
+    unsigned int percent = argc > 2 ? atoi(argv[2]) : DEFAULT_UNSEEN;
+    unsigned int i, step = percent ? 100 / percent : 0;
+    char *path, *dir;
+    double start;
+
+    path = g_dir_make_tmp("bench_maildir_XXXXXX", NULL);
+    if (!path) {
+        fprintf(stderr, "Cannot create the maildir\n");
+        return EXIT_FAILURE;
+    }
+    for (i = 0; i < 3; i++) {
+        dir = g_build_filename(path, i == 0 ? "new" : i == 1 ? "cur" : "tmp", NULL);
+        g_mkdir(dir, 0700);
+        g_free(dir);
+    }
+
+    start = test_time_ms();
+    for (i = 0; i < messages; i++)
+        write_message(path, i, !step || i % step != 0);
+    printf("%u messages written to %s in %.0f ms\n\n", messages, path,
+           test_time_ms() - start);
+
+    /* the first run warms the page cache, like a mailbox in use */
+    maildir_scan(path, &i, &i, 0, NULL, NULL);
+
+    bench_native(path, 0, false);
+    bench_native(path, 10, true);
+    bench_native(path, 0, true);
+    bench_libetpan(path);
+
+    test_remove_tree(path);
+    g_free(path);
+
+    return EXIT_SUCCESS;
+}
+
+/* vim: set ts=4 sw=4 et: */
@@ -0,0 +1,172 @@
+/*
+ * This file is part of lcd-stuff.
+ *
+ * lcd-stuff is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License.
+ *
+ * lcd-stuff is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with lcd-stuff; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+/*
+ * Compares the mail store with the list that it replaced: a GList of
+ * separately allocated messages, built with g_list_append(), and walked
+ * from its head (g_list_length(), g_list_nth_data()) on each key press.
+ *
+ * Usage: bench_mailstore [messages [cycles]]
+ *
+ * Each cycle builds the unseen mail of one check, pages through all of it
+ * like the user with the Down key, and frees it.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+
+#include <glib.h>
+
+#include "mailstore.h"
+#include "testutil.h"
+
+/* ---------------------- constants ----------------------------------------- */
+#define DEFAULT_MESSAGES    10000
+#define DEFAULT_CYCLES      5
+
+/* ---------------------- types --------------------------------------------- */
+struct list_email {
+    int             message_number_in_box;
+    char            *subject;
+    char            *from;
+};
+
+struct result {
+    double          build_ms;
+    double          page_ms;
+    double          free_ms;
+    size_t          heap;
+    size_t          checksum;
+};
+
+/* -------------------------------------------------------------------------- */
+static void cycle_list(char **from, char **subject, unsigned int n, struct result *r)
+{
+    GList *list = NULL, *cur;
+    size_t heap = test_heap_in_use();
+    double start = test_time_ms();
+    unsigned int i;
+
+    for (i = 0; i < n; i++) {
+        struct list_email *email = g_new0(struct list_email, 1);
+
+        email->from = g_strdup(from[i]);
+        email->subject = g_strdup(subject[i]);
+        email->message_number_in_box = i + 1;
+        list = g_list_append(list, email);
+    }
+    r->build_ms += test_time_ms() - start;
+    r->heap = test_heap_in_use() - heap;
+
+    start = test_time_ms();
+    for (i = 0; i < n; i++) {
+        struct list_email *email;
+
+        if (i >= g_list_length(list))
+            break;
+        email = g_list_nth_data(list, i);
+        r->checksum += email->message_number_in_box + email->from[0];
+    }
+    r->page_ms += test_time_ms() - start;
+
+    start = test_time_ms();
+    for (cur = list; cur; cur = cur->next) {
+        struct list_email *email = cur->data;
+
+        g_free(email->from);
+        g_free(email->subject);
+        g_free(email);
+    }
+    g_list_free(list);
+    r->free_ms += test_time_ms() - start;
+}
+
+/* -------------------------------------------------------------------------- */
+static void cycle_store(char **from, char **subject, unsigned int n, struct result *r)
+{
+    struct mail_store store;
+    size_t heap = test_heap_in_use();
+    double start = test_time_ms();
+    unsigned int i;
+
+    mail_store_init(&store);
+    for (i = 0; i < n; i++)
+        mail_store_add(&store, NULL, from[i], subject[i]);
+    r->build_ms += test_time_ms() - start;
+    r->heap = test_heap_in_use() - heap;
+
+    start = test_time_ms();
+    for (i = 0; i < n; i++) {
+        struct email *email;
+
+        if (i >= store.email->len)
+            break;
+        email = &g_array_index(store.email, struct email, i);
+        r->checksum += email->message_number_in_box + email->from[0];
+    }
+    r->page_ms += test_time_ms() - start;
+
+    start = test_time_ms();
+    mail_store_free(&store);
+    r->free_ms += test_time_ms() - start;
+}
+
+/* -------------------------------------------------------------------------- */
+static void print_result(const char *name, const struct result *r, unsigned int cycles)
+{
+    printf("%-8s build %8.2f ms  page %9.2f ms  free %7.2f ms  heap %6zu KiB\n",
+           name, r->build_ms / cycles, r->page_ms / cycles, r->free_ms / cycles,
+           r->heap / 1024);
+}
+
+/* -------------------------------------------------------------------------- */
+int main(int argc, char *argv[])
+{
+    unsigned int n = argc > 1 ? atoi(argv[1]) : DEFAULT_MESSAGES;
+    unsigned int cycles = argc > 2 ? atoi(argv[2]) : DEFAULT_CYCLES;
+    struct result list = { 0 }, store = { 0 };
+    char **from, **subject;
+    unsigned int i;
+
+    if (n == 0 || cycles == 0)
+        return EXIT_FAILURE;
+
+    from = g_new0(char *, n + 1);
+    subject = g_new0(char *, n + 1);
+    for (i = 0; i < n; i++) {
+        from[i] = g_strdup_printf("Sender %u <sender%u@example.org>", i, i);
+        subject[i] = g_strdup_printf("Subject of the unseen message number %u", i);
+    }
+
+    for (i = 0; i < cycles; i++) {
+        cycle_list(from, subject, n, &list);
+        cycle_store(from, subject, n, &store);
+    }
+
+    printf("%u messages, average of %u cycles\n\n", n, cycles);
+    print_result("GList", &list, cycles);
+    print_result("store", &store, cycles);
+
+    g_strfreev(from);
+    g_strfreev(subject);
+
+    /* both have seen the same messages */
+    return list.checksum == store.checksum ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+/* vim: set ts=4 sw=4 et: */
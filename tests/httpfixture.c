@@ -0,0 +1,213 @@
+/*
+ * This file is part of lcd-stuff.
+ *
+ * lcd-stuff is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License.
+ *
+ * lcd-stuff is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with lcd-stuff; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+#include <stdio.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include <glib.h>
+
+#include "httpfixture.h"
+
+/* ---------------------- constants ----------------------------------------- */
+#define REQUEST_MAX         8192
+#define POLL_MS             100
+#define READ_TIMEOUT_MS     5000
+
+/* ---------------------- types --------------------------------------------- */
+struct http_fixture {
+    int                 fd;
+    int                 port;
+    http_fixture_fun    fun;
+    void                *cookie;
+    GThread             *thread;
+    volatile gint       stop;
+    volatile gint       requests;
+};
+
+/* -------------------------------------------------------------------------- */
+static bool read_request(int fd, char *path, size_t path_len)
+{
+    char buffer[REQUEST_MAX];
+    size_t len = 0;
+    char *start, *end;
+
+    /* a GET has no body, the header is enough */
+    while (len < sizeof(buffer) - 1) {
+        struct pollfd pfd = { fd, POLLIN, 0 };
+        ssize_t n;
+
+        if (poll(&pfd, 1, READ_TIMEOUT_MS) <= 0)
+            return false;
+        n = read(fd, buffer + len, sizeof(buffer) - 1 - len);
+        if (n <= 0)
+            return false;
+        len += n;
+        buffer[len] = '\0';
+        if (strstr(buffer, "\r\n\r\n"))
+            break;
+    }
+
+    start = strchr(buffer, ' ');
+    end = start ? strchr(start + 1, ' ') : NULL;
+    if (!end)
+        return false;
+
+    g_strlcpy(path, start + 1, MIN(path_len, (size_t)(end - start)));
+    return true;
+}
+
+/* -------------------------------------------------------------------------- */
+static void serve(struct http_fixture *fixture, int fd)
+{
+    char path[REQUEST_MAX];
+    GString *response;
+    gsize pos = 0;
+
+    if (!read_request(fd, path, sizeof(path)))
+        return;
+
+    g_atomic_int_inc(&fixture->requests);
+
+    response = g_string_new(NULL);
+    fixture->fun(path, response, fixture->cookie);
+
+    /* the client may have given up already */
+    while (pos < response->len) {
+        ssize_t n = send(fd, response->str + pos, response->len - pos, MSG_NOSIGNAL);
+        if (n <= 0)
+            break;
+        pos += n;
+    }
+
+    g_string_free(response, true);
+}
+
+/* -------------------------------------------------------------------------- */
+static gpointer fixture_thread(gpointer cookie)
+{
+    struct http_fixture *fixture = (struct http_fixture *)cookie;
+
+    while (!g_atomic_int_get(&fixture->stop)) {
+        struct pollfd pfd = { fixture->fd, POLLIN, 0 };
+        int fd;
+
+        if (poll(&pfd, 1, POLL_MS) <= 0)
+            continue;
+
+        fd = accept(fixture->fd, NULL, NULL);
+        if (fd < 0)
+            continue;
+
+        serve(fixture, fd);
+        shutdown(fd, SHUT_WR);
+        close(fd);
+    }
+
+    return NULL;
+}
+
+/* -------------------------------------------------------------------------- */
+struct http_fixture *http_fixture_start(http_fixture_fun fun, void *cookie)
+{
+    struct http_fixture *fixture;
+    struct sockaddr_in addr;
+    socklen_t addr_len = sizeof(addr);
+    int on = 1;
+
+    fixture = g_new0(struct http_fixture, 1);
+    fixture->fun = fun;
+    fixture->cookie = cookie;
+
+    fixture->fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fixture->fd < 0)
+        goto err;
+    setsockopt(fixture->fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = 0;
+    if (bind(fixture->fd, (struct sockaddr *)&addr, sizeof(addr)) != 0 ||
+            listen(fixture->fd, SOMAXCONN) != 0 ||
+            getsockname(fixture->fd, (struct sockaddr *)&addr, &addr_len) != 0)
+        goto err;
+    fixture->port = ntohs(addr.sin_port);
+
+    fixture->thread = g_thread_create(fixture_thread, fixture, true, NULL);
+    if (!fixture->thread)
+        goto err;
+
+    return fixture;
+
+err:
+    fprintf(stderr, "Cannot start the HTTP fixture: %s\n", strerror(errno));
+    if (fixture->fd >= 0)
+        close(fixture->fd);
+    g_free(fixture);
+    return NULL;
+}
+
+/* -------------------------------------------------------------------------- */
+int http_fixture_port(struct http_fixture *fixture)
+{
+    return fixture->port;
+}
+
+/* -------------------------------------------------------------------------- */
+unsigned int http_fixture_requests(struct http_fixture *fixture)
+{
+    return g_atomic_int_get(&fixture->requests);
+}
+
+/* -------------------------------------------------------------------------- */
+void http_fixture_respond(GString       *response,
+                          int           status,
+                          const char    *content_type,
+                          const char    *body,
+                          gsize         len)
+{
+    g_string_append_printf(response,
+            "HTTP/1.1 %d %s\r\n"
+            "Content-Type: %s\r\n"
+            "Content-Length: %lu\r\n"
+            "Connection: close\r\n"
+            "\r\n",
+            status, status == 200 ? "OK" : "Error", content_type,
+            (unsigned long)len);
+    g_string_append_len(response, body, len);
+}
+
+/* -------------------------------------------------------------------------- */
+void http_fixture_stop(struct http_fixture *fixture)
+{
+    if (!fixture)
+        return;
+
+    g_atomic_int_set(&fixture->stop, 1);
+    g_thread_join(fixture->thread);
+    close(fixture->fd);
+    g_free(fixture);
+}
+
+/* vim: set ts=4 sw=4 et: */
@@ -0,0 +1,73 @@
+/*
+ * This file is part of lcd-stuff.
+ *
+ * lcd-stuff is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License.
+ *
+ * lcd-stuff is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with lcd-stuff; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+#ifndef HTTPFIXTURE_H
+#define HTTPFIXTURE_H
+
+#include <glib.h>
+
+/**
+ * @file httpfixture.h
+ * @brief A minimal HTTP server on 127.0.0.1 for the tests.
+ *
+ * Each connection gets one response and is closed then. The response is
+ * written as it is, so a handler can also send broken responses.
+ */
+
+struct http_fixture;
+
+/**
+ * @brief Builds the response for a request.
+ *
+ * @param[in] path the path of the request, e.g. "/feed/1"
+ * @param[out] response the raw response (status line, header and body),
+ *             nothing to close the connection without a response
+ * @param[in] cookie the cookie passed to http_fixture_start()
+ */
+typedef void (*http_fixture_fun)(const char *path, GString *response, void *cookie);
+
+/**
+ * @brief Starts the server in its own thread on a free port.
+ *
+ * @return the server or NULL on error
+ */
+struct http_fixture *http_fixture_start(http_fixture_fun fun, void *cookie);
+
+/**
+ * @brief Returns the port of the server.
+ */
+int http_fixture_port(struct http_fixture *fixture);
+
+/**
+ * @brief Returns the number of requests served so far.
+ */
+unsigned int http_fixture_requests(struct http_fixture *fixture);
+
+/**
+ * @brief Appends a complete response with "Connection: close".
+ */
+void http_fixture_respond(GString *response, int status, const char *content_type,
+                          const char *body, gsize len);
+
+/**
+ * @brief Stops the server and frees it.
+ */
+void http_fixture_stop(struct http_fixture *fixture);
+
+#endif /* HTTPFIXTURE_H */
+
+/* vim: set ts=4 sw=4 et: */
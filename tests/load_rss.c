@@ -0,0 +1,241 @@
+/*
+ * This file is part of lcd-stuff.
+ *
+ * lcd-stuff is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License.
+ *
+ * lcd-stuff is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with lcd-stuff; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+/*
+ * Loads a generated OPML subscription list and fetches all of its feeds
+ * from a local HTTP server, the way the RSS module does on a refresh: with
+ * http_get_all() and the streaming feed parser, which stops each download
+ * when it has enough items.
+ *
+ * Usage: load_rss [feeds [items_per_feed [connections [max_items]]]]
+ *
+ * Prints the time to read the OPML file, the wall and CPU time of the
+ * refresh and the peak RSS of the process.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <unistd.h>
+
+#include <glib.h>
+#include <glib/gstdio.h>
+
+#include "feedparser.h"
+#include "http.h"
+#include "opml.h"
+#include "httpfixture.h"
+#include "testutil.h"
+
+/* ---------------------- constants ----------------------------------------- */
+#define DEFAULT_FEEDS       2000
+#define DEFAULT_ITEMS       20
+#define DEFAULT_CONNECTIONS 8
+#define DEFAULT_MAX_ITEMS   5
+#define TIMEOUT_SEC         30
+
+/* ---------------------- types --------------------------------------------- */
+struct load;
+
+struct load_feed {
+    struct load         *load;
+    char                *url;
+    char                *name;
+    struct feed_parser  *parser;
+};
+
+struct load {
+    GArray              *feeds;         /* of struct load_feed */
+    unsigned int        max_items;
+    unsigned int        items;          /* parsed in all feeds */
+    unsigned int        failed;
+};
+
+/* ---------------------- globals ------------------------------------------- */
+volatile bool g_exit = false;
+
+/* -------------------------------------------------------------------------- */
+static void serve_feed(const char *path, GString *response, void *cookie)
+{
+    unsigned int items = GPOINTER_TO_UINT(cookie), i;
+    GString *feed = g_string_sized_new(items * 512);
+
+    g_string_append_printf(feed,
+            "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n"
+            "<rss version=\"2.0\">\n"
+            "<channel>\n"
+            "<title>Feed %s</title>\n"
+            "<link>http://www.example.org%s</link>\n"
+            "<ttl>30</ttl>\n", path, path);
+    for (i = 0; i < items; i++)
+        g_string_append_printf(feed,
+                "<item>\n"
+                "<title>Headline %u of %s</title>\n"
+                "<link>http://www.example.org%s/%u.html</link>\n"
+                "<pubDate>Mon, %02u Nov 2010 %02u:%02u:00 +0100</pubDate>\n"
+                "<description>The teaser of the article, long enough to give "
+                "the feed the size of a real one. &amp; it has entities."
+                "</description>\n"
+                "</item>\n",
+                items - i, path, path, items - i, 1 + i % 28, i % 24, i % 60);
+    g_string_append(feed, "</channel>\n</rss>\n");
+
+    http_fixture_respond(response, 200, "application/rss+xml", feed->str, feed->len);
+    g_string_free(feed, true);
+}
+
+/* -------------------------------------------------------------------------- */
+static char *write_opml(int port, unsigned int feeds)
+{
+    GString *opml = g_string_sized_new(feeds * 128);
+    char *filename = NULL;
+    unsigned int i;
+    int fd;
+
+    g_string_append(opml,
+            "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n"
+            "<opml version=\"1.0\">\n"
+            "<head><title>Subscriptions</title></head>\n"
+            "<body>\n"
+            "<outline text=\"News\">\n");
+    for (i = 0; i < feeds; i++)
+        g_string_append_printf(opml,
+                "<outline type=\"rss\" text=\"Feed %u\" title=\"Feed %u\" "
+                "xmlUrl=\"http://127.0.0.1:%d/feed/%u\"/>\n", i, i, port, i);
+    g_string_append(opml, "</outline>\n</body>\n</opml>\n");
+
+    fd = g_file_open_tmp("load_rss_XXXXXX.opml", &filename, NULL);
+    if (fd < 0 || !g_file_set_contents(filename, opml->str, opml->len, NULL)) {
+        fprintf(stderr, "Cannot write the OPML file\n");
+        exit(EXIT_FAILURE);
+    }
+    close(fd);
+
+    g_string_free(opml, true);
+    return filename;
+}
+
+/* -------------------------------------------------------------------------- */
+static void add_feed(const char *url, const char *name, void *cookie)
+{
+    struct load *load = (struct load *)cookie;
+    struct load_feed feed = { load, g_strdup(url), g_strdup(name), NULL };
+
+    g_array_append_val(load->feeds, feed);
+}
+
+/* -------------------------------------------------------------------------- */
+static bool feed_data(struct http_transfer *transfer, const char *data, size_t len)
+{
+    struct load_feed *feed = (struct load_feed *)transfer->cookie;
+
+    return feed_parser_parse(feed->parser, data, len);
+}
+
+/* -------------------------------------------------------------------------- */
+static void feed_done(struct http_transfer *transfer)
+{
+    struct load_feed *feed = (struct load_feed *)transfer->cookie;
+    struct load *load = feed->load;
+    GPtrArray *items = NULL;
+
+    if (transfer->result == HTTP_MODIFIED)
+        items = feed_parser_finish(feed->parser);
+
+    if (items)
+        load->items += items->len;
+    else
+        load->failed++;
+
+    feed_parser_free(feed->parser);
+    feed->parser = NULL;
+}
+
+/* -------------------------------------------------------------------------- */
+int main(int argc, char *argv[])
+{
+    unsigned int feeds = argc > 1 ? atoi(argv[1]) : DEFAULT_FEEDS;
+    unsigned int items = argc > 2 ? atoi(argv[2]) : DEFAULT_ITEMS;
+    unsigned int connections = argc > 3 ? atoi(argv[3]) : DEFAULT_CONNECTIONS;
+    struct load load = { NULL, argc > 4 ? atoi(argv[4]) : DEFAULT_MAX_ITEMS, 0, 0 };
+    struct http_transfer *transfers;
+    struct http_fixture *fixture;
+    double start, cpu;
+    char *filename;
+    unsigned int i;
+
+    if (feeds == 0 || load.max_items == 0)
+        return EXIT_FAILURE;
+
+    if (!g_thread_supported())
+        g_thread_init(NULL);
+    http_global_init();
+
+    fixture = http_fixture_start(serve_feed, GUINT_TO_POINTER(items));
+    if (!fixture)
+        return EXIT_FAILURE;
+
+    filename = write_opml(http_fixture_port(fixture), feeds);
+    load.feeds = g_array_sized_new(false, true, sizeof(struct load_feed), feeds);
+
+    start = test_time_ms();
+    if (!opml_read(filename, add_feed, &load)) {
+        fprintf(stderr, "opml_read() failed\n");
+        return EXIT_FAILURE;
+    }
+    printf("OPML with %u feeds read in %.1f ms\n", load.feeds->len,
+           test_time_ms() - start);
+
+    transfers = g_new0(struct http_transfer, load.feeds->len);
+    for (i = 0; i < load.feeds->len; i++) {
+        struct load_feed *feed = &g_array_index(load.feeds, struct load_feed, i);
+
+        feed->parser = feed_parser_new(load.max_items);
+        transfers[i].url = feed->url;
+        transfers[i].data = feed_data;
+        transfers[i].cookie = feed;
+    }
+
+    start = test_time_ms();
+    cpu = test_cpu_ms();
+    http_get_all(transfers, load.feeds->len, connections, TIMEOUT_SEC, feed_done);
+    printf("%u feeds of %u items over %u connections: %.0f ms, %.0f ms CPU, "
+           "%u requests, %u items, %u failed\n",
+           load.feeds->len, items, connections, test_time_ms() - start,
+           test_cpu_ms() - cpu, http_fixture_requests(fixture), load.items,
+           load.failed);
+    printf("peak RSS: %ld KiB\n", test_max_rss_kb());
+
+    for (i = 0; i < load.feeds->len; i++) {
+        struct load_feed *feed = &g_array_index(load.feeds, struct load_feed, i);
+
+        g_free(feed->url);
+        g_free(feed->name);
+    }
+    g_free(transfers);
+    g_array_free(load.feeds, true);
+
+    http_fixture_stop(fixture);
+    http_global_cleanup();
+    g_unlink(filename);
+    g_free(filename);
+
+    return load.failed == 0 && load.items == feeds * MIN(items, load.max_items)
+        ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+/* vim: set ts=4 sw=4 et: */
@@ -0,0 +1,208 @@
+/*
+ * This file is part of lcd-stuff.
+ *
+ * lcd-stuff is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License.
+ *
+ * lcd-stuff is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with lcd-stuff; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+/*
+ * Runs retrieve_weather_data() over and over against a local HTTP server
+ * that answers with good data and with each kind of failure: HTTP errors,
+ * documents that are not well-formed or have no current conditions, a
+ * body that is cut off, a connection closed without an answer and a port
+ * where nobody listens. The good answer has a long tail after the current
+ * conditions, so the download is stopped by the extractor.
+ *
+ * Usage: soak_weather [rounds]
+ *
+ * It is meant to be built with -fsanitize=address, which reports every
+ * leak at exit, see README:
+ *
+ *   cmake -DBUILD_TESTS=ON -DCMAKE_C_FLAGS="-fsanitize=address -g" ..
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include <glib.h>
+
+#include "httpfixture.h"
+#include "testutil.h"
+
+/* the city code is "<port>/<scenario>" */
+#define WEATHER_URL "http://127.0.0.1:%s?unit=%c"
+#include "weatherlib.c"
+
+/* ---------------------- constants ----------------------------------------- */
+#define DEFAULT_ROUNDS      200
+#define TAIL_DAYS           500
+
+/* ---------------------- types --------------------------------------------- */
+struct scenario {
+    const char      *name;
+    int             expected;       /* of retrieve_weather_data() */
+};
+
+/* ---------------------- globals ------------------------------------------- */
+volatile bool g_exit = false;
+
+static const struct scenario s_scenarios[] = {
+    { "ok",         0 },
+    { "404",        -1 },
+    { "500",        -1 },
+    { "malformed",  -1 },
+    { "nocc",       -1 },
+    { "truncated",  -1 },
+    { "close",      -1 },
+    { "refused",    -1 }
+};
+
+#define CC \
+    "<cc><lsup>11/1/10 10:50 AM Local Time</lsup>" \
+    "<tmp>7</tmp><flik>5</flik><t>Partly Cloudy</t>" \
+    "<bar><r>1016.9</r><d>steady</d></bar>" \
+    "<wind><s>11</s><gust>N/A</gust><d>240</d><t>WSW</t></wind>" \
+    "<hmid>81</hmid></cc>"
+
+/* -------------------------------------------------------------------------- */
+static void serve_weather(const char *path, GString *response, void *cookie)
+{
+    GString *body = g_string_new("<?xml version=\"1.0\" encoding=\"ISO-8859-1\"?>\n"
+                                 "<weather ver=\"2.0\"><head><ut>C</ut></head>");
+    unsigned int i;
+
+    if (g_str_has_prefix(path, "/ok")) {
+        g_string_append(body, CC "<dayf>");
+        for (i = 0; i < TAIL_DAYS; i++)
+            g_string_append_printf(body, "<day d=\"%u\"><hi>10</hi><low>2</low>"
+                                         "<part p=\"d\"><t>Showers</t></part></day>", i);
+        g_string_append(body, "</dayf></weather>");
+        http_fixture_respond(response, 200, "text/xml", body->str, body->len);
+    } else if (g_str_has_prefix(path, "/404")) {
+        g_string_append(body, CC "</weather>");
+        http_fixture_respond(response, 404, "text/xml", body->str, body->len);
+    } else if (g_str_has_prefix(path, "/500")) {
+        http_fixture_respond(response, 500, "text/html", "<html>", 6);
+    } else if (g_str_has_prefix(path, "/malformed")) {
+        g_string_append(body, "<cc><tmp>7</tmp><bar><r>1016.9</bar></cc></weather>");
+        http_fixture_respond(response, 200, "text/xml", body->str, body->len);
+    } else if (g_str_has_prefix(path, "/nocc")) {
+        g_string_append(body, "<loc id=\"GMXX0007\"><dnam>Berlin</dnam></loc></weather>");
+        http_fixture_respond(response, 200, "text/xml", body->str, body->len);
+    } else if (g_str_has_prefix(path, "/truncated")) {
+        /* announces more than it sends, and stops inside cc */
+        g_string_append(body, "<cc><tmp>7</tmp><flik>");
+        g_string_append_printf(response,
+                "HTTP/1.1 200 OK\r\n"
+                "Content-Type: text/xml\r\n"
+                "Content-Length: %lu\r\n"
+                "Connection: close\r\n"
+                "\r\n%s", (unsigned long)body->len + 1000, body->str);
+    }
+    /* "close" answers nothing */
+
+    g_string_free(body, true);
+}
+
+/* -------------------------------------------------------------------------- */
+static int closed_port(void)
+{
+    struct sockaddr_in addr;
+    socklen_t len = sizeof(addr);
+    int fd, port = -1;
+
+    fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd < 0)
+        return -1;
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) == 0 &&
+            getsockname(fd, (struct sockaddr *)&addr, &len) == 0)
+        port = ntohs(addr.sin_port);
+
+    /* nobody listens there after this */
+    close(fd);
+    return port;
+}
+
+/* -------------------------------------------------------------------------- */
+static bool check_data(const struct weather_data *data)
+{
+    return data->temp_c == 7 && data->temp_fl_c == 5 && data->humid == 81 &&
+        data->pressure_hPa > 1016.8 && data->pressure_hPa < 1017.0 &&
+        data->wind_speed == 11 && strcmp(data->wind_dir, "WSW") == 0 &&
+        strcmp(data->weather, "Partly Cloudy") == 0;
+}
+
+/* -------------------------------------------------------------------------- */
+int main(int argc, char *argv[])
+{
+    unsigned int rounds = argc > 1 ? atoi(argv[1]) : DEFAULT_ROUNDS;
+    unsigned int n = G_N_ELEMENTS(s_scenarios), round, i, failed = 0;
+    struct http_fixture *fixture;
+    int refused;
+    double start;
+
+    /* the failures are expected, only the wrong results are printed */
+    set_reporting("soak_weather", RPT_CRIT, RPT_DEST_STDERR);
+
+    if (!g_thread_supported())
+        g_thread_init(NULL);
+    http_global_init();
+
+    fixture = http_fixture_start(serve_weather, NULL);
+    refused = closed_port();
+    if (!fixture || refused < 0)
+        return EXIT_FAILURE;
+
+    start = test_time_ms();
+    for (round = 0; round < rounds; round++) {
+        for (i = 0; i < n; i++) {
+            const struct scenario *scenario = &s_scenarios[i];
+            struct weather_data data;
+            char code[64];
+            int ret;
+
+            g_snprintf(code, sizeof(code), "%d/%s",
+                       strcmp(scenario->name, "refused") == 0 ? refused
+                                                              : http_fixture_port(fixture),
+                       scenario->name);
+            memset(&data, 0, sizeof(data));
+
+            ret = retrieve_weather_data(code, &data, UNIT_METRIC);
+            if (ret != scenario->expected || (ret == 0 && !check_data(&data))) {
+                fprintf(stderr, "Round %u, %s: returned %d, expected %d\n",
+                        round, scenario->name, ret, scenario->expected);
+                failed++;
+            }
+        }
+    }
+
+    printf("%u rounds of %u scenarios in %.0f ms, %u requests served, %u failed\n",
+           rounds, n, test_time_ms() - start, http_fixture_requests(fixture), failed);
+    printf("peak RSS: %ld KiB\n", test_max_rss_kb());
+
+    http_fixture_stop(fixture);
+    http_global_cleanup();
+
+    return failed == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+/* vim: set ts=4 sw=4 et: */
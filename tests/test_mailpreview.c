@@ -0,0 +1,145 @@
+/*
+ * This file is part of lcd-stuff.
+ *
+ * lcd-stuff is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License.
+ *
+ * lcd-stuff is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with lcd-stuff; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+/*
+ * Checks the one-line previews of mail_preview() for the usual structures
+ * of mail: single parts with transfer encoding and charset, alternatives
+ * of text and HTML, nested multiparts and bodies with a signature.
+ *
+ * Usage: test_mailpreview
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <glib.h>
+
+#include "maillib.h"
+#include "util.h"
+
+/* ---------------------- types --------------------------------------------- */
+struct preview_case {
+    const char      *name;
+    const char      *header;        /* NULL like IMAP TEXT without header */
+    const char      *body;
+    const char      *expected;
+};
+
+/* ---------------------- globals ------------------------------------------- */
+static const struct preview_case s_cases[] = {
+    {
+        "plain",
+        "Content-Type: text/plain; charset=us-ascii\n\n",
+        "Hello,\n\nthe meeting is at  10.\n",
+        "Hello, the meeting is at 10."
+    },
+    {
+        "quoted-printable utf-8",
+        "Content-Type: text/plain; charset=UTF-8\n"
+        "Content-Transfer-Encoding: quoted-printable\n\n",
+        "Gr=C3=BC=C3=9Fe aus M=C3=BCn=\nchen\n",
+        "Gr\xfc\xdf" "e aus M\xfcnchen"
+    },
+    {
+        "alternative text and html",
+        "MIME-Version: 1.0\n"
+        "Content-Type: multipart/alternative; boundary=\"=_alt\"\n\n",
+        "This is a multi-part message in MIME format.\n"
+        "--=_alt\n"
+        "Content-Type: text/plain; charset=iso-8859-1\n\n"
+        "The plain text.\n"
+        "--=_alt\n"
+        "Content-Type: text/html; charset=iso-8859-1\n\n"
+        "<html><body>The HTML.</body></html>\n"
+        "--=_alt--\n",
+        "The plain text."
+    },
+    {
+        "mixed with nested alternative",
+        "Content-Type: multipart/mixed; boundary=outer\n\n",
+        "--outer\n"
+        "Content-Type: multipart/alternative; boundary=inner\n\n"
+        "--inner\n"
+        "Content-Type: text/plain\n"
+        "Content-Transfer-Encoding: base64\n\n"
+        "VGhlIGJhc2U2NCB0ZXh0Lg==\n"
+        "--inner\n"
+        "Content-Type: text/html\n\n"
+        "<p>HTML</p>\n"
+        "--inner--\n"
+        "--outer\n"
+        "Content-Type: application/pdf\n\n"
+        "JVBERi0xLjQK\n"
+        "--outer--\n",
+        "The base64 text."
+    },
+    {
+        "part without type",
+        "Content-Type: multipart/mixed; boundary=b\n\n",
+        "--b\n"
+        "Content-Disposition: inline\n\n"
+        "Untyped text.\n"
+        "--b--\n",
+        "Untyped text."
+    },
+    {
+        "signature in single part",
+        "Content-Type: text/plain\n\n",
+        "Short.\n-- \nContent-Type: not a header\n\nJohn\n",
+        "Short. -- Content-Type: not a header John"
+    },
+    {
+        "imap text without header",
+        NULL,
+        "--=_alt\n"
+        "Content-Type: text/plain\n\n"
+        "First part.\n"
+        "--=_alt\n"
+        "Content-Type: text/html\n\n"
+        "<b>Second</b>\n"
+        "--=_alt--\n",
+        "First part."
+    }
+};
+
+/* -------------------------------------------------------------------------- */
+int main(int argc, char *argv[])
+{
+    unsigned int i, failed = 0;
+
+    string_canon_init();
+
+    for (i = 0; i < G_N_ELEMENTS(s_cases); i++) {
+        const struct preview_case *c = &s_cases[i];
+        char *preview;
+
+        preview = mail_preview(c->header, c->header ? strlen(c->header) : 0,
+                               c->body, strlen(c->body));
+        if (!preview || strcmp(preview, c->expected) != 0) {
+            printf("FAIL %-32s \"%s\", expected \"%s\"\n", c->name,
+                   preview ? preview : "(null)", c->expected);
+            failed++;
+        } else
+            printf("ok   %s\n", c->name);
+        g_free(preview);
+    }
+
+    return failed == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+/* vim: set ts=4 sw=4 et: */
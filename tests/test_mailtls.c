@@ -0,0 +1,442 @@
+/*
+ * This file is part of lcd-stuff.
+ *
+ * lcd-stuff is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License.
+ *
+ * lcd-stuff is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with lcd-stuff; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+/*
+ * Checks the TLS streams of mailtls.c against a local OpenSSL server whose
+ * certificate for "localhost" is signed by a CA that is generated for the
+ * test: verification against the system CAs and against the wrong host
+ * name must fail, with the CA file it must succeed, and the second
+ * connection of an account must resume the session. This is done for
+ * implicit TLS with TLS 1.3 and TLS 1.2 and for STARTTLS.
+ *
+ * Usage: test_mailtls
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include <glib.h>
+#include <glib/gstdio.h>
+
+#include <openssl/ssl.h>
+#include <openssl/err.h>
+#include <openssl/pem.h>
+#include <openssl/x509v3.h>
+
+#include <libetpan/libetpan.h>
+
+#include <shared/report.h>
+
+#include "mailtls.h"
+
+/* ---------------------- constants ----------------------------------------- */
+#define SERVER_NAME         "localhost"
+#define POLL_MS             100
+#define LINE_MAX_LEN        256
+
+/* ---------------------- types --------------------------------------------- */
+enum listener_kind {
+    LISTEN_TLS13,                   /* implicit TLS */
+    LISTEN_TLS12,                   /* implicit TLS, at most TLS 1.2 */
+    LISTEN_STARTTLS,                /* plain greeting, then STARTTLS */
+    LISTEN_KINDS
+};
+
+struct tls_server {
+    int                 fd[LISTEN_KINDS];
+    int                 port[LISTEN_KINDS];
+    SSL_CTX             *ctx[LISTEN_KINDS];
+    GThread             *thread;
+    volatile gint       stop;
+};
+
+/* -------------------------------------------------------------------------- */
+static EVP_PKEY *make_key(void)
+{
+    EVP_PKEY_CTX *ctx = EVP_PKEY_CTX_new_id(EVP_PKEY_RSA, NULL);
+    EVP_PKEY *key = NULL;
+
+    if (!ctx || EVP_PKEY_keygen_init(ctx) <= 0 ||
+            EVP_PKEY_CTX_set_rsa_keygen_bits(ctx, 2048) <= 0 ||
+            EVP_PKEY_keygen(ctx, &key) <= 0)
+        key = NULL;
+    EVP_PKEY_CTX_free(ctx);
+
+    return key;
+}
+
+/* -------------------------------------------------------------------------- */
+static bool add_extension(X509 *cert, X509 *issuer, int nid, const char *value)
+{
+    X509V3_CTX ctx;
+    X509_EXTENSION *ext;
+    bool ok;
+
+    X509V3_set_ctx(&ctx, issuer, cert, NULL, NULL, 0);
+    ext = X509V3_EXT_conf_nid(NULL, &ctx, nid, (char *)value);
+    if (!ext)
+        return false;
+    ok = X509_add_ext(cert, ext, -1) == 1;
+    X509_EXTENSION_free(ext);
+
+    return ok;
+}
+
+/*
+ * Creates a certificate for @p key with the common name @p cn, signed by
+ * @p issuer with @p issuer_key, or self-signed if @p issuer is NULL.
+ */
+static X509 *make_cert(EVP_PKEY *key, const char *cn, long serial,
+                       X509 *issuer, EVP_PKEY *issuer_key)
+{
+    X509 *cert = X509_new();
+    X509_NAME *name;
+    bool ca = issuer == NULL;
+
+    X509_set_version(cert, 2);
+    ASN1_INTEGER_set(X509_get_serialNumber(cert), serial);
+    X509_gmtime_adj(X509_get_notBefore(cert), -60);
+    X509_gmtime_adj(X509_get_notAfter(cert), 24*60*60);
+    X509_set_pubkey(cert, key);
+
+    name = X509_get_subject_name(cert);
+    X509_NAME_add_entry_by_txt(name, "CN", MBSTRING_ASC, (const unsigned char *)cn, -1, -1, 0);
+    X509_set_issuer_name(cert, ca ? name : X509_get_subject_name(issuer));
+
+    if (!add_extension(cert, ca ? cert : issuer, NID_basic_constraints,
+                       ca ? "critical,CA:TRUE" : "CA:FALSE") ||
+            (ca && !add_extension(cert, cert, NID_key_usage, "critical,keyCertSign")) ||
+            (!ca && !add_extension(cert, issuer, NID_subject_alt_name, "DNS:" SERVER_NAME)) ||
+            !X509_sign(cert, ca ? key : issuer_key, EVP_sha256())) {
+        X509_free(cert);
+        return NULL;
+    }
+
+    return cert;
+}
+
+/* -------------------------------------------------------------------------- */
+static bool read_plain_line(int fd, char *line)
+{
+    size_t len = 0;
+
+    while (len + 1 < LINE_MAX_LEN) {
+        if (read(fd, line + len, 1) != 1)
+            return false;
+        if (line[len++] == '\n')
+            break;
+    }
+    line[len] = '\0';
+
+    return true;
+}
+
+/* -------------------------------------------------------------------------- */
+static void serve(struct tls_server *server, enum listener_kind kind, int fd)
+{
+    static const char greeting[] = "* OK ready\r\n";
+    static const char begin[] = "OK begin TLS\r\n";
+    static const char hello[] = "* OK TLS\r\n";
+    char line[LINE_MAX_LEN];
+    SSL *ssl;
+
+    if (kind == LISTEN_STARTTLS) {
+        if (write(fd, greeting, strlen(greeting)) < 0 || !read_plain_line(fd, line) ||
+                strncmp(line, "STARTTLS", 8) != 0 || write(fd, begin, strlen(begin)) < 0)
+            return;
+    }
+
+    ssl = SSL_new(server->ctx[kind]);
+    SSL_set_fd(ssl, fd);
+
+    /* the greeting makes the client read the TLS 1.3 tickets */
+    if (SSL_accept(ssl) == 1 && SSL_write(ssl, hello, strlen(hello)) > 0) {
+        while (SSL_read(ssl, line, sizeof(line)) > 0)
+            ;
+        SSL_shutdown(ssl);
+    }
+
+    SSL_free(ssl);
+    ERR_clear_error();
+}
+
+/* -------------------------------------------------------------------------- */
+static gpointer server_thread(gpointer cookie)
+{
+    struct tls_server *server = (struct tls_server *)cookie;
+
+    while (!g_atomic_int_get(&server->stop)) {
+        struct pollfd pfd[LISTEN_KINDS];
+        int kind;
+
+        for (kind = 0; kind < LISTEN_KINDS; kind++) {
+            pfd[kind].fd = server->fd[kind];
+            pfd[kind].events = POLLIN;
+            pfd[kind].revents = 0;
+        }
+        if (poll(pfd, LISTEN_KINDS, POLL_MS) <= 0)
+            continue;
+
+        for (kind = 0; kind < LISTEN_KINDS; kind++) {
+            int fd;
+
+            if (!(pfd[kind].revents & POLLIN))
+                continue;
+            fd = accept(server->fd[kind], NULL, NULL);
+            if (fd < 0)
+                continue;
+            serve(server, kind, fd);
+            close(fd);
+        }
+    }
+
+    return NULL;
+}
+
+/* -------------------------------------------------------------------------- */
+static int listen_local(int *port)
+{
+    struct sockaddr_in addr;
+    socklen_t len = sizeof(addr);
+    int fd;
+
+    fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd < 0)
+        return -1;
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0 ||
+            listen(fd, SOMAXCONN) != 0 ||
+            getsockname(fd, (struct sockaddr *)&addr, &len) != 0) {
+        close(fd);
+        return -1;
+    }
+    *port = ntohs(addr.sin_port);
+
+    return fd;
+}
+
+/* -------------------------------------------------------------------------- */
+static struct tls_server *server_start(X509 *cert, EVP_PKEY *key)
+{
+    struct tls_server *server = g_new0(struct tls_server, 1);
+    int kind;
+
+    for (kind = 0; kind < LISTEN_KINDS; kind++) {
+        server->ctx[kind] = SSL_CTX_new(SSLv23_server_method());
+        if (!server->ctx[kind] ||
+                SSL_CTX_use_certificate(server->ctx[kind], cert) != 1 ||
+                SSL_CTX_use_PrivateKey(server->ctx[kind], key) != 1)
+            return NULL;
+        if (kind == LISTEN_TLS12)
+            SSL_CTX_set_max_proto_version(server->ctx[kind], TLS1_2_VERSION);
+
+        server->fd[kind] = listen_local(&server->port[kind]);
+        if (server->fd[kind] < 0)
+            return NULL;
+    }
+
+    server->thread = g_thread_create(server_thread, server, true, NULL);
+    return server->thread ? server : NULL;
+}
+
+/* -------------------------------------------------------------------------- */
+static void server_stop(struct tls_server *server)
+{
+    int kind;
+
+    g_atomic_int_set(&server->stop, 1);
+    g_thread_join(server->thread);
+    for (kind = 0; kind < LISTEN_KINDS; kind++) {
+        close(server->fd[kind]);
+        SSL_CTX_free(server->ctx[kind]);
+    }
+    g_free(server);
+}
+
+/* -------------------------------------------------------------------------- */
+static bool read_line(mailstream *stream, const char *expected)
+{
+    char line[LINE_MAX_LEN];
+    size_t len = 0;
+
+    while (len + 1 < sizeof(line)) {
+        if (mailstream_read(stream, line + len, 1) != 1)
+            return false;
+        if (line[len++] == '\n')
+            break;
+    }
+    line[len] = '\0';
+
+    return strncmp(line, expected, strlen(expected)) == 0;
+}
+
+/*
+ * One connection of an account, like mail_connect() does it. Returns true
+ * if the handshake succeeded and the greeting arrived over TLS.
+ */
+static bool client_connect(struct mail_tls *tls, enum listener_kind kind, int port)
+{
+    mailstream_low *low;
+    mailstream *stream;
+    bool ok;
+    int fd;
+
+    fd = mail_tls_tcp_connect(SERVER_NAME, port);
+    if (fd < 0)
+        return false;
+
+    if (kind == LISTEN_STARTTLS) {
+        low = mailstream_low_socket_open(fd);
+        stream = low ? mailstream_new(low, 1024) : NULL;
+        if (!stream) {
+            close(fd);
+            return false;
+        }
+        ok = read_line(stream, "* OK") &&
+            mailstream_write(stream, "STARTTLS\r\n", 10) == 10 &&
+            mailstream_flush(stream) == 0 &&
+            read_line(stream, "OK") &&
+            mail_tls_upgrade(tls, stream);
+    } else {
+        low = mail_tls_handshake(tls, fd);
+        if (!low) {
+            close(fd);
+            return false;
+        }
+        stream = mailstream_new(low, 1024);
+        ok = stream != NULL;
+    }
+
+    ok = ok && read_line(stream, "* OK TLS");
+    mailstream_close(stream);
+
+    return ok;
+}
+
+/* -------------------------------------------------------------------------- */
+static const char *s_kind_names[LISTEN_KINDS] = { "TLS 1.3", "TLS 1.2", "STARTTLS" };
+
+static bool check_kind(struct tls_server *server, enum listener_kind kind,
+                       const char *ca_file)
+{
+    struct mail_tls_stats stats;
+    struct mail_tls *tls;
+    int port = server->port[kind];
+    bool ok = true;
+
+    /* the generated CA is not among the system CAs */
+    tls = mail_tls_new(SERVER_NAME, NULL);
+    if (!tls || client_connect(tls, kind, port)) {
+        printf("FAIL %-9s verified without the CA file\n", s_kind_names[kind]);
+        ok = false;
+    }
+    mail_tls_free(tls);
+
+    /* the certificate is for localhost only */
+    tls = mail_tls_new("127.0.0.1", ca_file);
+    if (!tls || client_connect(tls, kind, port)) {
+        printf("FAIL %-9s verified with the wrong host name\n", s_kind_names[kind]);
+        ok = false;
+    }
+    mail_tls_free(tls);
+
+    tls = mail_tls_new(SERVER_NAME, ca_file);
+    if (!tls || !client_connect(tls, kind, port) || !client_connect(tls, kind, port)) {
+        printf("FAIL %-9s no connection with the CA file\n", s_kind_names[kind]);
+        mail_tls_free(tls);
+        return false;
+    }
+
+    mail_tls_get_stats(tls, &stats);
+    if (stats.handshakes != 2 || stats.resumed != 1) {
+        printf("FAIL %-9s %u handshakes, %u resumed\n", s_kind_names[kind],
+               stats.handshakes, stats.resumed);
+        ok = false;
+    } else
+        printf("%s %-9s full handshake %.1f ms, resumed %.1f ms\n", ok ? "ok  " : "FAIL",
+               s_kind_names[kind], stats.total_ms - stats.last_ms, stats.last_ms);
+    mail_tls_free(tls);
+
+    return ok;
+}
+
+/* -------------------------------------------------------------------------- */
+int main(int argc, char *argv[])
+{
+    EVP_PKEY *ca_key, *key;
+    X509 *ca, *cert;
+    struct tls_server *server;
+    char *ca_file = NULL;
+    FILE *fp;
+    int kind, fd, failed = 0;
+
+    /* the failing handshakes are expected */
+    set_reporting("test_mailtls", RPT_CRIT, RPT_DEST_STDERR);
+
+    if (!g_thread_supported())
+        g_thread_init(NULL);
+    SSL_library_init();
+    SSL_load_error_strings();
+
+    ca_key = make_key();
+    key = make_key();
+    ca = ca_key ? make_cert(ca_key, "lcd-stuff test CA", 1, NULL, NULL) : NULL;
+    cert = ca && key ? make_cert(key, SERVER_NAME, 2, ca, ca_key) : NULL;
+    if (!cert) {
+        fprintf(stderr, "Cannot create the certificates\n");
+        return EXIT_FAILURE;
+    }
+
+    fd = g_file_open_tmp("test_mailtls_XXXXXX.pem", &ca_file, NULL);
+    fp = fd >= 0 ? fdopen(fd, "w") : NULL;
+    if (!fp || !PEM_write_X509(fp, ca) || fclose(fp) != 0) {
+        fprintf(stderr, "Cannot write the CA file\n");
+        return EXIT_FAILURE;
+    }
+
+    server = server_start(cert, key);
+    if (!server) {
+        fprintf(stderr, "Cannot start the TLS server\n");
+        return EXIT_FAILURE;
+    }
+
+    for (kind = 0; kind < LISTEN_KINDS; kind++)
+        if (!check_kind(server, kind, ca_file))
+            failed++;
+
+    server_stop(server);
+    g_unlink(ca_file);
+    g_free(ca_file);
+    X509_free(cert);
+    X509_free(ca);
+    EVP_PKEY_free(key);
+    EVP_PKEY_free(ca_key);
+
+    return failed == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+/* vim: set ts=4 sw=4 et: */
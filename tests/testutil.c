@@ -0,0 +1,82 @@
+/*
+ * This file is part of lcd-stuff.
+ *
+ * lcd-stuff is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License.
+ *
+ * lcd-stuff is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with lcd-stuff; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+#define _XOPEN_SOURCE 500
+#include <stdio.h>
+#include <malloc.h>
+#include <ftw.h>
+#include <time.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+
+#include "testutil.h"
+
+/* -------------------------------------------------------------------------- */
+double test_time_ms(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
+
+/* -------------------------------------------------------------------------- */
+double test_cpu_ms(void)
+{
+    struct rusage usage;
+
+    getrusage(RUSAGE_SELF, &usage);
+    return (usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) * 1000.0 +
+        (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) / 1000.0;
+}
+
+/* -------------------------------------------------------------------------- */
+size_t test_heap_in_use(void)
+{
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || __GLIBC_MINOR__ >= 33)
+    struct mallinfo2 info = mallinfo2();
+    return info.uordblks + info.hblkhd;
+#else
+    struct mallinfo info = mallinfo();
+    return (size_t)info.uordblks + (size_t)info.hblkhd;
+#endif
+}
+
+/* -------------------------------------------------------------------------- */
+long test_max_rss_kb(void)
+{
+    struct rusage usage;
+
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_maxrss;
+}
+
+/* -------------------------------------------------------------------------- */
+static int remove_entry(const char *path, const struct stat *sb, int flag, struct FTW *ftw)
+{
+    if (remove(path) != 0)
+        perror(path);
+    return 0;
+}
+
+/* -------------------------------------------------------------------------- */
+void test_remove_tree(const char *path)
+{
+    nftw(path, remove_entry, 64, FTW_DEPTH | FTW_PHYS);
+}
+
+/* vim: set ts=4 sw=4 et: */
@@ -0,0 +1,56 @@
+/*
+ * This file is part of lcd-stuff.
+ *
+ * lcd-stuff is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License.
+ *
+ * lcd-stuff is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with lcd-stuff; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+#ifndef TESTUTIL_H
+#define TESTUTIL_H
+
+#include <stddef.h>
+
+/**
+ * @file testutil.h
+ * @brief Helpers shared by the benchmarks and soak tests.
+ */
+
+/**
+ * @brief Returns a monotonic time in milliseconds.
+ */
+double test_time_ms(void);
+
+/**
+ * @brief Returns the CPU time (user and system) of the process in
+ *        milliseconds.
+ */
+double test_cpu_ms(void);
+
+/**
+ * @brief Returns the bytes currently allocated with malloc().
+ */
+size_t test_heap_in_use(void);
+
+/**
+ * @brief Returns the peak resident set size of the process in KiB.
+ */
+long test_max_rss_kb(void);
+
+/**
+ * @brief Removes @p path with everything below it.
+ */
+void test_remove_tree(const char *path);
+
+#endif /* TESTUTIL_H */
+
+/* vim: set ts=4 sw=4 et: */